@@ -0,0 +1,294 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <miniglib.h>
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct record {
+    uint64_t fields[8];
+};
+
+#define u64_less(a, b) (*(a) < *(b))
+
+G_ARRAY_SORT_DEFINE(u64, uint64_t, u64_less)
+
+static int compare_u64(const void *a, const void *b) {
+    return (*(const uint64_t*) a > *(const uint64_t*) b) - (*(const uint64_t*) a < *(const uint64_t*) b);
+}
+
+enum sort_kind {
+    SORT_QSORT,
+    SORT_GENERIC,
+    SORT_INLINED,
+    SORT_STABLE,
+    SORT_RADIX,
+};
+
+static double bench_sort(const uint64_t *keys, size_t n, enum sort_kind kind) {
+    GArray *array = g_array_sized_new(false, false, sizeof(uint64_t), n);
+    g_array_append_vals(array, keys, n);
+
+    double start = now();
+    switch (kind) {
+        case SORT_QSORT:
+            qsort(array->data, array->len, sizeof(uint64_t), compare_u64);
+            break;
+        case SORT_GENERIC:
+            g_array_sort(array, compare_u64);
+            break;
+        case SORT_INLINED:
+            g_array_sort_u64(array);
+            break;
+        case SORT_STABLE:
+            g_array_sort_stable(array, compare_u64);
+            break;
+        case SORT_RADIX:
+            g_array_sort_by_key(array, G_ARRAY_KEY_UINT64, 0);
+            break;
+    }
+    double elapsed = now() - start;
+
+    for (size_t i = 1; i < n; i++) {
+        if (g_array_index(array, uint64_t, i - 1) > g_array_index(array, uint64_t, i)) {
+            fprintf(stderr, "FATAL ERROR: garray_bench: Array is not sorted");
+            exit(1);
+        }
+    }
+
+    g_array_free(array, true);
+
+    return elapsed;
+}
+
+// records of element_size bytes with a uint64 key in front
+static int compare_keys(const void *a, const void *b, void *user_data) {
+    return compare_u64(a, b);
+}
+
+static double bench_sort_parallel(const uint64_t *keys, size_t n, size_t element_size, uint32_t num_threads) {
+    GArray *array = g_array_sized_new(false, true, element_size, n);
+    g_array_set_size(array, n);
+    for (size_t i = 0; i < n; i++) {
+        memcpy(&array->data[i * element_size], &keys[i], sizeof(uint64_t));
+    }
+
+    double start = now();
+    g_array_sort_parallel_with_data(array, compare_keys, NULL, num_threads, NULL);
+    double elapsed = now() - start;
+
+    g_array_free(array, true);
+
+    return elapsed;
+}
+
+// lower bounds of random keys, half of them present, in a sorted array
+static void bench_search(const uint64_t *keys, size_t n, size_t probes) {
+    GArray *array = g_array_sized_new(false, false, sizeof(uint64_t), n);
+    g_array_append_vals(array, keys, n);
+    g_array_sort_by_key(array, G_ARRAY_KEY_UINT64, 0);
+
+    GArray *targets = g_array_sized_new(false, false, sizeof(uint64_t), probes);
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    for (size_t i = 0; i < probes; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint64_t target = state % 2 ? keys[state % n] : state;
+        g_array_append_val(targets, target);
+    }
+
+    size_t *indices = malloc(probes * sizeof(size_t));
+    if (indices == NULL) {
+        fprintf(stderr, "FATAL ERROR: garray_bench: Out of memory");
+        exit(1);
+    }
+    size_t found = 0;
+
+    double start = now();
+    for (size_t i = 0; i < probes; i++) {
+        found += bsearch(&g_array_index(targets, uint64_t, i), array->data, n, sizeof(uint64_t), compare_u64) != NULL;
+    }
+    double bsearch_time = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < probes; i++) {
+        found += g_array_lower_bound(array, &g_array_index(targets, uint64_t, i), compare_u64);
+    }
+    double lower_bound_time = now() - start;
+
+    start = now();
+    GArrayEytzinger *index = g_array_eytzinger_new(array);
+    double build_time = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < probes; i++) {
+        found += g_array_eytzinger_lower_bound(index, &g_array_index(targets, uint64_t, i), compare_u64);
+    }
+    double eytzinger_time = now() - start;
+
+    start = now();
+    g_array_search_many(array, targets->data, probes, compare_u64, indices);
+    double many_time = now() - start;
+    found += indices[probes - 1];
+
+    printf("n=%-9zu search  bsearch %6.2f Mops/s  lower_bound %6.2f Mops/s  eytzinger %6.2f Mops/s (built in %.0f ms)  search_many %6.2f Mops/s  (%zu)\n",
+            n, probes / bsearch_time / 1e6, probes / lower_bound_time / 1e6, probes / eytzinger_time / 1e6,
+            build_time * 1e3, probes / many_time / 1e6, found % 10);
+
+    g_array_eytzinger_free(index);
+    free(indices);
+    g_array_free(targets, true);
+    g_array_free(array, true);
+}
+
+#if !(defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+#define MAPPED_PATH "garray_bench.mapped"
+
+// reading a file into a buffer and appending it to an array, versus mapping
+// it, both until the array is ready and after a pass over every element
+static void bench_load(const uint64_t *keys, size_t n) {
+    FILE *file = fopen(MAPPED_PATH, "wb");
+    if (file == NULL || fwrite(keys, sizeof(uint64_t), n, file) != n) {
+        fprintf(stderr, "FATAL ERROR: garray_bench: Can't write " MAPPED_PATH);
+        exit(1);
+    }
+    fclose(file);
+
+    uint64_t sum = 0;
+
+    double start = now();
+    file = fopen(MAPPED_PATH, "rb");
+    uint64_t *buffer = malloc(n * sizeof(uint64_t));
+    if (file == NULL || buffer == NULL || fread(buffer, sizeof(uint64_t), n, file) != n) {
+        fprintf(stderr, "FATAL ERROR: garray_bench: Can't read " MAPPED_PATH);
+        exit(1);
+    }
+    fclose(file);
+    GArray *array = g_array_sized_new(false, false, sizeof(uint64_t), n);
+    g_array_append_vals(array, buffer, n);
+    free(buffer);
+    double read_time = now() - start;
+    for (size_t i = 0; i < n; i++) {
+        sum += g_array_index(array, uint64_t, i);
+    }
+    double read_scan_time = now() - start;
+    g_array_free(array, true);
+
+    start = now();
+    array = g_array_new_mapped(MAPPED_PATH, sizeof(uint64_t), G_ARRAY_MAP_READ_ONLY);
+    if (array == NULL) {
+        fprintf(stderr, "FATAL ERROR: garray_bench: Can't map " MAPPED_PATH);
+        exit(1);
+    }
+    double map_time = now() - start;
+    for (size_t i = 0; i < n; i++) {
+        sum += g_array_index(array, uint64_t, i);
+    }
+    double map_scan_time = now() - start;
+    g_array_free(array, true);
+
+    start = now();
+    array = g_array_map_writable(MAPPED_PATH, sizeof(uint64_t));
+    g_array_append_vals(array, keys, n);
+    g_array_sync(array);
+    double append_time = now() - start;
+    g_array_free(array, true);
+
+    remove(MAPPED_PATH);
+
+    printf("n=%-9zu load  read + append %8.2f ms (%8.2f ms with a pass)  mapped %8.3f ms (%8.2f ms with a pass)  writable append + sync %8.2f ms  (%" PRIu64 ")\n",
+            n, read_time * 1e3, read_scan_time * 1e3, map_time * 1e3, map_scan_time * 1e3, append_time * 1e3, sum % 10);
+}
+#endif
+
+// exact fit reallocates on every append, as GArray did before it grew
+// geometrically
+static double bench_append(size_t n, unsigned int element_size, bool exact, bool reserve) {
+    char value[sizeof(struct record)] = {0};
+
+    double start = now();
+    GArray *array = g_array_new(false, false, element_size);
+    if (reserve) {
+        g_array_reserve(array, n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        value[0] = (char) i;
+        g_array_append_vals(array, value, 1);
+        if (exact) {
+            g_array_shrink_to_fit(array);
+        }
+    }
+    double elapsed = now() - start;
+
+    g_array_free(array, true);
+
+    return elapsed;
+}
+
+int garray_bench(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t sort_n = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000000;
+    uint32_t max_threads = argc > 3 ? (uint32_t) strtoul(argv[3], NULL, 10) : 8;
+    size_t probes = argc > 4 ? strtoull(argv[4], NULL, 10) : 5000000;
+    unsigned int sizes[] = {sizeof(uint32_t), sizeof(struct record)};
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        double exact_time = bench_append(n, sizes[s], true, false);
+        double growth_time = bench_append(n, sizes[s], false, false);
+        double reserve_time = bench_append(n, sizes[s], false, true);
+
+        printf("n=%-9zu element %2u B  append exact fit %8.2f Mops/s  x%g growth %8.2f Mops/s  reserved %8.2f Mops/s\n",
+                n, sizes[s], n / exact_time / 1e6, (double) GARRAY_GROWTH_FACTOR, n / growth_time / 1e6, n / reserve_time / 1e6);
+    }
+
+    uint64_t *keys = malloc(sort_n * sizeof(uint64_t));
+    if (keys == NULL) {
+        fprintf(stderr, "FATAL ERROR: garray_bench: Out of memory");
+        exit(1);
+    }
+
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < sort_n; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        keys[i] = state;
+    }
+
+    printf("n=%-9zu sort uint64  qsort %8.2f ms  g_array_sort %8.2f ms  inlined %8.2f ms  stable %8.2f ms  radix %8.2f ms\n",
+            sort_n, bench_sort(keys, sort_n, SORT_QSORT) * 1e3, bench_sort(keys, sort_n, SORT_GENERIC) * 1e3,
+            bench_sort(keys, sort_n, SORT_INLINED) * 1e3, bench_sort(keys, sort_n, SORT_STABLE) * 1e3,
+            bench_sort(keys, sort_n, SORT_RADIX) * 1e3);
+
+    size_t element_sizes[] = {sizeof(uint64_t), 16, 64};
+    for (size_t s = 0; s < sizeof(element_sizes) / sizeof(element_sizes[0]); s++) {
+        double single_time = 0;
+
+        for (uint32_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+            double time = bench_sort_parallel(keys, sort_n, element_sizes[s], num_threads);
+            if (num_threads == 1) {
+                single_time = time;
+            }
+
+            printf("n=%-9zu sort_parallel element %2zu B  threads %3u  %8.2f ms  speedup %5.2fx\n",
+                    sort_n, element_sizes[s], num_threads, time * 1e3, single_time / time);
+        }
+    }
+
+    bench_search(keys, sort_n, probes);
+#if !(defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+    bench_load(keys, sort_n);
+#endif
+
+    free(keys);
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+#include <miniglib.h>
+
+#define MAX_THREADS 64
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct bench_state {
+    GConcurrentHashTable *concurrent;
+    GHashTable *locked;
+    mtx_t lock;
+    size_t n;
+    size_t lookups;
+    atomic_size_t found;
+};
+
+static int concurrent_reader(void *data) {
+    struct bench_state *state = data;
+    uint64_t x = (uint64_t) (uintptr_t) &data;
+    size_t found = 0;
+
+    for (size_t i = 0; i < state->lookups; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        found += g_concurrent_hash_table_lookup(state->concurrent, (void*) (uintptr_t) ((x >> 33) % state->n + 1)) != NULL;
+    }
+
+    atomic_fetch_add(&state->found, found);
+    return 0;
+}
+
+// the setup this table replaces: one mutex around a shared GHashTable
+static int locked_reader(void *data) {
+    struct bench_state *state = data;
+    uint64_t x = (uint64_t) (uintptr_t) &data;
+    size_t found = 0;
+
+    for (size_t i = 0; i < state->lookups; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        mtx_lock(&state->lock);
+        found += g_hash_table_lookup(state->locked, (void*) (uintptr_t) ((x >> 33) % state->n + 1)) != NULL;
+        mtx_unlock(&state->lock);
+    }
+
+    atomic_fetch_add(&state->found, found);
+    return 0;
+}
+
+static double run_threads(thrd_start_t func, struct bench_state *state, int num_threads) {
+    thrd_t threads[MAX_THREADS];
+
+    double start = now();
+    for (int i = 0; i < num_threads; i++) {
+        if (thrd_create(&threads[i], func, state) != thrd_success) {
+            fprintf(stderr, "FATAL ERROR: run_threads: Failed to create thread");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        thrd_join(threads[i], NULL);
+    }
+
+    return now() - start;
+}
+
+int gconcurrenthashtable_bench(int argc, char** argv) {
+    struct bench_state state;
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+
+    state.n = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+    state.lookups = argc > 3 ? strtoull(argv[3], NULL, 10) : 2000000;
+    state.concurrent = g_concurrent_hash_table_new(g_int_hash, g_int_equal);
+    state.locked = g_hash_table_new(g_int_hash, g_int_equal);
+    mtx_init(&state.lock, mtx_plain);
+
+    if (max_threads > MAX_THREADS) {
+        max_threads = MAX_THREADS;
+    }
+
+    for (size_t i = 1; i <= state.n; i++) {
+        g_concurrent_hash_table_insert(state.concurrent, (void*) (uintptr_t) i, (void*) (uintptr_t) i);
+        g_hash_table_insert(state.locked, (void*) (uintptr_t) i, (void*) (uintptr_t) i);
+    }
+
+    // every thread does the same number of lookups, so perfect scaling keeps
+    // the time flat and multiplies the throughput
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double locked_time = run_threads(locked_reader, &state, threads);
+        atomic_store(&state.found, 0);
+        double concurrent_time = run_threads(concurrent_reader, &state, threads);
+
+        printf("threads=%-3d mutex + GHashTable %8.2f Mops/s  GConcurrentHashTable %8.2f Mops/s  (%zu found)\n",
+                threads, (double) state.lookups * threads / locked_time / 1e6,
+                (double) state.lookups * threads / concurrent_time / 1e6, atomic_load(&state.found));
+    }
+
+    mtx_destroy(&state.lock);
+    g_hash_table_destroy(state.locked);
+    g_concurrent_hash_table_destroy(state.concurrent);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <miniglib.h>
+
+G_DEFINE_HASH_MAP(GU64Map, g_u64_map, uint64_t, void*)
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// uint64 ID -> pointer, as GHashTable with g_int_hash and as a GU64Map
+int ghashmap_bench(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t rounds = argc > 2 ? strtoull(argv[2], NULL, 10) : 5;
+    size_t found = 0;
+
+    GHashTable *table = g_hash_table_new(g_int_hash, g_int_equal);
+    double start = now();
+    for (size_t i = 0; i < n; i++) {
+        g_hash_table_insert(table, (void*) (uintptr_t) (i * 64 + 1), (void*) (uintptr_t) (i + 1));
+    }
+    double insert_time = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            found += g_hash_table_lookup(table, (void*) (uintptr_t) ((i * 7919) % n * 64 + 1)) != NULL;
+        }
+    }
+    double lookup_time = now() - start;
+
+    printf("%-32s n=%-9zu insert %8.2f Mops/s  lookup %8.2f Mops/s  (%zu found)\n",
+            "GHashTable, g_int_hash", n, n / insert_time / 1e6, (double) n * rounds / lookup_time / 1e6, found);
+    g_hash_table_destroy(table);
+
+    found = 0;
+    GU64Map *map = g_u64_map_new();
+    start = now();
+    for (size_t i = 0; i < n; i++) {
+        g_u64_map_insert(map, i * 64 + 1, (void*) (uintptr_t) (i + 1));
+    }
+    insert_time = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            found += g_u64_map_lookup_extended(map, (i * 7919) % n * 64 + 1, NULL);
+        }
+    }
+    lookup_time = now() - start;
+
+    printf("%-32s n=%-9zu insert %8.2f Mops/s  lookup %8.2f Mops/s  (%zu found)\n",
+            "G_DEFINE_HASH_MAP(uint64_t)", n, n / insert_time / 1e6, (double) n * rounds / lookup_time / 1e6, found);
+    g_u64_map_destroy(map);
+
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <miniglib.h>
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t identity_hash(void *v) {
+    return (uint32_t) (uintptr_t) v;
+}
+
+static void bench_lookup(const char *name, GHashFunc hash_func, GEqualFunc equal_func, void **keys, size_t n, size_t rounds) {
+    GHashTable *table = g_hash_table_new(hash_func, equal_func);
+
+    double start = now();
+    for (size_t i = 0; i < n; i++) {
+        g_hash_table_insert(table, keys[i], keys[i]);
+    }
+    double insert_time = now() - start;
+
+    size_t found = 0;
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            found += g_hash_table_lookup(table, keys[(i * 7919) % n]) != NULL;
+        }
+    }
+    double lookup_time = now() - start;
+
+    printf("%-32s n=%-9zu insert %8.2f Mops/s  lookup %8.2f Mops/s  (%zu found)\n",
+            name, n, n / insert_time / 1e6, (double) n * rounds / lookup_time / 1e6, found);
+
+    GHashTableStats stats;
+    g_hash_table_get_stats(table, &stats);
+    printf("%-32s load %.3f  probe groups found mean %.3f max %u  missing mean %.3f max %u  resizes %u\n",
+            "", stats.load_factor, stats.mean_probe_length_found, stats.max_probe_length_found,
+            stats.mean_probe_length_missing, stats.max_probe_length_missing, stats.num_resizes);
+
+    g_hash_table_destroy(table);
+}
+
+static void bench_insert_latency(const char *name, GHashTableFlags flags, size_t n) {
+    GHashTable *table = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, flags);
+    double worst = 0;
+
+    double start = now();
+    for (size_t i = 0; i < n; i++) {
+        double t = now();
+        g_hash_table_insert(table, (void*) (uintptr_t) (i + 1), NULL);
+        t = now() - t;
+        if (t > worst) {
+            worst = t;
+        }
+    }
+    double total = now() - start;
+
+    printf("%-32s n=%-9zu insert %8.2f Mops/s  worst insert %10.3f ms\n", name, n, n / total / 1e6, worst * 1e3);
+
+    g_hash_table_destroy(table);
+}
+
+// Random lookups into a table much larger than the cache, one at a time and
+// in batches.
+static void bench_lookup_batch(size_t n, size_t lookups) {
+    GHashTable *table = g_hash_table_new_sized(g_int_hash, g_int_equal, (uint32_t) n);
+    void **keys = malloc(lookups * sizeof(void*));
+    void **values = malloc(lookups * sizeof(void*));
+    if (keys == NULL || values == NULL) {
+        fprintf(stderr, "FATAL ERROR: bench_lookup_batch: Out of memory");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        g_hash_table_insert(table, (void*) (uintptr_t) (i + 1), (void*) (uintptr_t) (i + 1));
+    }
+
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < lookups; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[i] = (void*) (uintptr_t) (x % n + 1);
+    }
+
+    size_t found = 0;
+    double start = now();
+    for (size_t i = 0; i < lookups; i++) {
+        found += g_hash_table_lookup(table, keys[i]) != NULL;
+    }
+    double single_time = now() - start;
+
+    start = now();
+    g_hash_table_lookup_batch(table, keys, (uint32_t) lookups, values);
+    double batch_time = now() - start;
+    for (size_t i = 0; i < lookups; i++) {
+        found += values[i] != NULL;
+    }
+
+    printf("%-32s n=%-9zu lookup %8.2f Mops/s  lookup_batch %8.2f Mops/s  (%zu found)\n",
+            "random int keys, out of cache", n, lookups / single_time / 1e6, lookups / batch_time / 1e6, found);
+
+    free(values);
+    free(keys);
+    g_hash_table_destroy(table);
+}
+
+static void count_entry(void *key, void *value, void *user_data) {
+    *(size_t*) user_data += (uintptr_t) value;
+}
+
+static size_t table_bytes(GHashTable *table) {
+    GHashTableStats stats;
+    g_hash_table_get_stats(table, &stats);
+    return stats.bytes_allocated;
+}
+
+static void bench_set(size_t n, size_t rounds) {
+    GHashTable *set = g_hash_table_new(g_int_hash, g_int_equal);
+    GHashTable *map = g_hash_table_new(g_int_hash, g_int_equal);
+    size_t found = 0;
+
+    for (size_t i = 1; i <= n; i++) {
+        g_hash_table_add(set, (void*) (uintptr_t) i);
+        g_hash_table_insert(map, (void*) (uintptr_t) i, (void*) (uintptr_t) 1);
+    }
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 1; i <= n; i++) {
+            found += g_hash_table_contains(set, (void*) (uintptr_t) i);
+        }
+    }
+    double set_time = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 1; i <= n; i++) {
+            found += g_hash_table_contains(map, (void*) (uintptr_t) i);
+        }
+    }
+    double map_time = now() - start;
+
+    printf("%-32s n=%-9zu set %8.2f Mops/s %6.1f bytes/entry  map %8.2f Mops/s %6.1f bytes/entry  (%zu found)\n",
+            "int keys, set vs map", n, (double) n * rounds / set_time / 1e6, (double) table_bytes(set) / n,
+            (double) n * rounds / map_time / 1e6, (double) table_bytes(map) / n, found);
+
+    g_hash_table_destroy(map);
+    g_hash_table_destroy(set);
+}
+
+static void bench_foreach(const char *name, GHashTableFlags flags, size_t n, size_t rounds) {
+    GHashTable *table = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, flags);
+    size_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        g_hash_table_insert(table, (void*) (uintptr_t) (i + 1), (void*) (uintptr_t) i);
+    }
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        g_hash_table_foreach(table, count_entry, &sum);
+    }
+    double foreach_time = now() - start;
+
+    printf("%-32s n=%-9zu foreach %7.2f Mentries/s  %6.1f bytes/entry  (%zu)\n",
+            name, n, (double) n * rounds / foreach_time / 1e6, (double) table_bytes(table) / n, sum);
+
+    g_hash_table_destroy(table);
+}
+
+static void sum_entry(void *key, void *value, void *accumulator, void *user_data) {
+    *(size_t*) accumulator += (uintptr_t) value;
+}
+
+static void combine_sums(void *accumulator, void *other, void *user_data) {
+    *(size_t*) accumulator += *(size_t*) other;
+}
+
+static void bench_reduce_parallel(size_t n, size_t rounds) {
+    GHashTable *table = g_hash_table_new(g_int_hash, g_int_equal);
+    size_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        g_hash_table_insert(table, (void*) (uintptr_t) (i + 1), (void*) (uintptr_t) i);
+    }
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        g_hash_table_foreach(table, count_entry, &sum);
+    }
+    double foreach_time = now() - start;
+
+    printf("%-32s n=%-9zu foreach %8.2f Mentries/s  (%zu)\n", "aggregate, serial", n, (double) n * rounds / foreach_time / 1e6, sum);
+
+    for (uint32_t threads = 1; threads <= 8; threads *= 2) {
+        sum = 0;
+        start = now();
+        for (size_t r = 0; r < rounds; r++) {
+            g_hash_table_reduce_parallel(table, sum_entry, combine_sums, &sum, sizeof(sum), NULL, threads);
+        }
+        double reduce_time = now() - start;
+
+        printf("%-32s n=%-9zu threads=%-3u reduce %8.2f Mentries/s  (%zu)\n",
+                "aggregate, parallel", n, threads, (double) n * rounds / reduce_time / 1e6, sum);
+    }
+
+    g_hash_table_destroy(table);
+}
+
+static void bench_from_arrays(size_t n) {
+    void **keys = malloc(n * sizeof(void*));
+    if (keys == NULL) {
+        fprintf(stderr, "FATAL ERROR: bench_from_arrays: Out of memory");
+        exit(1);
+    }
+
+    uint64_t x = 1;
+    for (size_t i = 0; i < n; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        keys[i] = (void*) (uintptr_t) ((x >> 16) | 1);
+    }
+
+    double start = now();
+    GHashTable *table = g_hash_table_new(g_int_hash, g_int_equal);
+    for (size_t i = 0; i < n; i++) {
+        g_hash_table_insert(table, keys[i], keys[i]);
+    }
+    double insert_time = now() - start;
+    g_hash_table_destroy(table);
+
+    printf("%-32s n=%-9zu g_hash_table_insert %8.2f Mkeys/s\n", "bulk build, random int keys", n, n / insert_time / 1e6);
+
+    for (uint32_t threads = 1; threads <= 8; threads *= 2) {
+        start = now();
+        table = g_hash_table_new_from_arrays(g_int_hash, g_int_equal, NULL, NULL, keys, keys, (uint32_t) n, threads);
+        double build_time = now() - start;
+
+        printf("%-32s n=%-9zu threads=%-3u %8.2f Mkeys/s  (%u keys)\n",
+                "bulk build, from arrays", n, threads, n / build_time / 1e6, g_hash_table_size(table));
+        g_hash_table_destroy(table);
+    }
+
+    free(keys);
+}
+
+// the g_str_hash this library used to ship, for comparison
+static uint32_t djb2_hash(const void *v, size_t len) {
+    const unsigned char *str = v;
+    uint32_t hash = 5381;
+
+    for (size_t i = 0; i < len; i++) {
+        hash = ((hash << 5) + hash) + str[i];
+    }
+
+    return hash;
+}
+
+static void bench_str_hash(size_t len, size_t total_bytes) {
+    char *buf = malloc(len + 64);
+    if (buf == NULL) {
+        fprintf(stderr, "FATAL ERROR: bench_str_hash: Out of memory");
+        exit(1);
+    }
+    for (size_t i = 0; i < len + 64; i++) {
+        buf[i] = (char) ('a' + i % 26);
+    }
+
+    size_t iterations = total_bytes / len;
+    uint32_t sink = 0;
+
+    double start = now();
+    for (size_t i = 0; i < iterations; i++) {
+        sink += djb2_hash(&buf[i % 64], len);
+    }
+    double djb2_time = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < iterations; i++) {
+        sink += g_str_hash_len(&buf[i % 64], len);
+    }
+    double hash_time = now() - start;
+
+    printf("string hash len=%-5zu djb2 %7.2f GB/s %7.2f ns/hash  g_str_hash_len %7.2f GB/s %7.2f ns/hash  (%u)\n",
+            len, iterations * len / djb2_time / 1e9, djb2_time / iterations * 1e9,
+            iterations * len / hash_time / 1e9, hash_time / iterations * 1e9, sink);
+
+    free(buf);
+}
+
+int ghashtable_bench(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t rounds = argc > 2 ? strtoull(argv[2], NULL, 10) : 5;
+
+    void **keys = malloc(n * sizeof(void*));
+    char *strings = malloc(n * 24);
+    if (keys == NULL || strings == NULL) {
+        fprintf(stderr, "FATAL ERROR: ghashtable_bench: Out of memory");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (void*) (uintptr_t) (i + 1);
+    }
+    bench_lookup("int keys, g_int_hash", g_int_hash, g_int_equal, keys, n, rounds);
+
+    // page-aligned pointers hashed by identity leave the low 12 bits unused
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (void*) (uintptr_t) ((i + 1) * 4096);
+    }
+    bench_lookup("page-aligned pointers, identity", identity_hash, g_int_equal, keys, n, rounds);
+
+    for (size_t i = 0; i < n; i++) {
+        snprintf(&strings[i * 24], 24, "key-%zu", i);
+        keys[i] = &strings[i * 24];
+    }
+    bench_lookup("string keys, g_str_hash", g_str_hash, g_str_equal, keys, n, rounds);
+
+    free(strings);
+    free(keys);
+
+    bench_insert_latency("insert latency, resize at once", G_HASH_TABLE_FLAGS_NONE, n * 4);
+    bench_insert_latency("insert latency, incremental", G_HASH_TABLE_INCREMENTAL_RESIZE, n * 4);
+
+    bench_lookup_batch(n * 8, n * 4);
+
+    // just past a resize the slot array is less than half full
+    bench_foreach("foreach, slot array", G_HASH_TABLE_FLAGS_NONE, n, rounds);
+    bench_foreach("foreach, ordered", G_HASH_TABLE_ORDERED, n, rounds);
+    bench_foreach("foreach, slot array", G_HASH_TABLE_FLAGS_NONE, (size_t) (n * 1.6), rounds);
+    bench_foreach("foreach, ordered", G_HASH_TABLE_ORDERED, (size_t) (n * 1.6), rounds);
+    bench_set(n, rounds);
+    bench_from_arrays(n * 8);
+    bench_reduce_parallel(n * 8, rounds);
+
+    size_t lengths[] = {8, 16, 32, 64, 256, 4096};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        bench_str_hash(lengths[i], 1 << 28);
+    }
+
+    return 0;
+}
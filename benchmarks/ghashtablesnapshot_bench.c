@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <miniglib.h>
+
+#define SNAPSHOT_PATH "ghashtablesnapshot_bench.bin"
+// room for "/data/file-" and any size_t
+#define KEY_STRIDE 32
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// string -> file offset, rebuilt with g_hash_table_insert at every start
+// versus mapped from a snapshot
+int ghashtablesnapshot_bench(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoull(argv[2], NULL, 10) : 5000000;
+    size_t found = 0;
+
+    char *strings = malloc(n * KEY_STRIDE);
+    uint64_t *offsets = malloc(n * sizeof(uint64_t));
+    if (strings == NULL || offsets == NULL) {
+        fprintf(stderr, "FATAL ERROR: ghashtablesnapshot_bench: Out of memory");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        snprintf(&strings[i * KEY_STRIDE], KEY_STRIDE, "/data/file-%zu", i);
+        offsets[i] = i * 4096;
+    }
+
+    double start = now();
+    GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+    for (size_t i = 0; i < n; i++) {
+        g_hash_table_insert(table, &strings[i * KEY_STRIDE], &offsets[i]);
+    }
+    double build_time = now() - start;
+
+    start = now();
+    if (!g_hash_table_snapshot_write(table, SNAPSHOT_PATH, sizeof(uint64_t))) {
+        fprintf(stderr, "FATAL ERROR: ghashtablesnapshot_bench: Failed to write %s", SNAPSHOT_PATH);
+        exit(1);
+    }
+    double write_time = now() - start;
+
+    start = now();
+    GHashTableSnapshot *snapshot = g_hash_table_snapshot_open(SNAPSHOT_PATH);
+    found += g_hash_table_snapshot_lookup(snapshot, &strings[0]) != NULL;
+    double open_time = now() - start;
+
+    start = now();
+    bool verified = g_hash_table_snapshot_verify(snapshot);
+    double verify_time = now() - start;
+
+    printf("n=%-9zu build %8.2f ms  write %8.2f ms  open + first lookup %8.3f ms  verify %8.2f ms (%s)\n",
+            n, build_time * 1e3, write_time * 1e3, open_time * 1e3, verify_time * 1e3, verified ? "ok" : "FAILED");
+
+    start = now();
+    for (size_t i = 0; i < lookups; i++) {
+        found += g_hash_table_lookup(table, &strings[(i * 7919) % n * KEY_STRIDE]) != NULL;
+    }
+    double table_time = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < lookups; i++) {
+        found += g_hash_table_snapshot_lookup(snapshot, &strings[(i * 7919) % n * KEY_STRIDE]) != NULL;
+    }
+    double snapshot_time = now() - start;
+
+    printf("n=%-9zu lookup GHashTable %8.2f Mops/s  GHashTableSnapshot %8.2f Mops/s  (%zu found)\n",
+            n, lookups / table_time / 1e6, lookups / snapshot_time / 1e6, found);
+
+    g_hash_table_snapshot_close(snapshot);
+    g_hash_table_destroy(table);
+    remove(SNAPSHOT_PATH);
+    free(offsets);
+    free(strings);
+
+    return 0;
+}
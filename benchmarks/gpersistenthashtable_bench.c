@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <miniglib.h>
+
+#define KEY(i) ((void*) (uintptr_t) (i))
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// copy-on-write of a whole GHashTable per published version versus a path
+// copy of GPersistentHashTable, then lookups in both
+int gpersistenthashtable_bench(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    size_t updates = argc > 2 ? strtoull(argv[2], NULL, 10) : 200;
+    size_t lookups = argc > 3 ? strtoull(argv[3], NULL, 10) : 5000000;
+    size_t found = 0;
+
+    GHashTable *table = g_hash_table_new(g_int_hash, g_int_equal);
+    GPersistentHashTable *version = g_persistent_hash_table_new(g_int_hash, g_int_equal);
+    for (size_t i = 1; i <= n; i++) {
+        g_hash_table_insert(table, KEY(i), KEY(i));
+
+        GPersistentHashTable *next = g_persistent_hash_table_insert(version, KEY(i), KEY(i));
+        g_persistent_hash_table_unref(version);
+        version = next;
+    }
+
+    _Atomic(GPersistentHashTable*) current = NULL;
+    g_persistent_hash_table_publish(&current, version);
+
+    double start = now();
+    for (size_t u = 0; u < updates; u++) {
+        GHashTable *copy = g_hash_table_new(g_int_hash, g_int_equal);
+        GHashTableIter iter;
+        void *key, *value;
+
+        g_hash_table_iter_init(&iter, table);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_hash_table_insert(copy, key, value);
+        }
+        g_hash_table_insert(copy, KEY(u % n + 1), KEY(u));
+
+        g_hash_table_destroy(table);
+        table = copy;
+    }
+    double copy_time = now() - start;
+
+    start = now();
+    for (size_t u = 0; u < updates; u++) {
+        GPersistentHashTable *old = g_persistent_hash_table_acquire(&current);
+        GPersistentHashTable *next = g_persistent_hash_table_insert(old, KEY(u % n + 1), KEY(u));
+        g_persistent_hash_table_unref(old);
+        g_persistent_hash_table_publish(&current, next);
+    }
+    double persistent_time = now() - start;
+
+    printf("n=%-9zu update + publish  GHashTable copy %10.2f us  GPersistentHashTable %8.2f us\n",
+            n, copy_time / updates * 1e6, persistent_time / updates * 1e6);
+
+    version = g_persistent_hash_table_acquire(&current);
+
+    start = now();
+    for (size_t i = 0; i < lookups; i++) {
+        found += g_hash_table_lookup(table, KEY((i * 7919) % n + 1)) != NULL;
+    }
+    double table_time = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < lookups; i++) {
+        found += g_persistent_hash_table_lookup(version, KEY((i * 7919) % n + 1)) != NULL;
+    }
+    double version_time = now() - start;
+
+    printf("n=%-9zu lookup GHashTable %8.2f Mops/s  GPersistentHashTable %8.2f Mops/s  (%zu found)\n",
+            n, lookups / table_time / 1e6, lookups / version_time / 1e6, found);
+
+    g_persistent_hash_table_unref(version);
+    g_persistent_hash_table_unref(atomic_load(&current));
+    g_hash_table_destroy(table);
+
+    return 0;
+}
@@ -2,3 +2,7 @@
 #include <miniglib/garray.h>
 #include <miniglib/gstring.h>
 #include <miniglib/ghashtable.h>
+#include <miniglib/ghashtablesnapshot.h>
+#include <miniglib/gconcurrenthashtable.h>
+#include <miniglib/gpersistenthashtable.h>
+#include <miniglib/ghashmap.h>
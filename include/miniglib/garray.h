@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 // Needed for qsort_s
@@ -49,39 +50,389 @@
 void qsort_r(void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *, void *), void *arg);
 #endif
 
+// GArray grows its allocation by this factor when it runs out of room, so
+// appending n elements one at a time moves O(n) bytes in total. Define it when
+// building miniglib to trade memory for fewer reallocations.
+#ifndef GARRAY_GROWTH_FACTOR
+#define GARRAY_GROWTH_FACTOR 2
+#endif
+
 typedef int(*GCompareFunc) (const void *a, const void *b);
 typedef int(*GCompareDataFunc) (const void *a, const void *b, void *user_data);
 typedef void (*GDestroyNotify)(void *data);
 
+// Where data lives, see g_array_new_mapped and g_array_map_writable.
+typedef enum _GArrayBacking {
+    _G_ARRAY_HEAP,
+    _G_ARRAY_MAPPED_READ_ONLY,
+    _G_ARRAY_MAPPED_COPY_ON_WRITE,
+    _G_ARRAY_MAPPED_WRITABLE,
+} _GArrayBacking;
+
+// Lengths, indices and sizes are size_t, so arrays can hold more than 4G
+// elements and 4 GB. Growing an array past SIZE_MAX bytes is a fatal error.
 typedef struct GArray {
     char *data;
-    unsigned int len;
-    unsigned int _allocated_elements;
+    size_t len;
+    size_t _allocated_elements;
     bool _zero_terminated;
     bool _clear;
-    unsigned int _element_size;
+    size_t _element_size;
     GDestroyNotify _clear_func;
+    _GArrayBacking _backing;
+    // the file of a writable mapping, -1 otherwise
+    int _fd;
 } GArray;
 
-GArray* g_array_new(bool zero_terminated, bool clear, unsigned int element_size);
+GArray* g_array_new(bool zero_terminated, bool clear, size_t element_size);
 void* g_array_steal(GArray *array, size_t *len);
-GArray* g_array_sized_new(bool zero_terminated, bool clear, unsigned int element_size, unsigned int reserved_size);
+GArray* g_array_sized_new(bool zero_terminated, bool clear, size_t element_size, size_t reserved_size);
 GArray* g_array_copy(GArray *array);
-unsigned int g_array_get_element_size(GArray *array);
+size_t g_array_get_element_size(GArray *array);
 #define g_array_append_val(a, v) g_array_append_vals(a, &v, 1);
-GArray* g_array_append_vals (GArray *array, const void *data, unsigned int len);
+GArray* g_array_append_vals (GArray *array, const void *data, size_t len);
 #define g_array_prepend_val(a, v) g_array_prepend_vals(a, &v, 1);
-GArray* g_array_prepend_vals(GArray *array, const void *data, unsigned int len);
+GArray* g_array_prepend_vals(GArray *array, const void *data, size_t len);
 #define g_array_insert_val(a, i, v) g_array_insert_vals(a, i, &v, 1);
-GArray* g_array_insert_vals (GArray *array, unsigned int index, const void *data, unsigned int len);
-GArray* g_array_remove_index(GArray *array, unsigned int index);
-GArray* g_array_remove_index_fast(GArray *array, unsigned int index);
-GArray* g_array_remove_range(GArray *array, unsigned int index, unsigned int length);
+GArray* g_array_insert_vals (GArray *array, size_t index, const void *data, size_t len);
+GArray* g_array_remove_index(GArray *array, size_t index);
+GArray* g_array_remove_index_fast(GArray *array, size_t index);
+GArray* g_array_remove_range(GArray *array, size_t index, size_t length);
 void g_array_sort(GArray *array, GCompareFunc compare_func);
 void g_array_sort_with_data(GArray *array, GCompareDataFunc compare_func, void *user_data);
+bool g_array_binary_search_index(GArray *array, const void *target, GCompareFunc compare_func, size_t *out_match_index);
+// the unsigned int variant, for existing callers
 bool g_array_binary_search(GArray *array, const void *target, GCompareFunc compare_func, unsigned int *out_match_index);
-#define g_array_index(a, t, i) (t) a->data[i * a->_element_size]
-GArray* g_array_set_size(GArray *array, unsigned int length);
+size_t g_array_lower_bound(GArray *array, const void *target, GCompareFunc compare_func);
+size_t g_array_upper_bound(GArray *array, const void *target, GCompareFunc compare_func);
+void g_array_equal_range(GArray *array, const void *target, GCompareFunc compare_func, size_t *ret_start, size_t *ret_end);
+void g_array_search_many(GArray *array, const void *targets, size_t num_targets, GCompareFunc compare_func, size_t *ret_indices);
+#define g_array_index(a, t, i) (((t*) (void*) (a)->data)[(i)])
+GArray* g_array_set_size(GArray *array, size_t length);
 void g_array_set_clear_func(GArray *array, GDestroyNotify clear_func);
+GArray* g_array_reserve(GArray *array, size_t length);
+GArray* g_array_shrink_to_fit(GArray *array);
 
 char* g_array_free(GArray *array, bool free_segment);
+
+// Maps a file of element_size records as the data of a new array, without
+// reading it. The array is neither zero-terminated nor cleared. Returns NULL
+// with errno set if the file can't be mapped or its size isn't a multiple of
+// element_size. g_array_steal and g_array_free without free_segment hand out
+// a heap copy of the elements.
+typedef enum GArrayMapFlags {
+    // writes to the array fault and growing it is a bug; shrinking its
+    // allocation leaves the mapping as it is
+    G_ARRAY_MAP_READ_ONLY = 0,
+    // changes stay private to the array and never reach the file; growing or
+    // shrinking the allocation moves the array to the heap
+    G_ARRAY_MAP_COPY_ON_WRITE = 1 << 0,
+} GArrayMapFlags;
+
+GArray* g_array_new_mapped(const char *path, size_t element_size, GArrayMapFlags flags);
+// Maps a file shared, creating it if needed, so changes go to the file and
+// other processes mapping it. Growing the array grows the file.
+GArray* g_array_map_writable(const char *path, size_t element_size);
+// Trims the file of a writable mapping to len elements and writes the
+// changes out. Returns false if the file can't be trimmed, leaving the array
+// as it was, or if writing failed. Other arrays have nothing to write. The
+// room reserved beyond len goes with the trim, so the next append grows the
+// file and remaps it again. g_array_free trims the file too but can only
+// report a failure on stderr, so sync first to handle it.
+bool g_array_sync(GArray *array);
+
+// Sorts elements by a key of the given type at key_offset in each element,
+// with an LSD radix sort. The sort is stable. Floats sort by value with -0.0
+// before 0.0; NaNs sort before everything if their sign bit is set and after
+// everything otherwise.
+typedef enum GArrayKeyType {
+    G_ARRAY_KEY_UINT32,
+    G_ARRAY_KEY_INT32,
+    G_ARRAY_KEY_UINT64,
+    G_ARRAY_KEY_INT64,
+    G_ARRAY_KEY_FLOAT,
+    G_ARRAY_KEY_DOUBLE,
+} GArrayKeyType;
+
+void g_array_sort_stable(GArray *array, GCompareFunc compare_func);
+void g_array_sort_stable_with_data(GArray *array, GCompareDataFunc compare_func, void *user_data);
+void g_array_sort_by_key(GArray *array, GArrayKeyType key_type, size_t key_offset);
+
+// Number of searches g_array_search_many interleaves. targets holds
+// num_targets elements of the array's element size, and ret_indices gets the
+// lower bound of each.
+#define GARRAY_SEARCH_BATCH 16
+
+// A read-only copy of a sorted array in Eytzinger (breadth-first) order, for
+// arrays that are searched far more often than they change.
+typedef struct GArrayEytzinger {
+    // aligned to a cache line inside _allocation
+    char *data;
+    char *_allocation;
+    // ranks[k] is the index in the sorted array of node k
+    size_t *ranks;
+    size_t len;
+    size_t element_size;
+} GArrayEytzinger;
+
+// Nodes start at a cache line boundary.
+#define GARRAY_EYTZINGER_ALIGNMENT 64
+
+// The search prefetches the node this many times further down, which
+// together with its siblings is four levels below.
+#define GARRAY_EYTZINGER_PREFETCH_DISTANCE 16
+
+GArrayEytzinger* g_array_eytzinger_new(GArray *array);
+size_t g_array_eytzinger_lower_bound(GArrayEytzinger *index, const void *target, GCompareFunc compare_func);
+void g_array_eytzinger_free(GArrayEytzinger *index);
+
+// Minimum number of elements each thread of g_array_sort_parallel gets.
+#define GARRAY_SORT_PARALLEL_MIN_ELEMENTS 65536
+
+void g_array_sort_parallel(GArray *array, GCompareFunc compare_func, uint32_t num_threads);
+void g_array_sort_parallel_with_data(GArray *array, GCompareDataFunc compare_func, void *user_data, uint32_t num_threads, void *scratch);
+
+// G_ARRAY_SORT_DEFINE(name, type, less) defines
+//
+//     static inline void g_array_sort_<name>(GArray *array)
+//
+// which sorts an array of type with less inlined into the sort. less(a, b)
+// takes two const type* and is true if *a sorts before *b, e.g.
+//
+//     #define u64_less(a, b) (*(a) < *(b))
+//     G_ARRAY_SORT_DEFINE(u64, uint64_t, u64_less)
+//
+// The sort is a pattern-defeating quicksort: introsort that falls back to
+// heapsort, with insertion sort for short ranges, ninther pivots, and
+// shortcuts for runs that are already sorted or full of equal keys. It is
+// not stable.
+#define G_ARRAY_SORT_DEFINE(name, type, less) \
+    _G_ARRAY_SORT_DEFINE_ENGINE(name, type, less) \
+    static inline void g_array_sort_##name(GArray *array) \
+    { \
+        if (array->_element_size != sizeof(type)) { \
+            fprintf(stderr, "BUG: g_array_sort_" #name ": Element size doesn't match " #type "."); \
+            abort(); \
+        } \
+        _g_array_sort_##name((type*) (void*) array->data, array->len, NULL); \
+    }
+
+#define _G_ARRAY_SORT_INSERTION_THRESHOLD 24
+#define _G_ARRAY_SORT_NINTHER_THRESHOLD 128
+#define _G_ARRAY_SORT_PARTIAL_INSERTION_LIMIT 8
+
+// Defines _g_array_sort_<name>(type *data, size_t n, void *context). less
+// may refer to context.
+#define _G_ARRAY_SORT_DEFINE_ENGINE(name, type, less) \
+    static inline void _g_array_sort_##name##_swap(type *a, type *b) \
+    { \
+        type tmp = *a; \
+        *a = *b; \
+        *b = tmp; \
+    } \
+    \
+    static inline void _g_array_sort_##name##_sort2(type *a, type *b, void *context) \
+    { \
+        (void) context; \
+        if (less(b, a)) { \
+            _g_array_sort_##name##_swap(a, b); \
+        } \
+    } \
+    \
+    static inline void _g_array_sort_##name##_sort3(type *a, type *b, type *c, void *context) \
+    { \
+        _g_array_sort_##name##_sort2(a, b, context); \
+        _g_array_sort_##name##_sort2(b, c, context); \
+        _g_array_sort_##name##_sort2(a, b, context); \
+    } \
+    \
+    static inline void _g_array_sort_##name##_insertion(type *data, size_t n, void *context) \
+    { \
+        (void) context; \
+        for (size_t i = 1; i < n; i++) { \
+            if (less(&data[i], &data[i - 1])) { \
+                type tmp = data[i]; \
+                size_t j = i; \
+                do { \
+                    data[j] = data[j - 1]; \
+                    j--; \
+                } while (j > 0 && less(&tmp, &data[j - 1])); \
+                data[j] = tmp; \
+            } \
+        } \
+    } \
+    \
+    /* gives up once it has moved more than a few elements */ \
+    static inline bool _g_array_sort_##name##_partial_insertion(type *data, size_t n, void *context) \
+    { \
+        (void) context; \
+        size_t moved = 0; \
+        for (size_t i = 1; i < n; i++) { \
+            if (less(&data[i], &data[i - 1])) { \
+                type tmp = data[i]; \
+                size_t j = i; \
+                do { \
+                    data[j] = data[j - 1]; \
+                    j--; \
+                } while (j > 0 && less(&tmp, &data[j - 1])); \
+                data[j] = tmp; \
+                moved += i - j; \
+                if (moved > _G_ARRAY_SORT_PARTIAL_INSERTION_LIMIT) { \
+                    return false; \
+                } \
+            } \
+        } \
+        return true; \
+    } \
+    \
+    static inline void _g_array_sort_##name##_sift_down(type *data, size_t n, size_t i, void *context) \
+    { \
+        (void) context; \
+        type tmp = data[i]; \
+        while (2 * i + 1 < n) { \
+            size_t child = 2 * i + 1; \
+            if (child + 1 < n && less(&data[child], &data[child + 1])) { \
+                child++; \
+            } \
+            if (!less(&tmp, &data[child])) { \
+                break; \
+            } \
+            data[i] = data[child]; \
+            i = child; \
+        } \
+        data[i] = tmp; \
+    } \
+    \
+    static inline void _g_array_sort_##name##_heap(type *data, size_t n, void *context) \
+    { \
+        for (size_t i = n / 2; i > 0; i--) { \
+            _g_array_sort_##name##_sift_down(data, n, i - 1, context); \
+        } \
+        for (size_t i = n; i > 1; i--) { \
+            _g_array_sort_##name##_swap(&data[0], &data[i - 1]); \
+            _g_array_sort_##name##_sift_down(data, i - 1, 0, context); \
+        } \
+    } \
+    \
+    /* The pivot is data[0] and data[n - 1] doesn't sort before it. Elements \
+       equal to the pivot end up on the right. */ \
+    static inline size_t _g_array_sort_##name##_partition_right(type *data, size_t n, bool *ret_partitioned, void *context) \
+    { \
+        (void) context; \
+        type pivot = data[0]; \
+        size_t i = 0; \
+        size_t j = n; \
+        while (less(&data[++i], &pivot)); \
+        if (i == 1) { \
+            while (i < j && !less(&data[--j], &pivot)); \
+        } else { \
+            while (!less(&data[--j], &pivot)); \
+        } \
+        *ret_partitioned = i >= j; \
+        while (i < j) { \
+            _g_array_sort_##name##_swap(&data[i], &data[j]); \
+            while (less(&data[++i], &pivot)); \
+            while (!less(&data[--j], &pivot)); \
+        } \
+        data[0] = data[i - 1]; \
+        data[i - 1] = pivot; \
+        return i - 1; \
+    } \
+    \
+    /* Elements equal to the pivot end up on the left, used when the pivot \
+       equals an element left of the range, so they are all in place. */ \
+    static inline size_t _g_array_sort_##name##_partition_left(type *data, size_t n, void *context) \
+    { \
+        (void) context; \
+        type pivot = data[0]; \
+        size_t i = 0; \
+        size_t j = n; \
+        while (less(&pivot, &data[--j])); \
+        if (j + 1 == n) { \
+            while (i < j && !less(&pivot, &data[++i])); \
+        } else { \
+            while (!less(&pivot, &data[++i])); \
+        } \
+        while (i < j) { \
+            _g_array_sort_##name##_swap(&data[i], &data[j]); \
+            while (less(&pivot, &data[--j])); \
+            while (!less(&pivot, &data[++i])); \
+        } \
+        data[0] = data[j]; \
+        data[j] = pivot; \
+        return j; \
+    } \
+    \
+    static void _g_array_sort_##name##_loop(type *data, size_t n, uint32_t bad_allowed, bool leftmost, void *context) \
+    { \
+        (void) context; \
+        while (true) { \
+            if (n < _G_ARRAY_SORT_INSERTION_THRESHOLD) { \
+                _g_array_sort_##name##_insertion(data, n, context); \
+                return; \
+            } \
+            \
+            size_t half = n / 2; \
+            if (n > _G_ARRAY_SORT_NINTHER_THRESHOLD) { \
+                _g_array_sort_##name##_sort3(&data[0], &data[half], &data[n - 1], context); \
+                _g_array_sort_##name##_sort3(&data[1], &data[half - 1], &data[n - 2], context); \
+                _g_array_sort_##name##_sort3(&data[2], &data[half + 1], &data[n - 3], context); \
+                _g_array_sort_##name##_sort3(&data[half - 1], &data[half], &data[half + 1], context); \
+                _g_array_sort_##name##_swap(&data[0], &data[half]); \
+            } else { \
+                _g_array_sort_##name##_sort3(&data[half], &data[0], &data[n - 1], context); \
+            } \
+            \
+            if (!leftmost && !less(&data[-1], &data[0])) { \
+                size_t pivot = _g_array_sort_##name##_partition_left(data, n, context); \
+                data += pivot + 1; \
+                n -= pivot + 1; \
+                continue; \
+            } \
+            \
+            bool partitioned; \
+            size_t pivot = _g_array_sort_##name##_partition_right(data, n, &partitioned, context); \
+            size_t left = pivot; \
+            size_t right = n - pivot - 1; \
+            \
+            if (left < n / 8 || right < n / 8) { \
+                if (bad_allowed-- == 0) { \
+                    _g_array_sort_##name##_heap(data, n, context); \
+                    return; \
+                } \
+                /* break up the pattern that produced a bad pivot */ \
+                if (left >= _G_ARRAY_SORT_INSERTION_THRESHOLD) { \
+                    _g_array_sort_##name##_swap(&data[0], &data[left / 4]); \
+                    _g_array_sort_##name##_swap(&data[pivot - 1], &data[pivot - left / 4]); \
+                } \
+                if (right >= _G_ARRAY_SORT_INSERTION_THRESHOLD) { \
+                    _g_array_sort_##name##_swap(&data[pivot + 1], &data[pivot + 1 + right / 4]); \
+                    _g_array_sort_##name##_swap(&data[n - 1], &data[n - right / 4]); \
+                } \
+            } else if (partitioned \
+                    && _g_array_sort_##name##_partial_insertion(data, left, context) \
+                    && _g_array_sort_##name##_partial_insertion(&data[pivot + 1], right, context)) { \
+                return; \
+            } \
+            \
+            /* recurse into the smaller side so the stack stays O(log n) */ \
+            if (left < right) { \
+                _g_array_sort_##name##_loop(data, left, bad_allowed, leftmost, context); \
+                data += pivot + 1; \
+                n = right; \
+                leftmost = false; \
+            } else { \
+                _g_array_sort_##name##_loop(&data[pivot + 1], right, bad_allowed, false, context); \
+                n = left; \
+            } \
+        } \
+    } \
+    \
+    static inline void _g_array_sort_##name(type *data, size_t n, void *context) \
+    { \
+        uint32_t bad_allowed = 0; \
+        for (size_t m = n; m > 1; m >>= 1) { \
+            bad_allowed++; \
+        } \
+        _g_array_sort_##name##_loop(data, n, bad_allowed, true, context); \
+    }
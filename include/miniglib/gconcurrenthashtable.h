@@ -0,0 +1,77 @@
+#pragma once
+// A hash table that can be shared between threads. It keeps the callback
+// contract of GHashTable: hash_func and key_equal_func are called without any
+// lock held, and key_destroy_func/value_destroy_func are deferred until no
+// reader can still see the removed key or value.
+//
+// Writers lock one of GCONCURRENTHASHTABLE_NUM_SEGMENTS segments picked by the
+// key's hash. Readers never lock: they validate their probe against the
+// segment's sequence counter and retry if a removal raced with them.
+// Removed entries and replaced slot arrays are reclaimed through epochs.
+//
+// g_concurrent_hash_table_lookup returns a value that stays valid until it is
+// removed or replaced. If the table destroys its values, wrap the lookup and
+// every use of the value in g_concurrent_hash_table_pin/unpin.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+#include <miniglib/garray.h>
+#include <miniglib/ghashtable.h>
+
+#define GCONCURRENTHASHTABLE_NUM_SEGMENTS 64
+#define GCONCURRENTHASHTABLE_SEGMENT_MIN_SLOTS 16
+#define GCONCURRENTHASHTABLE_RECLAIM_BATCH 64
+
+struct GConcurrentHashTableSlot {
+    _Atomic(void*) key;
+    _Atomic(void*) value;
+    _Atomic uint32_t hash;
+};
+
+struct GConcurrentHashTableArray {
+    uint32_t num_slots;
+    uint32_t num_used;
+    uint32_t num_deleted;
+    uint32_t resize_threshold;
+    // control bytes packed 8 to a word so readers can load them atomically
+    _Atomic uint64_t *ctrl;
+    struct GConcurrentHashTableSlot *slots;
+};
+
+struct GConcurrentHashTableRetired {
+    void *data;
+    GDestroyNotify destroy_func;
+    uint64_t epoch;
+};
+
+struct GConcurrentHashTableSegment {
+    mtx_t lock;
+    // odd while a removal is rewriting slots that readers may be probing
+    _Atomic uint32_t seq;
+    _Atomic(struct GConcurrentHashTableArray*) array;
+    _Atomic uint32_t size;
+    GArray *retired;
+    char _padding[64];
+};
+
+typedef struct GConcurrentHashTable {
+    uint32_t seed;
+    GHashFunc hash_func;
+    GEqualFunc key_equal_func;
+    GDestroyNotify key_destroy_func;
+    GDestroyNotify value_destroy_func;
+    struct GConcurrentHashTableSegment segments[GCONCURRENTHASHTABLE_NUM_SEGMENTS];
+} GConcurrentHashTable;
+
+GConcurrentHashTable *g_concurrent_hash_table_new(GHashFunc hash_func, GEqualFunc key_equal_func);
+GConcurrentHashTable *g_concurrent_hash_table_new_full(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func);
+void g_concurrent_hash_table_insert(GConcurrentHashTable *hash_table, void *key, void *value);
+uint32_t g_concurrent_hash_table_size(GConcurrentHashTable *hash_table);
+void* g_concurrent_hash_table_lookup(GConcurrentHashTable *hash_table, void *key);
+bool g_concurrent_hash_table_remove(GConcurrentHashTable *hash_table, void *key);
+void g_concurrent_hash_table_foreach(GConcurrentHashTable *hash_table, GHFunc func, void *user_data);
+void g_concurrent_hash_table_pin(void);
+void g_concurrent_hash_table_unpin(void);
+void g_concurrent_hash_table_destroy(GConcurrentHashTable *hash_table);
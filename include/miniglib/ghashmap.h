@@ -0,0 +1,276 @@
+#pragma once
+// Type-specialized hash maps with inline keys and values.
+//
+//   G_DEFINE_HASH_MAP(GU64Map, g_u64_map, uint64_t, void*)
+//
+// defines the type GU64Map and g_u64_map_new(), g_u64_map_insert() and so on,
+// mirroring the GHashTable functions. Hashing and equality are expanded at
+// compile time instead of being called through function pointers.
+//
+// Slots are probed linearly. A slot is free when its key equals empty_key.
+// The entry for empty_key itself, if any, is kept next to the slot array, so
+// every key can be stored. Removal shifts the following entries back instead
+// of leaving tombstones.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <miniglib/ghashtable.h>
+
+#define GHASHMAP_MIN_SLOTS 16
+#define GHASHMAP_MAX_LOAD 0.75
+#define GHASHMAP_MIN_LOAD 0.125
+
+#define G_HASH_MAP_INT_HASH(key) ((uint64_t) (key))
+#define G_HASH_MAP_INT_EQUAL(a, b) ((a) == (b))
+
+// murmur3 fmix64, so that sequential or aligned keys still spread over the
+// low bits used to pick a slot
+static inline uint64_t _g_hash_map_mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+#define G_DEFINE_HASH_MAP(TypeName, type_name, KeyType, ValueType) \
+    G_DEFINE_HASH_MAP_FULL(TypeName, type_name, KeyType, ValueType, G_HASH_MAP_INT_HASH, G_HASH_MAP_INT_EQUAL, 0)
+
+// hash_func(key) must return an integer hash, equal_func(a, b) must compare
+// two keys. Either may be a function or a function-like macro.
+#define G_DEFINE_HASH_MAP_FULL(TypeName, type_name, KeyType, ValueType, hash_func, equal_func, empty_key) \
+\
+struct TypeName##Slot { \
+    KeyType key; \
+    ValueType value; \
+}; \
+\
+typedef struct TypeName { \
+    uint32_t num_slots; \
+    uint32_t num_used; \
+    uint32_t resize_threshold; \
+    uint64_t seed; \
+    bool has_empty_key; \
+    ValueType empty_key_value; \
+    struct TypeName##Slot *slots; \
+} TypeName; \
+\
+static inline uint32_t _##type_name##_home(TypeName *map, KeyType key) \
+{ \
+    return (uint32_t) _g_hash_map_mix((uint64_t) hash_func(key) ^ map->seed) & (map->num_slots - 1); \
+} \
+\
+static inline void _##type_name##_alloc_slots(TypeName *map, uint32_t num_slots) \
+{ \
+    map->num_slots = num_slots; \
+    map->resize_threshold = (uint32_t) (num_slots * GHASHMAP_MAX_LOAD); \
+    map->slots = malloc(num_slots * sizeof(struct TypeName##Slot)); \
+    if (map->slots == NULL) { \
+        fprintf(stderr, "FATAL ERROR: _" #type_name "_alloc_slots: Out of memory"); \
+        exit(1); \
+    } \
+\
+    for (uint32_t i = 0; i < num_slots; i++) { \
+        map->slots[i].key = (empty_key); \
+    } \
+} \
+\
+static inline uint32_t _##type_name##_slots_for_size(uint32_t size) \
+{ \
+    uint32_t num_slots = GHASHMAP_MIN_SLOTS; \
+\
+    while ((uint32_t) (num_slots * GHASHMAP_MAX_LOAD) < size) { \
+        if (num_slots > UINT32_MAX / 2) { \
+            fprintf(stderr, "FATAL ERROR: _" #type_name "_slots_for_size: Too many entries"); \
+            exit(1); \
+        } \
+        num_slots *= 2; \
+    } \
+\
+    return num_slots; \
+} \
+\
+static inline TypeName *type_name##_new_sized(uint32_t size) \
+{ \
+    TypeName *map = malloc(sizeof(TypeName)); \
+    if (map == NULL) { \
+        fprintf(stderr, "FATAL ERROR: " #type_name "_new_sized: Out of memory"); \
+        exit(1); \
+    } \
+\
+    map->num_used = 0; \
+    map->seed = _g_hash_map_mix(g_hash_seed() ^ (uint64_t) (uintptr_t) map); \
+    map->has_empty_key = false; \
+    _##type_name##_alloc_slots(map, _##type_name##_slots_for_size(size)); \
+\
+    return map; \
+} \
+\
+static inline TypeName *type_name##_new(void) \
+{ \
+    return type_name##_new_sized(0); \
+} \
+\
+/* Returns the slot holding key, or the free slot ending its probe sequence. */ \
+static inline uint32_t _##type_name##_find_slot(TypeName *map, KeyType key) \
+{ \
+    uint32_t mask = map->num_slots - 1; \
+    uint32_t slot = _##type_name##_home(map, key); \
+\
+    while (!equal_func(map->slots[slot].key, (empty_key)) && !equal_func(map->slots[slot].key, key)) { \
+        slot = (slot + 1) & mask; \
+    } \
+\
+    return slot; \
+} \
+\
+static inline void _##type_name##_resize(TypeName *map, uint32_t num_slots) \
+{ \
+    struct TypeName##Slot *old_slots = map->slots; \
+    uint32_t old_num_slots = map->num_slots; \
+\
+    _##type_name##_alloc_slots(map, num_slots); \
+\
+    for (uint32_t i = 0; i < old_num_slots; i++) { \
+        if (!equal_func(old_slots[i].key, (empty_key))) { \
+            map->slots[_##type_name##_find_slot(map, old_slots[i].key)] = old_slots[i]; \
+        } \
+    } \
+\
+    free(old_slots); \
+} \
+\
+static inline void type_name##_reserve(TypeName *map, uint32_t size) \
+{ \
+    uint32_t num_slots = _##type_name##_slots_for_size(size); \
+\
+    if (num_slots > map->num_slots) { \
+        _##type_name##_resize(map, num_slots); \
+    } \
+} \
+\
+static inline void type_name##_insert(TypeName *map, KeyType key, ValueType value) \
+{ \
+    if (equal_func(key, (empty_key))) { \
+        map->num_used += !map->has_empty_key; \
+        map->has_empty_key = true; \
+        map->empty_key_value = value; \
+        return; \
+    } \
+\
+    uint32_t slot = _##type_name##_find_slot(map, key); \
+\
+    if (!equal_func(map->slots[slot].key, (empty_key))) { \
+        map->slots[slot].value = value; \
+        return; \
+    } \
+\
+    if (map->num_used >= map->resize_threshold) { \
+        _##type_name##_resize(map, map->num_slots * 2); \
+        slot = _##type_name##_find_slot(map, key); \
+    } \
+\
+    map->slots[slot].key = key; \
+    map->slots[slot].value = value; \
+    map->num_used++; \
+} \
+\
+static inline uint32_t type_name##_size(TypeName *map) \
+{ \
+    return map->num_used; \
+} \
+\
+static inline bool type_name##_lookup_extended(TypeName *map, KeyType key, ValueType *ret_value) \
+{ \
+    if (equal_func(key, (empty_key))) { \
+        if (map->has_empty_key && ret_value) { \
+            *ret_value = map->empty_key_value; \
+        } \
+        return map->has_empty_key; \
+    } \
+\
+    uint32_t slot = _##type_name##_find_slot(map, key); \
+\
+    if (equal_func(map->slots[slot].key, (empty_key))) { \
+        return false; \
+    } \
+\
+    if (ret_value) { \
+        *ret_value = map->slots[slot].value; \
+    } \
+\
+    return true; \
+} \
+\
+/* Returns a zero value for missing keys, like GHashTable returns NULL. */ \
+static inline ValueType type_name##_lookup(TypeName *map, KeyType key) \
+{ \
+    ValueType value = {0}; \
+\
+    type_name##_lookup_extended(map, key, &value); \
+\
+    return value; \
+} \
+\
+static inline bool type_name##_remove(TypeName *map, KeyType key) \
+{ \
+    if (equal_func(key, (empty_key))) { \
+        if (!map->has_empty_key) { \
+            return false; \
+        } \
+        map->has_empty_key = false; \
+        map->num_used--; \
+        return true; \
+    } \
+\
+    uint32_t mask = map->num_slots - 1; \
+    uint32_t slot = _##type_name##_find_slot(map, key); \
+\
+    if (equal_func(map->slots[slot].key, (empty_key))) { \
+        return false; \
+    } \
+\
+    /* Move back every following entry whose home slot doesn't lie between \
+       the hole and itself, so no probe sequence crosses a free slot. */ \
+    for (uint32_t next = (slot + 1) & mask; !equal_func(map->slots[next].key, (empty_key)); next = (next + 1) & mask) { \
+        uint32_t home = _##type_name##_home(map, map->slots[next].key); \
+        if (((next - home) & mask) >= ((next - slot) & mask)) { \
+            map->slots[slot] = map->slots[next]; \
+            slot = next; \
+        } \
+    } \
+\
+    map->slots[slot].key = (empty_key); \
+    map->num_used--; \
+\
+    if (map->num_slots > GHASHMAP_MIN_SLOTS && map->num_used < (uint32_t) (map->num_slots * GHASHMAP_MIN_LOAD)) { \
+        _##type_name##_resize(map, _##type_name##_slots_for_size(map->num_used * 2)); \
+    } \
+\
+    return true; \
+} \
+\
+static inline void type_name##_foreach(TypeName *map, void (*func)(KeyType key, ValueType value, void *user_data), void *user_data) \
+{ \
+    if (map->has_empty_key) { \
+        func((empty_key), map->empty_key_value, user_data); \
+    } \
+\
+    for (uint32_t i = 0; i < map->num_slots; i++) { \
+        if (!equal_func(map->slots[i].key, (empty_key))) { \
+            func(map->slots[i].key, map->slots[i].value, user_data); \
+        } \
+    } \
+} \
+\
+static inline void type_name##_destroy(TypeName *map) \
+{ \
+    if (map) { \
+        free(map->slots); \
+        free(map); \
+    } \
+}
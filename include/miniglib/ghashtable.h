@@ -33,47 +33,173 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 
 #define GHASHTABLE_MIN_SLOTS 64
-#define GHASHTABLE_MAX_LOAD 0.5
+#define GHASHTABLE_MAX_LOAD 0.875
+#define GHASHTABLE_MIN_LOAD 0.125
+
+// Slots are probed in groups of GHASHTABLE_GROUP_WIDTH using one control byte
+// per slot. A full slot stores the low 7 bits of its hash in its control byte
+// so only slots whose tag matches are handed to key_equal_func.
+#define GHASHTABLE_GROUP_WIDTH 16
+#define GHASHTABLE_CTRL_EMPTY ((uint8_t) 0x80)
+#define GHASHTABLE_CTRL_DELETED ((uint8_t) 0xFE)
+
+// Number of old slots migrated by each insert, lookup and remove while an
+// incremental resize is in progress.
+#define GHASHTABLE_REHASH_STEP 64
+
+// Number of keys g_hash_table_lookup_batch keeps in flight at once.
+#define GHASHTABLE_LOOKUP_BATCH 16
+
+// Minimum number of keys each thread of g_hash_table_new_from_arrays gets.
+#define GHASHTABLE_BUILD_MIN_KEYS 65536
+
+// Number of slots (or entries, for ordered tables) the threads of
+// g_hash_table_foreach_parallel and g_hash_table_reduce_parallel take at a
+// time. A multiple of 64, so chunks of the control bytes span whole multiples
+// of 64 bytes; ctrl itself only has malloc's alignment.
+#define GHASHTABLE_PARALLEL_CHUNK 4096
+
+// Probe lengths of at least GHASHTABLE_STATS_HISTOGRAM_SIZE - 1 groups share
+// the last bucket of the histograms in GHashTableStats.
+#define GHASHTABLE_STATS_HISTOGRAM_SIZE 16
 
 typedef uint32_t (*GHashFunc)(void *key);
 typedef bool (*GEqualFunc)(void *a, void *b);
 typedef void (*GDestroyNotify)(void *data);
 typedef void (*GHFunc) (void *key, void *value, void *user_data);
 typedef bool (*GHRFunc) (void *key, void *value, void *user_data);
+typedef void (*GHReduceFunc) (void *key, void *value, void *accumulator, void *user_data);
+typedef void (*GHCombineFunc) (void *accumulator, void *other, void *user_data);
+
+typedef enum GHashTableFlags {
+    G_HASH_TABLE_FLAGS_NONE = 0,
+    // Spread the cost of growing over later operations instead of moving
+    // every entry at once.
+    G_HASH_TABLE_INCREMENTAL_RESIZE = 1 << 0,
+    // Keep entries in a dense array in insertion order and index them from
+    // the control bytes with 1, 2 or 4 byte indices. Iteration follows
+    // insertion order. Ordered tables always resize at once.
+    G_HASH_TABLE_ORDERED = 1 << 1,
+} GHashTableFlags;
 
-struct GHashTableSlot {
-    void *key;
-    void *value;
-    bool used : 1;
-    bool deleted : 1;
-};
+// Only counted if the library is built with GHASHTABLE_COUNTERS defined (the
+// MINIGLIB_HASH_TABLE_COUNTERS CMake option). Probes made by the threads of
+// g_hash_table_new_from_arrays are not counted.
+typedef struct GHashTableCounters {
+    // key probes and the groups they visited
+    uint64_t probes;
+    uint64_t probe_groups;
+    uint64_t key_compares;
+    // searches for a free slot and the groups they visited
+    uint64_t free_slot_searches;
+    uint64_t free_slot_groups;
+} GHashTableCounters;
 
 typedef struct GHashTable {
     uint32_t num_slots;
     uint32_t num_used;
+    uint32_t num_deleted;
     uint32_t resize_threshold;
+    uint32_t seed;
+    GHashTableFlags flags;
     GHashFunc hash_func;
     GEqualFunc key_equal_func;
     GDestroyNotify key_destroy_func;
     GDestroyNotify value_destroy_func;
-    struct GHashTableSlot *slots;
+    uint8_t *ctrl;
+    // Keys, values and cached hashes are kept in separate arrays. values is
+    // the keys array itself until a value different from its key is stored,
+    // so sets don't pay for values.
+    void **keys;
+    void **values;
+    uint32_t *hashes;
+    // slot arrays being migrated by an incremental resize
+    uint32_t old_num_slots;
+    uint32_t old_num_used;
+    uint32_t rehash_index;
+    uint8_t *old_ctrl;
+    void **old_keys;
+    void **old_values;
+    uint32_t *old_hashes;
+    // G_HASH_TABLE_ORDERED: keys, values and hashes hold the entries in
+    // insertion order and indices[slot] points into them
+    void *indices;
+    uint32_t num_entries;
+    uint32_t entries_capacity;
+    // rebuilds of the slot arrays, growing, shrinking or purging tombstones
+    uint32_t num_resizes;
+    GHashTableCounters counters;
 } GHashTable;
 
+// Probe lengths count groups, so a key found in its home group has probe
+// length 1. Missing keys are sampled once per home group. While an
+// incremental resize is pending only the new slot arrays are measured.
+typedef struct GHashTableStats {
+    uint32_t size;
+    uint32_t num_slots;
+    uint32_t num_tombstones;
+    double load_factor;
+    double tombstone_ratio;
+    uint32_t max_probe_length_found;
+    double mean_probe_length_found;
+    uint32_t probe_length_found[GHASHTABLE_STATS_HISTOGRAM_SIZE];
+    uint32_t max_probe_length_missing;
+    double mean_probe_length_missing;
+    uint32_t probe_length_missing[GHASHTABLE_STATS_HISTOGRAM_SIZE];
+    uint32_t num_resizes;
+    // everything the table currently holds on the heap
+    size_t bytes_allocated;
+    bool counters_enabled;
+    GHashTableCounters counters;
+} GHashTableStats;
+
+typedef struct GHashTableIter {
+    GHashTable *hash_table;
+    // one past the slot (or entry, for ordered tables) returned by the last
+    // call to g_hash_table_iter_next
+    uint32_t position;
+} GHashTableIter;
+
 uint32_t g_int_hash(void *v);
 bool g_int_equal(void *v1, void *v2);
 uint32_t g_str_hash(void *v);
+uint32_t g_str_hash_len(const void *v, size_t len);
 bool g_str_equal(void *v1, void *v2);
+// The random per-process seed of the string hashes, for hash tables built
+// outside of GHashTable, like the G_DEFINE_HASH_MAP maps. Never 0.
+uint64_t g_hash_seed(void);
 GHashTable *g_hash_table_new(GHashFunc hash_func, GEqualFunc key_equal_func);
+GHashTable *g_hash_table_new_sized(GHashFunc hash_func, GEqualFunc key_equal_func, uint32_t size);
 GHashTable *g_hash_table_new_full(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func);
+GHashTable *g_hash_table_new_with_flags(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func, GHashTableFlags flags);
+GHashTable *g_hash_table_new_from_arrays(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func, void **keys, void **values, uint32_t n, uint32_t num_threads);
 void g_hash_table_insert(GHashTable *hash_table, void *key, void *value);
+bool g_hash_table_add(GHashTable *hash_table, void *key);
+void** g_hash_table_lookup_or_insert(GHashTable *hash_table, void *key, bool *ret_found);
 uint32_t g_hash_table_size(GHashTable *hash_table);
+void g_hash_table_reserve(GHashTable *hash_table, uint32_t size);
+void g_hash_table_compact(GHashTable *hash_table);
+void g_hash_table_get_stats(GHashTable *hash_table, GHashTableStats *stats);
 void* g_hash_table_lookup(GHashTable *hash_table, void *key);
+bool g_hash_table_lookup_extended(GHashTable *hash_table, void *lookup_key, void **orig_key, void **value);
+bool g_hash_table_contains(GHashTable *hash_table, void *key);
+void g_hash_table_lookup_batch(GHashTable *hash_table, void **keys, uint32_t n, void **out_values);
 void g_hash_table_foreach(GHashTable *hash_table, GHFunc func, void *user_data);
+void g_hash_table_foreach_parallel(GHashTable *hash_table, GHFunc func, void *user_data, uint32_t num_threads);
+void g_hash_table_reduce_parallel(GHashTable *hash_table, GHReduceFunc reduce_func, GHCombineFunc combine_func, void *accumulator, size_t accumulator_size, void *user_data, uint32_t num_threads);
+uint32_t g_hash_table_foreach_remove(GHashTable *hash_table, GHRFunc func, void *user_data);
+uint32_t g_hash_table_foreach_steal(GHashTable *hash_table, GHRFunc func, void *user_data);
 bool g_hash_table_remove(GHashTable *hash_table, void *key);
+void g_hash_table_iter_init(GHashTableIter *iter, GHashTable *hash_table);
+bool g_hash_table_iter_next(GHashTableIter *iter, void **key, void **value);
+void g_hash_table_iter_remove(GHashTableIter *iter);
+void g_hash_table_iter_replace(GHashTableIter *iter, void *value);
+void g_hash_table_iter_steal(GHashTableIter *iter);
 void g_hash_table_destroy(GHashTable *hash_table);
 
@@ -0,0 +1,82 @@
+#pragma once
+// A read-only image of a GHashTable with string keys that can be written to a
+// file once and memory-mapped by later processes. Lookups run directly
+// against the mapped pages: opening a snapshot only validates its header, and
+// neither opening nor looking up parses entries or allocates per entry.
+//
+// The file is position independent. It holds a header, an open-addressing
+// slot array and the entries, all addressed by offsets from the start of the
+// file. Keys are hashed with the seed stored in the header, so every process
+// probes the same slots. Files are only readable on machines with the byte
+// order they were written with.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <miniglib/ghashtable.h>
+
+#define GHASHTABLESNAPSHOT_MAGIC "MGLIBHT"
+#define GHASHTABLESNAPSHOT_VERSION 1
+#define GHASHTABLESNAPSHOT_BYTE_ORDER 0x01020304u
+#define GHASHTABLESNAPSHOT_MIN_SLOTS 16
+
+// The data checksum chains the hashes of blocks of this size, so the writer
+// can compute it while streaming.
+#define GHASHTABLESNAPSHOT_BLOCK_SIZE 65536
+
+struct GHashTableSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t seed;
+    uint64_t file_size;
+    uint64_t num_entries;
+    // a power of two, at most half full
+    uint64_t num_slots;
+    uint32_t value_size;
+    uint32_t reserved;
+    uint64_t slots_offset;
+    uint64_t entries_offset;
+    // covers everything after the header
+    uint64_t data_checksum;
+    // covers the header up to this field
+    uint64_t header_checksum;
+};
+
+// entry_offset is 0 for an empty slot. An entry is value_size bytes of value,
+// padded to 8 bytes, then a uint32_t key length and the NUL-terminated key,
+// padded to 8 bytes.
+struct GHashTableSnapshotSlot {
+    uint64_t hash;
+    uint64_t entry_offset;
+};
+
+typedef struct GHashTableSnapshot {
+    const char *data;
+    uint64_t size;
+    const struct GHashTableSnapshotHeader *header;
+    const struct GHashTableSnapshotSlot *slots;
+} GHashTableSnapshot;
+
+// Writes every entry of hash_table to path. Keys must be NUL-terminated
+// strings, values must point at value_size bytes (NULL values are written as
+// zeros). Returns false if the file couldn't be written.
+bool g_hash_table_snapshot_write(GHashTable *hash_table, const char *path, uint32_t value_size);
+
+// Maps a snapshot written by g_hash_table_snapshot_write. Returns NULL if the
+// file can't be mapped or its header is invalid.
+GHashTableSnapshot *g_hash_table_snapshot_open(const char *path);
+
+// Checks the data checksum. This reads the whole file, so it is left to the
+// caller to decide when it's worth it.
+bool g_hash_table_snapshot_verify(GHashTableSnapshot *snapshot);
+
+uint64_t g_hash_table_snapshot_size(GHashTableSnapshot *snapshot);
+uint32_t g_hash_table_snapshot_value_size(GHashTableSnapshot *snapshot);
+
+// Returns a pointer to the value stored for key inside the mapping, or NULL.
+// The pointer is valid until the snapshot is closed.
+const void *g_hash_table_snapshot_lookup(GHashTableSnapshot *snapshot, const char *key);
+const void *g_hash_table_snapshot_lookup_len(GHashTableSnapshot *snapshot, const char *key, size_t len);
+
+void g_hash_table_snapshot_close(GHashTableSnapshot *snapshot);
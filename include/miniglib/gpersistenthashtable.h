@@ -0,0 +1,91 @@
+#pragma once
+// An immutable hash map. Every update returns a new version and leaves the
+// old one untouched; the versions share all nodes the update didn't change.
+// It is a hash array mapped trie: each level of branch nodes consumes
+// GPERSISTENTHASHTABLE_BITS bits of the hash, so an update copies O(log n)
+// small nodes instead of the whole table.
+//
+// Versions and nodes are reference counted, a version is freed with its last
+// reference, and keys and values are destroyed once no version holds them.
+// Since versions never change, any number of threads can read a version
+// without locks. To share the latest version through a pointer, writers use
+// g_persistent_hash_table_publish and readers either
+// g_persistent_hash_table_acquire, or look it up directly between
+// g_concurrent_hash_table_pin and g_concurrent_hash_table_unpin.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <miniglib/ghashtable.h>
+
+#define GPERSISTENTHASHTABLE_BITS 5
+#define GPERSISTENTHASHTABLE_BRANCHING (1 << GPERSISTENTHASHTABLE_BITS)
+
+enum GPersistentHashTableNodeKind {
+    G_PERSISTENT_HASH_TABLE_LEAF,
+    G_PERSISTENT_HASH_TABLE_BRANCH,
+    // leaves whose hashes are all equal
+    G_PERSISTENT_HASH_TABLE_COLLISION,
+};
+
+struct GPersistentHashTableNode {
+    _Atomic uint32_t ref_count;
+    enum GPersistentHashTableNodeKind kind;
+};
+
+struct GPersistentHashTableLeaf {
+    struct GPersistentHashTableNode node;
+    uint32_t hash;
+    void *key;
+    void *value;
+    // the leaf that inserted the key, itself unless the key was replaced;
+    // key_ref_count of the owner counts the leaves sharing its key
+    struct GPersistentHashTableLeaf *key_owner;
+    _Atomic uint32_t key_ref_count;
+};
+
+struct GPersistentHashTableBranch {
+    struct GPersistentHashTableNode node;
+    // bit i is set if there is a child for hash bits i at this level, the
+    // children are stored densely in the order of their bits
+    uint32_t bitmap;
+    struct GPersistentHashTableNode *children[];
+};
+
+struct GPersistentHashTableCollision {
+    struct GPersistentHashTableNode node;
+    uint32_t hash;
+    uint32_t num_leaves;
+    struct GPersistentHashTableLeaf *leaves[];
+};
+
+typedef struct GPersistentHashTable {
+    _Atomic uint32_t ref_count;
+    uint32_t size;
+    uint32_t seed;
+    GHashFunc hash_func;
+    GEqualFunc key_equal_func;
+    GDestroyNotify key_destroy_func;
+    GDestroyNotify value_destroy_func;
+    // NULL for an empty version
+    struct GPersistentHashTableNode *root;
+} GPersistentHashTable;
+
+GPersistentHashTable *g_persistent_hash_table_new(GHashFunc hash_func, GEqualFunc key_equal_func);
+GPersistentHashTable *g_persistent_hash_table_new_full(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func);
+GPersistentHashTable *g_persistent_hash_table_ref(GPersistentHashTable *hash_table);
+void g_persistent_hash_table_unref(GPersistentHashTable *hash_table);
+// The table owns the key and value it is given. Replacing an existing key
+// keeps the stored key, like GHashTable, and destroys the given one unless it
+// is the same pointer; the new and old versions share the stored key until
+// the last of them goes. Inserting the value a key already maps to returns
+// another reference to the same version.
+GPersistentHashTable *g_persistent_hash_table_insert(GPersistentHashTable *hash_table, void *key, void *value);
+GPersistentHashTable *g_persistent_hash_table_remove(GPersistentHashTable *hash_table, void *key);
+uint32_t g_persistent_hash_table_size(GPersistentHashTable *hash_table);
+void* g_persistent_hash_table_lookup(GPersistentHashTable *hash_table, void *key);
+bool g_persistent_hash_table_lookup_extended(GPersistentHashTable *hash_table, void *lookup_key, void **orig_key, void **value);
+bool g_persistent_hash_table_contains(GPersistentHashTable *hash_table, void *key);
+void g_persistent_hash_table_foreach(GPersistentHashTable *hash_table, GHFunc func, void *user_data);
+void g_persistent_hash_table_publish(_Atomic(GPersistentHashTable*) *current, GPersistentHashTable *hash_table);
+GPersistentHashTable *g_persistent_hash_table_acquire(_Atomic(GPersistentHashTable*) *current);
@@ -1,14 +1,32 @@
+// For mremap. garray.c is compiled on its own, so unlike in the header this
+// doesn't leak into users.
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <miniglib/garray.h>
+#include "ghashtableprivate.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <threads.h>
 
 // Needed for qsort_s
 #if (defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
 #include <search.h>
 #endif
 
+#if !(defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // We would need to define _GNU_SOURCE for stdlib.h to declare qsort_r. Since we
 // are header-only we better declare it ourselves to make sure we don't define
 // _GNU_SOURCE when we shouldn't
@@ -33,34 +51,315 @@ void _g_array_zero_terminate(GArray *array)
     memset(&array->data[array->len * array->_element_size], 0, array->_element_size);
 }
 
-void _g_array_resize_if_needed(GArray *array, unsigned int new_elements)
+// Sizes are checked once, where they grow: every byte offset into the array
+// is then below the allocation size and can't overflow.
+size_t _g_array_checked_add(size_t a, size_t b)
 {
-    unsigned int new_len = array->len + new_elements;
-    unsigned int needed = new_len;
+    if (a > SIZE_MAX - b) {
+        fprintf(stderr, "FATAL ERROR: _g_array_checked_add: Array too large");
+        exit(1);
+    }
 
-    if (array->_zero_terminated) {
-        needed++;
+    return a + b;
+}
+
+size_t _g_array_checked_mul(size_t a, size_t b)
+{
+    if (b != 0 && a > SIZE_MAX / b) {
+        fprintf(stderr, "FATAL ERROR: _g_array_checked_mul: Array too large");
+        exit(1);
     }
 
-    if (needed <= array->_allocated_elements) {
+    return a * b;
+}
+
+#if !(defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+
+// Shrinks the file of a writable mapping and the mapping to
+// allocated_elements. Returns false and leaves both as they were if the file
+// can't be shrunk.
+bool _g_array_trim_mapping(GArray *array, size_t allocated_elements)
+{
+    size_t old_size = array->_allocated_elements * array->_element_size;
+    size_t size = allocated_elements * array->_element_size;
+
+    if (ftruncate(array->_fd, (off_t) size) != 0) {
+        return false;
+    }
+
+    // unmapping the pages past the end never moves the rest
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t kept = (size + page_size - 1) / page_size * page_size;
+    if (kept < old_size) {
+        munmap(&array->data[kept], old_size - kept);
+    }
+
+    if (size == 0) {
+        array->data = NULL;
+    }
+    array->_allocated_elements = allocated_elements;
+
+    return true;
+}
+
+// Drops the mapping and leaves an empty heap array. The file of a writable
+// mapping keeps len elements.
+void _g_array_unmap(GArray *array)
+{
+    // the callers can't return an error, g_array_sync can
+    if (array->_backing == _G_ARRAY_MAPPED_WRITABLE && array->len < array->_allocated_elements && !_g_array_trim_mapping(array, array->len)) {
+        fprintf(stderr, "Critical: _g_array_unmap: Can't trim the file to len (%zu) elements, it keeps %zu zeroed ones past them\n",
+                array->len, array->_allocated_elements - array->len);
+    }
+
+    if (array->data != NULL) {
+        munmap(array->data, array->_allocated_elements * array->_element_size);
+    }
+
+    if (array->_fd >= 0) {
+        close(array->_fd);
+    }
+
+    array->data = NULL;
+    array->_allocated_elements = 0;
+    array->_backing = _G_ARRAY_HEAP;
+    array->_fd = -1;
+}
+
+// Grows or shrinks the file of a writable mapping along with the mapping.
+// Only growing is fatal if the file can't be resized; shrinking then keeps
+// the room.
+void _g_array_resize_mapping(GArray *array, size_t allocated_elements)
+{
+    if (allocated_elements < array->_allocated_elements) {
+        _g_array_trim_mapping(array, allocated_elements);
         return;
     }
 
-    array->data = realloc(array->data, needed * array->_element_size);
-    if (array->data == NULL) {
-        fprintf(stderr, "FATAL ERROR: _g_array_resize_if_needed: Out of memory");
+    size_t old_size = array->_allocated_elements * array->_element_size;
+    size_t size = _g_array_checked_mul(allocated_elements, array->_element_size);
+
+    if (size > (size_t) INT64_MAX || ftruncate(array->_fd, (off_t) size) != 0) {
+        fprintf(stderr, "FATAL ERROR: _g_array_resize_mapping: Can't resize the file");
         exit(1);
     }
 
-    if (array->_clear) {
-        memset(&array->data[array->_allocated_elements * array->_element_size], 0,
-                (needed - array->_allocated_elements) * array->_element_size);
+    char *data = NULL;
+    if (size == 0) {
+        // nothing was mapped and nothing is needed
+    } else if (old_size == 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, array->_fd, 0);
+    } else {
+#ifdef __linux__
+        data = mremap(array->data, old_size, size, MREMAP_MAYMOVE);
+#else
+        // the file holds the elements while nothing maps it
+        munmap(array->data, old_size);
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, array->_fd, 0);
+#endif
     }
 
-    array->_allocated_elements = needed;
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "FATAL ERROR: _g_array_resize_mapping: Out of memory");
+        exit(1);
+    }
+
+    array->data = data;
+    array->_allocated_elements = allocated_elements;
 }
 
-GArray* g_array_new(bool zero_terminated, bool clear, unsigned int element_size)
+GArray* _g_array_map_file(const char *path, size_t element_size, _GArrayBacking backing)
+{
+    int fd = open(path, backing == _G_ARRAY_MAPPED_WRITABLE ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+
+    if (element_size == 0 || (uintmax_t) st.st_size > SIZE_MAX || (uintmax_t) st.st_size % element_size != 0) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // an empty file has nothing to map
+    size_t size = (size_t) st.st_size;
+    char *data = NULL;
+    if (size != 0) {
+        int prot = backing == _G_ARRAY_MAPPED_READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+        int flags = backing == _G_ARRAY_MAPPED_COPY_ON_WRITE ? MAP_PRIVATE : MAP_SHARED;
+
+        data = mmap(NULL, size, prot, flags, fd, 0);
+        if (data == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return NULL;
+        }
+    }
+
+    // the mapping stays valid without the file, only a writable array
+    // needs it to grow
+    if (backing != _G_ARRAY_MAPPED_WRITABLE) {
+        close(fd);
+        fd = -1;
+    }
+
+    GArray *array = g_array_new(false, false, element_size);
+    array->data = data;
+    array->len = size / element_size;
+    array->_allocated_elements = array->len;
+    array->_backing = backing;
+    array->_fd = fd;
+
+    return array;
+}
+
+GArray* g_array_new_mapped(const char *path, size_t element_size, GArrayMapFlags flags)
+{
+    return _g_array_map_file(path, element_size, flags & G_ARRAY_MAP_COPY_ON_WRITE ? _G_ARRAY_MAPPED_COPY_ON_WRITE : _G_ARRAY_MAPPED_READ_ONLY);
+}
+
+GArray* g_array_map_writable(const char *path, size_t element_size)
+{
+    return _g_array_map_file(path, element_size, _G_ARRAY_MAPPED_WRITABLE);
+}
+
+bool g_array_sync(GArray *array)
+{
+    if (array->_backing != _G_ARRAY_MAPPED_WRITABLE) {
+        return true;
+    }
+
+    if (array->len < array->_allocated_elements && !_g_array_trim_mapping(array, array->len)) {
+        return false;
+    }
+
+    return array->data == NULL || msync(array->data, array->len * array->_element_size, MS_SYNC) == 0;
+}
+
+#else
+
+// Arrays are never mapped on Windows.
+void _g_array_unmap(GArray *array)
+{
+}
+
+void _g_array_resize_mapping(GArray *array, size_t allocated_elements)
+{
+}
+
+GArray* g_array_new_mapped(const char *path, size_t element_size, GArrayMapFlags flags)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+GArray* g_array_map_writable(const char *path, size_t element_size)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+bool g_array_sync(GArray *array)
+{
+    return true;
+}
+
+#endif
+
+// Copies the elements of a mapped array to the heap and drops the mapping.
+void _g_array_move_to_heap(GArray *array)
+{
+    size_t len = array->len;
+    char *data = NULL;
+
+    if (len != 0) {
+        data = malloc(len * array->_element_size);
+        if (data == NULL) {
+            fprintf(stderr, "FATAL ERROR: _g_array_move_to_heap: Out of memory");
+            exit(1);
+        }
+        memcpy(data, array->data, len * array->_element_size);
+    }
+
+    _g_array_unmap(array);
+    array->data = data;
+    array->_allocated_elements = len;
+}
+
+void _g_array_reallocate(GArray *array, size_t allocated_elements)
+{
+    switch (array->_backing) {
+        case _G_ARRAY_HEAP:
+            break;
+        case _G_ARRAY_MAPPED_READ_ONLY:
+            // the mapping can't give back memory it doesn't own
+            if (allocated_elements <= array->_allocated_elements) {
+                return;
+            }
+            fprintf(stderr, "BUG: _g_array_reallocate: Array is mapped read-only.");
+            abort();
+        case _G_ARRAY_MAPPED_COPY_ON_WRITE:
+            _g_array_move_to_heap(array);
+            break;
+        case _G_ARRAY_MAPPED_WRITABLE:
+            _g_array_resize_mapping(array, allocated_elements);
+            return;
+    }
+
+    if (allocated_elements == 0) {
+        free(array->data);
+        array->data = NULL;
+        array->_allocated_elements = 0;
+        return;
+    }
+
+    char *data = realloc(array->data, _g_array_checked_mul(allocated_elements, array->_element_size));
+    if (data == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_array_reallocate: Out of memory");
+        exit(1);
+    }
+
+    array->data = data;
+    array->_allocated_elements = allocated_elements;
+}
+
+void _g_array_resize_if_needed(GArray *array, size_t new_elements)
+{
+    size_t needed = _g_array_checked_add(_g_array_checked_add(array->len, new_elements), array->_zero_terminated);
+
+    if (needed <= array->_allocated_elements) {
+        return;
+    }
+
+    // growing past what the address space can hold falls back to needed
+    double grown_elements = array->_allocated_elements * (double) GARRAY_GROWTH_FACTOR;
+    size_t grown = 0;
+    if (array->_element_size == 0 || grown_elements < (double) (SIZE_MAX / array->_element_size)) {
+        grown = (size_t) grown_elements;
+    }
+
+    _g_array_reallocate(array, needed > grown ? needed : grown);
+}
+
+// Zeroes elements that became part of the array without being written, the
+// rest of the allocation is left alone.
+void _g_array_clear_range(GArray *array, size_t start, size_t end)
+{
+    if (array->_clear && start < end) {
+        memset(&array->data[start * array->_element_size], 0, (end - start) * array->_element_size);
+    }
+}
+
+GArray* g_array_new(bool zero_terminated, bool clear, size_t element_size)
 {
     return g_array_sized_new(zero_terminated, clear, element_size, 0);
 }
@@ -71,18 +370,18 @@ void* g_array_steal(GArray *array, size_t *len)
 
     *len = array->len;
 
+    // the caller frees what it gets
+    if (array->_backing != _G_ARRAY_HEAP) {
+        _g_array_move_to_heap(array);
+    }
+
     data = array->data;
     array->data = NULL;
     array->len = 0;
     array->_allocated_elements = 0;
 
     if (array->_zero_terminated) {
-        if (array->_clear) {
-            array->data = calloc(array->_element_size, 1);
-        } else {
-            array->data = malloc(array->_element_size);
-        }
-
+        array->data = malloc(array->_element_size);
         if (array->data == NULL) {
             fprintf(stderr, "FATAL ERROR: g_array_steal: Out of memory");
             exit(1);
@@ -96,7 +395,7 @@ void* g_array_steal(GArray *array, size_t *len)
     return data;
 }
 
-GArray* g_array_sized_new(bool zero_terminated, bool clear, unsigned int element_size, unsigned int reserved_size)
+GArray* g_array_sized_new(bool zero_terminated, bool clear, size_t element_size, size_t reserved_size)
 {
     GArray *array;
 
@@ -108,32 +407,25 @@ GArray* g_array_sized_new(bool zero_terminated, bool clear, unsigned int element
 
     array->data = NULL;
     array->len = 0;
-    array->_allocated_elements = reserved_size;
+    array->_allocated_elements = _g_array_checked_add(reserved_size, zero_terminated);
     array->_zero_terminated = zero_terminated;
     array->_clear = clear;
     array->_element_size = element_size;
     array->_clear_func = NULL;
-
-    if (zero_terminated) {
-        array->_allocated_elements++;
-    }
+    array->_backing = _G_ARRAY_HEAP;
+    array->_fd = -1;
 
     if (array->_allocated_elements == 0) {
         return array;
     }
 
-    if (clear) {
-        array->data = calloc(array->_allocated_elements * array->_element_size, 1);
-    } else {
-        array->data = malloc(array->_allocated_elements * array->_element_size);
-    }
-
+    array->data = malloc(_g_array_checked_mul(array->_allocated_elements, array->_element_size));
     if (array->data == NULL) {
         fprintf(stderr, "FATAL ERROR: g_array_sized_new: Out of memory");
         exit(1);
     }
 
-    if (!clear && zero_terminated) {
+    if (zero_terminated) {
         _g_array_zero_terminate(array);
     }
 
@@ -156,24 +448,31 @@ GArray* g_array_copy(GArray *array)
 
     memcpy(copy, array, sizeof(GArray));
 
-    copy->data = malloc(copy->_allocated_elements * copy->_element_size);
-    if (copy->data == NULL) {
-        fprintf(stderr, "FATAL ERROR: g_array_copy: Out of memory");
-        exit(1);
-    }
+    // the copy doesn't inherit the spare room or the mapping
+    copy->data = NULL;
+    copy->_backing = _G_ARRAY_HEAP;
+    copy->_fd = -1;
+    copy->_allocated_elements = 0;
+    _g_array_reallocate(copy, array->len + array->_zero_terminated);
 
-    memcpy(copy->data, array->data, copy->_allocated_elements);
+    if (copy->_allocated_elements) {
+        memcpy(copy->data, array->data, copy->_allocated_elements * copy->_element_size);
+    }
 
     return copy;
 }
 
-unsigned int g_array_get_element_size(GArray *array)
+size_t g_array_get_element_size(GArray *array)
 {
     return array->_element_size;
 }
 
-GArray* g_array_append_vals(GArray *array, const void *data, unsigned int len)
+GArray* g_array_append_vals(GArray *array, const void *data, size_t len)
 {
+    if (len == 0) {
+        return array;
+    }
+
     _g_array_resize_if_needed(array, len);
 
     memcpy(&array->data[array->len * array->_element_size], data, len * array->_element_size);
@@ -185,8 +484,12 @@ GArray* g_array_append_vals(GArray *array, const void *data, unsigned int len)
     return array;
 }
 
-GArray* g_array_prepend_vals(GArray *array, const void *data, unsigned int len)
+GArray* g_array_prepend_vals(GArray *array, const void *data, size_t len)
 {
+    if (len == 0) {
+        return array;
+    }
+
     _g_array_resize_if_needed(array, len);
 
     memmove(&array->data[len * array->_element_size], &array->data[0], array->len * array->_element_size);
@@ -199,20 +502,22 @@ GArray* g_array_prepend_vals(GArray *array, const void *data, unsigned int len)
     return array;
 }
 
-GArray* g_array_insert_vals(GArray *array, unsigned int index, const void *data, unsigned int len)
+GArray* g_array_insert_vals(GArray *array, size_t index, const void *data, size_t len)
 {
-    unsigned int needed = len;
+    size_t needed = len;
 
     // we need to allocate extra bytes if the index to insert at is outside of
     // the array
-    if (index > (array->len - 1)) {
-        needed += index - array->len;
+    if (index > array->len) {
+        needed = _g_array_checked_add(needed, index - array->len);
     }
 
     _g_array_resize_if_needed(array, needed);
 
     if (index < array->len) {
         memmove(&array->data[(index + len) * array->_element_size], &array->data[index * array->_element_size], (array->len - index) * array->_element_size);
+    } else {
+        _g_array_clear_range(array, array->len, index);
     }
     memcpy(&array->data[index * array->_element_size], data, len * array->_element_size);
     array->len += needed;
@@ -224,10 +529,10 @@ GArray* g_array_insert_vals(GArray *array, unsigned int index, const void *data,
     return array;
 }
 
-GArray* g_array_remove_index(GArray *array, unsigned int index)
+GArray* g_array_remove_index(GArray *array, size_t index)
 {
     if (array->_clear_func) {
-        array->_clear_func(&array->data[index]);
+        array->_clear_func(&array->data[index * array->_element_size]);
     }
 
     // do we need to move other elements back?
@@ -244,10 +549,10 @@ GArray* g_array_remove_index(GArray *array, unsigned int index)
     return array;
 }
 
-GArray* g_array_remove_index_fast(GArray *array, unsigned int index)
+GArray* g_array_remove_index_fast(GArray *array, size_t index)
 {
     if (array->_clear_func) {
-        array->_clear_func(&array->data[index]);
+        array->_clear_func(&array->data[index * array->_element_size]);
     }
 
     if (array->len > 1 && index < (array->len - 1)) {
@@ -263,11 +568,11 @@ GArray* g_array_remove_index_fast(GArray *array, unsigned int index)
     return array;
 }
 
-GArray* g_array_remove_range(GArray *array, unsigned int index, unsigned int length)
+GArray* g_array_remove_range(GArray *array, size_t index, size_t length)
 {
     if (array->_clear_func) {
-        for (int i = index; i < (index + length - 1); i++) {
-            array->_clear_func(&array->data[i]);
+        for (size_t i = index; i < index + length; i++) {
+            array->_clear_func(&array->data[i * array->_element_size]);
         }
     }
 
@@ -285,30 +590,699 @@ GArray* g_array_remove_range(GArray *array, unsigned int index, unsigned int len
     return array;
 }
 
-void g_array_sort(GArray *array, GCompareFunc compare_func)
+// The sort engine specialized for the element sizes that fit in registers,
+// other sizes go through qsort
+struct _g_array_element_4 { unsigned char bytes[4]; };
+struct _g_array_element_8 { unsigned char bytes[8]; };
+struct _g_array_element_16 { unsigned char bytes[16]; };
+
+#define _G_ARRAY_LESS(a, b) ((*(GCompareFunc*) context)((a), (b)) < 0)
+#define _G_ARRAY_LESS_WITH_DATA(a, b) (((struct _garray_qsort_r_data*) context)->compare_func((a), (b), ((struct _garray_qsort_r_data*) context)->user_data) < 0)
+
+_G_ARRAY_SORT_DEFINE_ENGINE(compare_4, struct _g_array_element_4, _G_ARRAY_LESS)
+_G_ARRAY_SORT_DEFINE_ENGINE(compare_8, struct _g_array_element_8, _G_ARRAY_LESS)
+_G_ARRAY_SORT_DEFINE_ENGINE(compare_16, struct _g_array_element_16, _G_ARRAY_LESS)
+_G_ARRAY_SORT_DEFINE_ENGINE(compare_data_4, struct _g_array_element_4, _G_ARRAY_LESS_WITH_DATA)
+_G_ARRAY_SORT_DEFINE_ENGINE(compare_data_8, struct _g_array_element_8, _G_ARRAY_LESS_WITH_DATA)
+_G_ARRAY_SORT_DEFINE_ENGINE(compare_data_16, struct _g_array_element_16, _G_ARRAY_LESS_WITH_DATA)
+
+void _g_array_sort_range(char *data, size_t n, size_t size, GCompareFunc compare_func)
 {
-    qsort(array->data, array->len, array->_element_size, compare_func);
+    if (n < 2) {
+        return;
+    }
+
+    switch (size) {
+        case 4:
+            _g_array_sort_compare_4((struct _g_array_element_4*) (void*) data, n, &compare_func);
+            break;
+        case 8:
+            _g_array_sort_compare_8((struct _g_array_element_8*) (void*) data, n, &compare_func);
+            break;
+        case 16:
+            _g_array_sort_compare_16((struct _g_array_element_16*) (void*) data, n, &compare_func);
+            break;
+        default:
+            qsort(data, n, size, compare_func);
+            break;
+    }
 }
 
-void g_array_sort_with_data(GArray *array, GCompareDataFunc compare_func, void *user_data)
+void _g_array_sort_range_with_data(char *data, size_t n, size_t size, GCompareDataFunc compare_func, void *user_data)
 {
-#if (defined __linux__)
-    qsort_r(array->data, array->len, array->_element_size, compare_func, user_data);
-#elif (defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
     struct _garray_qsort_r_data tmp;
     tmp.user_data = user_data;
     tmp.compare_func = compare_func;
-    qsort_s(array->data, array->len, array->_element_size, &_garray_qsort_r_arg_swap, &tmp);
+
+    if (n < 2) {
+        return;
+    }
+
+    switch (size) {
+        case 4:
+            _g_array_sort_compare_data_4((struct _g_array_element_4*) (void*) data, n, &tmp);
+            return;
+        case 8:
+            _g_array_sort_compare_data_8((struct _g_array_element_8*) (void*) data, n, &tmp);
+            return;
+        case 16:
+            _g_array_sort_compare_data_16((struct _g_array_element_16*) (void*) data, n, &tmp);
+            return;
+    }
+
+#if (defined __linux__)
+    qsort_r(data, n, size, compare_func, user_data);
+#elif (defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+    qsort_s(data, n, size, &_garray_qsort_r_arg_swap, &tmp);
 #else
     // BSD / macOS
-    struct _garray_qsort_r_data tmp;
-    tmp.user_data = user_data;
-    tmp.compare_func = compare_func;
-    qsort_r(array->data, array->len, array->_element_size, &tmp, &_garray_qsort_r_arg_swap);
+    qsort_r(data, n, size, &tmp, &_garray_qsort_r_arg_swap);
 #endif
 }
 
-bool g_array_binary_search(GArray *array, const void *target, GCompareFunc compare_func, unsigned int *out_match_index)
+void g_array_sort(GArray *array, GCompareFunc compare_func)
+{
+    _g_array_sort_range(array->data, array->len, array->_element_size, compare_func);
+}
+
+void g_array_sort_with_data(GArray *array, GCompareDataFunc compare_func, void *user_data)
+{
+    _g_array_sort_range_with_data(array->data, array->len, array->_element_size, compare_func, user_data);
+}
+
+#define _G_ARRAY_MERGE_SORT_RUN 16
+
+static inline void _g_array_copy_element(char *dst, const char *src, size_t size)
+{
+    switch (size) {
+        case 4:
+            memcpy(dst, src, 4);
+            break;
+        case 8:
+            memcpy(dst, src, 8);
+            break;
+        case 16:
+            memcpy(dst, src, 16);
+            break;
+        default:
+            memcpy(dst, src, size);
+            break;
+    }
+}
+
+int _g_array_compare_without_data(const void *a, const void *b, void *user_data)
+{
+    return (*(GCompareFunc*) user_data)(a, b);
+}
+
+// Insertion sorts short runs, then merges them bottom-up between data and
+// buffer. buffer holds n + 1 elements, the last one is scratch space.
+void _g_array_merge_sort(char *data, char *buffer, size_t n, size_t size, GCompareDataFunc compare_func, void *user_data)
+{
+    char *tmp = &buffer[n * size];
+
+    for (size_t start = 0; start < n; start += _G_ARRAY_MERGE_SORT_RUN) {
+        size_t end = start + _G_ARRAY_MERGE_SORT_RUN < n ? start + _G_ARRAY_MERGE_SORT_RUN : n;
+
+        for (size_t i = start + 1; i < end; i++) {
+            size_t j = i;
+
+            if (compare_func(&data[i * size], &data[(i - 1) * size], user_data) >= 0) {
+                continue;
+            }
+
+            _g_array_copy_element(tmp, &data[i * size], size);
+            do {
+                j--;
+            } while (j > start && compare_func(tmp, &data[(j - 1) * size], user_data) < 0);
+            memmove(&data[(j + 1) * size], &data[j * size], (i - j) * size);
+            _g_array_copy_element(&data[j * size], tmp, size);
+        }
+    }
+
+    char *src = data;
+    char *dst = buffer;
+
+    for (size_t width = _G_ARRAY_MERGE_SORT_RUN; width < n; width *= 2) {
+        for (size_t start = 0; start < n; start += 2 * width) {
+            size_t mid = start + width < n ? start + width : n;
+            size_t end = mid + width < n ? mid + width : n;
+            size_t i = start;
+            size_t j = mid;
+            size_t k = start;
+
+            // runs that are already in order are copied whole
+            if (mid == end || compare_func(&src[(mid - 1) * size], &src[mid * size], user_data) <= 0) {
+                memcpy(&dst[start * size], &src[start * size], (end - start) * size);
+                continue;
+            }
+
+            while (i < mid && j < end) {
+                // ties take the left element, which keeps the sort stable
+                if (compare_func(&src[j * size], &src[i * size], user_data) < 0) {
+                    _g_array_copy_element(&dst[k++ * size], &src[j++ * size], size);
+                } else {
+                    _g_array_copy_element(&dst[k++ * size], &src[i++ * size], size);
+                }
+            }
+            memcpy(&dst[k * size], &src[i * size], (mid - i) * size);
+            k += mid - i;
+            memcpy(&dst[k * size], &src[j * size], (end - j) * size);
+        }
+
+        char *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != data) {
+        memcpy(data, src, n * size);
+    }
+}
+
+void g_array_sort_stable_with_data(GArray *array, GCompareDataFunc compare_func, void *user_data)
+{
+    if (array->len < 2) {
+        return;
+    }
+
+    char *buffer = malloc(_g_array_checked_mul(array->len + 1, array->_element_size));
+    if (buffer == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_array_sort_stable_with_data: Out of memory");
+        exit(1);
+    }
+
+    _g_array_merge_sort(array->data, buffer, array->len, array->_element_size, compare_func, user_data);
+
+    free(buffer);
+}
+
+void g_array_sort_stable(GArray *array, GCompareFunc compare_func)
+{
+    g_array_sort_stable_with_data(array, _g_array_compare_without_data, &compare_func);
+}
+
+struct _GArraySortParallel;
+
+struct _GArraySortParallelTask {
+    struct _GArraySortParallel *sort;
+    uint32_t thread;
+};
+
+struct _GArraySortParallel {
+    size_t n;
+    size_t size;
+    uint32_t num_threads;
+    // exactly one of them is set
+    GCompareFunc compare_func;
+    GCompareDataFunc compare_data_func;
+    void *user_data;
+    struct _GArraySortParallelTask *tasks;
+    // each round merges pairs of sorted runs from src into dst, run r is
+    // [run_start[r], run_start[r + 1])
+    char *src;
+    char *dst;
+    size_t *run_start;
+    uint32_t num_runs;
+};
+
+static inline int _g_array_sort_parallel_compare(struct _GArraySortParallel *sort, const void *a, const void *b)
+{
+    if (sort->compare_func) {
+        return sort->compare_func(a, b);
+    }
+
+    return sort->compare_data_func(a, b, sort->user_data);
+}
+
+// The elements thread writes in a merge round, and the run it sorts before
+void _g_array_sort_parallel_share(struct _GArraySortParallel *sort, uint32_t thread, size_t *ret_lo, size_t *ret_hi)
+{
+    *ret_lo = sort->n / sort->num_threads * thread;
+    *ret_hi = thread + 1 == sort->num_threads ? sort->n : sort->n / sort->num_threads * (thread + 1);
+}
+
+// Every thread sorts one run in place
+int _g_array_sort_parallel_runs(void *data)
+{
+    struct _GArraySortParallelTask *task = data;
+    struct _GArraySortParallel *sort = task->sort;
+    size_t start = sort->run_start[task->thread];
+    size_t n = sort->run_start[task->thread + 1] - start;
+
+    if (sort->compare_func) {
+        _g_array_sort_range(&sort->src[start * sort->size], n, sort->size, sort->compare_func);
+    } else {
+        _g_array_sort_range_with_data(&sort->src[start * sort->size], n, sort->size, sort->compare_data_func, sort->user_data);
+    }
+
+    return 0;
+}
+
+// Returns how many of the first k elements of the merge of a and b come from
+// a. Ties are taken from a first, so the merge is stable.
+size_t _g_array_sort_parallel_corank(struct _GArraySortParallel *sort, const char *a, size_t a_len, const char *b, size_t b_len, size_t k)
+{
+    size_t lo = k > b_len ? k - b_len : 0;
+    size_t hi = k < a_len ? k : a_len;
+
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        size_t j = k - i;
+
+        if (_g_array_sort_parallel_compare(sort, &a[i * sort->size], &b[(j - 1) * sort->size]) <= 0) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+
+    return lo;
+}
+
+// Every thread writes the same share of the round's output, wherever it falls
+// among the pairs, and finds its share of the inputs by co-ranking.
+int _g_array_sort_parallel_merge(void *data)
+{
+    struct _GArraySortParallelTask *task = data;
+    struct _GArraySortParallel *sort = task->sort;
+    size_t size = sort->size;
+    size_t lo, hi;
+
+    _g_array_sort_parallel_share(sort, task->thread, &lo, &hi);
+
+    for (uint32_t pair = 0; pair < sort->num_runs; pair += 2) {
+        size_t pair_start = sort->run_start[pair];
+        size_t pair_mid = sort->run_start[pair + 1];
+        size_t pair_end = pair + 2 <= sort->num_runs ? sort->run_start[pair + 2] : pair_mid;
+
+        if (pair_end <= lo) {
+            continue;
+        }
+
+        if (pair_start >= hi) {
+            break;
+        }
+
+        const char *a = &sort->src[pair_start * size];
+        const char *b = &sort->src[pair_mid * size];
+        size_t a_len = pair_mid - pair_start;
+        size_t b_len = pair_end - pair_mid;
+        size_t from = (lo > pair_start ? lo : pair_start) - pair_start;
+        size_t to = (hi < pair_end ? hi : pair_end) - pair_start;
+
+        size_t i = _g_array_sort_parallel_corank(sort, a, a_len, b, b_len, from);
+        size_t j = from - i;
+        size_t i_end = _g_array_sort_parallel_corank(sort, a, a_len, b, b_len, to);
+        size_t j_end = to - i_end;
+        char *out = &sort->dst[(pair_start + from) * size];
+
+        while (i < i_end && j < j_end) {
+            if (_g_array_sort_parallel_compare(sort, &b[j * size], &a[i * size]) < 0) {
+                _g_array_copy_element(out, &b[j++ * size], size);
+            } else {
+                _g_array_copy_element(out, &a[i++ * size], size);
+            }
+            out += size;
+        }
+
+        memcpy(out, &a[i * size], (i_end - i) * size);
+        out += (i_end - i) * size;
+        memcpy(out, &b[j * size], (j_end - j) * size);
+    }
+
+    return 0;
+}
+
+int _g_array_sort_parallel_copy(void *data)
+{
+    struct _GArraySortParallelTask *task = data;
+    struct _GArraySortParallel *sort = task->sort;
+    size_t lo, hi;
+
+    _g_array_sort_parallel_share(sort, task->thread, &lo, &hi);
+    memcpy(&sort->dst[lo * sort->size], &sort->src[lo * sort->size], (hi - lo) * sort->size);
+
+    return 0;
+}
+
+void _g_array_sort_parallel(GArray *array, struct _GArraySortParallel *sort, uint32_t num_threads, void *scratch)
+{
+    size_t n = array->len;
+
+    if (num_threads > n / GARRAY_SORT_PARALLEL_MIN_ELEMENTS) {
+        num_threads = (uint32_t) (n / GARRAY_SORT_PARALLEL_MIN_ELEMENTS);
+    }
+
+    if (num_threads <= 1) {
+        if (sort->compare_func) {
+            _g_array_sort_range(array->data, n, array->_element_size, sort->compare_func);
+        } else {
+            _g_array_sort_range_with_data(array->data, n, array->_element_size, sort->compare_data_func, sort->user_data);
+        }
+        return;
+    }
+
+    char *buffer = scratch;
+    if (buffer == NULL) {
+        buffer = malloc(_g_array_checked_mul(n, array->_element_size));
+    }
+    sort->tasks = malloc(num_threads * sizeof(struct _GArraySortParallelTask));
+    sort->run_start = malloc((num_threads + 1) * sizeof(size_t));
+    if (buffer == NULL || sort->tasks == NULL || sort->run_start == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_array_sort_parallel: Out of memory");
+        exit(1);
+    }
+
+    sort->n = n;
+    sort->size = array->_element_size;
+    sort->num_threads = num_threads;
+    sort->src = array->data;
+    sort->dst = buffer;
+    sort->num_runs = num_threads;
+
+    for (uint32_t t = 0; t < num_threads; t++) {
+        sort->tasks[t].sort = sort;
+        sort->tasks[t].thread = t;
+        _g_array_sort_parallel_share(sort, t, &sort->run_start[t], &sort->run_start[t + 1]);
+    }
+
+    _g_hash_table_run_threads(_g_array_sort_parallel_runs, sort->tasks, sizeof(struct _GArraySortParallelTask), num_threads);
+
+    while (sort->num_runs > 1) {
+        _g_hash_table_run_threads(_g_array_sort_parallel_merge, sort->tasks, sizeof(struct _GArraySortParallelTask), num_threads);
+
+        uint32_t num_runs = 0;
+        for (uint32_t r = 0; r < sort->num_runs; r += 2) {
+            sort->run_start[num_runs++] = sort->run_start[r];
+        }
+        sort->run_start[num_runs] = n;
+        sort->num_runs = num_runs;
+
+        char *swap = sort->src;
+        sort->src = sort->dst;
+        sort->dst = swap;
+    }
+
+    if (sort->src != array->data) {
+        sort->dst = array->data;
+        _g_hash_table_run_threads(_g_array_sort_parallel_copy, sort->tasks, sizeof(struct _GArraySortParallelTask), num_threads);
+    }
+
+    if (buffer != scratch) {
+        free(buffer);
+    }
+    free(sort->run_start);
+    free(sort->tasks);
+}
+
+// Sorts on up to num_threads threads, each with at least
+// GARRAY_SORT_PARALLEL_MIN_ELEMENTS elements: every thread sorts a run of the
+// array, then the runs are merged pairwise with all threads sharing each
+// round. The merge is stable, so for a total order the result is the same as
+// g_array_sort's.
+void g_array_sort_parallel(GArray *array, GCompareFunc compare_func, uint32_t num_threads)
+{
+    struct _GArraySortParallel sort = {
+        .compare_func = compare_func,
+    };
+
+    _g_array_sort_parallel(array, &sort, num_threads, NULL);
+}
+
+// scratch is NULL, or room for len elements that the merge rounds use
+// instead of allocating their own.
+void g_array_sort_parallel_with_data(GArray *array, GCompareDataFunc compare_func, void *user_data, uint32_t num_threads, void *scratch)
+{
+    struct _GArraySortParallel sort = {
+        .compare_data_func = compare_func,
+        .user_data = user_data,
+    };
+
+    _g_array_sort_parallel(array, &sort, num_threads, scratch);
+}
+
+// Keys are mapped to unsigned integers that sort the same way
+uint64_t _g_array_radix_key(const char *element, GArrayKeyType key_type)
+{
+    uint32_t key32;
+    uint64_t key64;
+
+    switch (key_type) {
+        case G_ARRAY_KEY_UINT32:
+            memcpy(&key32, element, sizeof(key32));
+            return key32;
+        case G_ARRAY_KEY_INT32:
+            memcpy(&key32, element, sizeof(key32));
+            return key32 ^ UINT32_C(0x80000000);
+        case G_ARRAY_KEY_FLOAT:
+            memcpy(&key32, element, sizeof(key32));
+            return key32 & UINT32_C(0x80000000) ? (uint32_t) ~key32 : key32 | UINT32_C(0x80000000);
+        case G_ARRAY_KEY_UINT64:
+            memcpy(&key64, element, sizeof(key64));
+            return key64;
+        case G_ARRAY_KEY_INT64:
+            memcpy(&key64, element, sizeof(key64));
+            return key64 ^ UINT64_C(0x8000000000000000);
+        case G_ARRAY_KEY_DOUBLE:
+            memcpy(&key64, element, sizeof(key64));
+            return key64 & UINT64_C(0x8000000000000000) ? ~key64 : key64 | UINT64_C(0x8000000000000000);
+    }
+
+    return 0;
+}
+
+uint64_t _g_array_radix_unkey(uint64_t key, GArrayKeyType key_type)
+{
+    switch (key_type) {
+        case G_ARRAY_KEY_UINT32:
+        case G_ARRAY_KEY_UINT64:
+            return key;
+        case G_ARRAY_KEY_INT32:
+            return key ^ UINT32_C(0x80000000);
+        case G_ARRAY_KEY_INT64:
+            return key ^ UINT64_C(0x8000000000000000);
+        case G_ARRAY_KEY_FLOAT:
+            return key & UINT32_C(0x80000000) ? key & UINT32_C(0x7fffffff) : (uint32_t) ~key;
+        case G_ARRAY_KEY_DOUBLE:
+            return key & UINT64_C(0x8000000000000000) ? key & UINT64_C(0x7fffffffffffffff) : ~key;
+    }
+
+    return 0;
+}
+
+struct _g_array_radix_pair {
+    uint64_t key;
+    size_t index;
+};
+
+#define _G_ARRAY_RADIX_KEY(x) (x)
+#define _G_ARRAY_RADIX_PAIR_KEY(x) ((x).key)
+
+// One counting pass over all digits, then one scatter pass per byte of the
+// key, skipping bytes that are the same in every key.
+#define _G_ARRAY_RADIX_SORT_DEFINE(name, type, key_of) \
+    void _g_array_radix_sort_##name(type *data, type *buffer, size_t n, uint32_t key_bytes) \
+    { \
+        size_t (*counts)[256] = calloc(key_bytes, sizeof(*counts)); \
+        if (counts == NULL) { \
+            fprintf(stderr, "FATAL ERROR: _g_array_radix_sort_" #name ": Out of memory"); \
+            exit(1); \
+        } \
+        \
+        for (size_t i = 0; i < n; i++) { \
+            uint64_t key = key_of(data[i]); \
+            for (uint32_t b = 0; b < key_bytes; b++) { \
+                counts[b][(key >> (8 * b)) & 0xff]++; \
+            } \
+        } \
+        \
+        type *src = data; \
+        type *dst = buffer; \
+        \
+        for (uint32_t b = 0; b < key_bytes; b++) { \
+            uint32_t shift = 8 * b; \
+            if (counts[b][(key_of(data[0]) >> shift) & 0xff] == n) { \
+                continue; \
+            } \
+            \
+            size_t offset = 0; \
+            for (uint32_t d = 0; d < 256; d++) { \
+                size_t count = counts[b][d]; \
+                counts[b][d] = offset; \
+                offset += count; \
+            } \
+            \
+            for (size_t i = 0; i < n; i++) { \
+                dst[counts[b][(key_of(src[i]) >> shift) & 0xff]++] = src[i]; \
+            } \
+            \
+            type *swap = src; \
+            src = dst; \
+            dst = swap; \
+        } \
+        \
+        if (src != data) { \
+            memcpy(data, src, n * sizeof(type)); \
+        } \
+        \
+        free(counts); \
+    }
+
+_G_ARRAY_RADIX_SORT_DEFINE(32, uint32_t, _G_ARRAY_RADIX_KEY)
+_G_ARRAY_RADIX_SORT_DEFINE(64, uint64_t, _G_ARRAY_RADIX_KEY)
+_G_ARRAY_RADIX_SORT_DEFINE(pairs, struct _g_array_radix_pair, _G_ARRAY_RADIX_PAIR_KEY)
+
+void g_array_sort_by_key(GArray *array, GArrayKeyType key_type, size_t key_offset)
+{
+    size_t n = array->len;
+    size_t size = array->_element_size;
+    uint32_t key_bytes = key_type == G_ARRAY_KEY_UINT32 || key_type == G_ARRAY_KEY_INT32 || key_type == G_ARRAY_KEY_FLOAT ? 4 : 8;
+
+    if (n < 2) {
+        return;
+    }
+
+    if (key_offset + key_bytes > size) {
+        fprintf(stderr, "BUG: g_array_sort_by_key: Key is outside of the element.");
+        abort();
+    }
+
+    // arrays of bare keys are sorted in place
+    if (size == key_bytes) {
+        void *buffer = malloc(_g_array_checked_mul(n, size));
+        if (buffer == NULL) {
+            fprintf(stderr, "FATAL ERROR: g_array_sort_by_key: Out of memory");
+            exit(1);
+        }
+
+        if (key_bytes == 4) {
+            uint32_t *keys = (uint32_t*) (void*) array->data;
+            for (size_t i = 0; i < n; i++) {
+                keys[i] = (uint32_t) _g_array_radix_key((const char*) &keys[i], key_type);
+            }
+            _g_array_radix_sort_32(keys, buffer, n, 4);
+            for (size_t i = 0; i < n; i++) {
+                keys[i] = (uint32_t) _g_array_radix_unkey(keys[i], key_type);
+            }
+        } else {
+            uint64_t *keys = (uint64_t*) (void*) array->data;
+            for (size_t i = 0; i < n; i++) {
+                keys[i] = _g_array_radix_key((const char*) &keys[i], key_type);
+            }
+            _g_array_radix_sort_64(keys, buffer, n, 8);
+            for (size_t i = 0; i < n; i++) {
+                keys[i] = _g_array_radix_unkey(keys[i], key_type);
+            }
+        }
+
+        free(buffer);
+        return;
+    }
+
+    // records are sorted as (key, index) pairs and moved once at the end
+    struct _g_array_radix_pair *pairs = malloc(_g_array_checked_mul(n, 2 * sizeof(struct _g_array_radix_pair)));
+    char *data = malloc(_g_array_checked_mul(array->_allocated_elements, size));
+    if (pairs == NULL || data == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_array_sort_by_key: Out of memory");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        pairs[i].key = _g_array_radix_key(&array->data[i * size + key_offset], key_type);
+        pairs[i].index = i;
+    }
+
+    _g_array_radix_sort_pairs(pairs, &pairs[n], n, key_bytes);
+
+    for (size_t i = 0; i < n; i++) {
+        memcpy(&data[i * size], &array->data[pairs[i].index * size], size);
+    }
+
+    free(pairs);
+    // a mapped array keeps its mapping
+    if (array->_backing != _G_ARRAY_HEAP) {
+        memcpy(array->data, data, n * size);
+        free(data);
+    } else {
+        free(array->data);
+        array->data = data;
+    }
+
+    if (array->_zero_terminated) {
+        _g_array_zero_terminate(array);
+    }
+}
+
+static inline void _g_array_prefetch(const void *address)
+{
+#if (defined __GNUC__ || defined __clang__)
+    __builtin_prefetch(address);
+#else
+    (void) address;
+#endif
+}
+
+static inline uint32_t _g_array_ctz(size_t x)
+{
+#if (defined _MSC_VER && !defined __clang__)
+    unsigned long index;
+    _BitScanForward64(&index, (unsigned __int64) x);
+    return (uint32_t) index;
+#else
+    return (uint32_t) __builtin_ctzll((unsigned long long) x);
+#endif
+}
+
+// Halves the range with a conditional move instead of a branch, and
+// prefetches both midpoints the next step might look at.
+size_t _g_array_bound(GArray *array, const void *target, GCompareFunc compare_func, bool upper)
+{
+    size_t size = array->_element_size;
+    const char *base = array->data;
+    size_t n = array->len;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    while (n > 1) {
+        size_t half = n / 2;
+        int cmp = compare_func(&base[half * size], target);
+
+        _g_array_prefetch(&base[(n - half) / 2 * size]);
+        _g_array_prefetch(&base[(half + (n - half) / 2) * size]);
+        base = (upper ? cmp <= 0 : cmp < 0) ? &base[half * size] : base;
+        n -= half;
+    }
+
+    int cmp = compare_func(base, target);
+
+    return (size_t) (base - array->data) / size + (upper ? cmp <= 0 : cmp < 0);
+}
+
+// Returns the index of the first element that doesn't sort before target,
+// len if there is none. The array must be sorted by compare_func.
+size_t g_array_lower_bound(GArray *array, const void *target, GCompareFunc compare_func)
+{
+    return _g_array_bound(array, target, compare_func, false);
+}
+
+// Returns the index of the first element that sorts after target, len if
+// there is none.
+size_t g_array_upper_bound(GArray *array, const void *target, GCompareFunc compare_func)
+{
+    return _g_array_bound(array, target, compare_func, true);
+}
+
+// Elements equal to target are [*ret_start, *ret_end).
+void g_array_equal_range(GArray *array, const void *target, GCompareFunc compare_func, size_t *ret_start, size_t *ret_end)
+{
+    *ret_start = g_array_lower_bound(array, target, compare_func);
+    *ret_end = g_array_upper_bound(array, target, compare_func);
+}
+
+bool g_array_binary_search_index(GArray *array, const void *target, GCompareFunc compare_func, size_t *out_match_index)
 {
     if (array == NULL) {
         return false;
@@ -318,49 +1292,166 @@ bool g_array_binary_search(GArray *array, const void *target, GCompareFunc compa
         return false;
     }
 
-    if (array->len <= 0) {
+    // the lower bound is the left-most match, if there is one
+    size_t m = g_array_lower_bound(array, target, compare_func);
+
+    if (m == array->len || compare_func(&array->data[m * array->_element_size], target) != 0) {
         return false;
     }
 
-    int l = 0;
-    int r = array->len - 1;
-    unsigned int m = 0;
+    if (out_match_index) {
+        *out_match_index = m;
+    }
 
-    while (l <= r) {
-        m = (r - l) / 2 + l; // (l + r) / 2 but prevent overflow
+    return true;
+}
 
-        if (compare_func(&array->data[m * array->_element_size], target) < 0) {
-            l = m + 1;
-        } else if (compare_func(&array->data[m * array->_element_size], target) > 0) {
-            r = m - 1;
-        } else {
-            // ensure we always return the left-most element
-            while (m > 0) {
-                if (compare_func(&array->data[m * array->_element_size], &array->data[(m - 1) * array->_element_size]) != 0) {
-                    break;
-                }
-                m--;
+// Kept for callers of the unsigned int API: a match that doesn't fit in
+// out_match_index is reported as not found.
+bool g_array_binary_search(GArray *array, const void *target, GCompareFunc compare_func, unsigned int *out_match_index)
+{
+    size_t match_index;
+
+    if (!g_array_binary_search_index(array, target, compare_func, &match_index) || match_index > UINT_MAX) {
+        return false;
+    }
+
+    if (out_match_index) {
+        *out_match_index = (unsigned int) match_index;
+    }
+
+    return true;
+}
+
+// Runs GARRAY_SEARCH_BATCH searches in lockstep: they all halve a range of
+// the same length, so every step issues the prefetches of the whole batch
+// before any of them is needed.
+void g_array_search_many(GArray *array, const void *targets, size_t num_targets, GCompareFunc compare_func, size_t *ret_indices)
+{
+    size_t size = array->_element_size;
+    const char *base[GARRAY_SEARCH_BATCH];
+
+    for (size_t start = 0; start < num_targets; start += GARRAY_SEARCH_BATCH) {
+        size_t batch = num_targets - start < GARRAY_SEARCH_BATCH ? num_targets - start : GARRAY_SEARCH_BATCH;
+        const char *batch_targets = &((const char*) targets)[start * size];
+        size_t n = array->len;
+
+        if (n == 0) {
+            for (size_t b = 0; b < batch; b++) {
+                ret_indices[start + b] = 0;
             }
+            continue;
+        }
 
-            if (out_match_index) {
-                *out_match_index = m;
+        for (size_t b = 0; b < batch; b++) {
+            base[b] = array->data;
+        }
+
+        while (n > 1) {
+            size_t half = n / 2;
+            n -= half;
+
+            for (size_t b = 0; b < batch; b++) {
+                base[b] = compare_func(&base[b][half * size], &batch_targets[b * size]) < 0 ? &base[b][half * size] : base[b];
+                _g_array_prefetch(&base[b][n / 2 * size]);
             }
+        }
+
+        for (size_t b = 0; b < batch; b++) {
+            ret_indices[start + b] = (size_t) (base[b] - array->data) / size + (compare_func(base[b], &batch_targets[b * size]) < 0);
+        }
+    }
+}
+
+// Fills the tree in order, so node k holds the element whose rank is its
+// in-order position.
+size_t _g_array_eytzinger_fill(GArrayEytzinger *index, GArray *array, size_t rank, size_t k)
+{
+    if (k <= index->len) {
+        rank = _g_array_eytzinger_fill(index, array, rank, 2 * k);
+        memcpy(&index->data[k * index->element_size], &array->data[rank * index->element_size], index->element_size);
+        index->ranks[k] = rank++;
+        rank = _g_array_eytzinger_fill(index, array, rank, 2 * k + 1);
+    }
+
+    return rank;
+}
+
+// Copies a sorted array into breadth-first order, where the nodes of the
+// first levels of every search share a few cache lines and the nodes four
+// levels down sit next to each other, so they can be prefetched ahead.
+// The index doesn't follow later changes to the array.
+GArrayEytzinger* g_array_eytzinger_new(GArray *array)
+{
+    GArrayEytzinger *index = malloc(sizeof(GArrayEytzinger));
+    if (index == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_array_eytzinger_new: Out of memory");
+        exit(1);
+    }
+
+    // node 0 is unused, the root is node 1 and the children of node k are
+    // 2k and 2k + 1
+    index->len = array->len;
+    index->element_size = array->_element_size;
+    size_t data_size = _g_array_checked_mul(_g_array_checked_add(array->len, 1), array->_element_size);
+    index->_allocation = malloc(_g_array_checked_add(data_size, GARRAY_EYTZINGER_ALIGNMENT - 1));
+    index->ranks = malloc(_g_array_checked_mul(_g_array_checked_add(array->len, 1), sizeof(size_t)));
+    if (index->_allocation == NULL || index->ranks == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_array_eytzinger_new: Out of memory");
+        exit(1);
+    }
+
+    // so the GARRAY_EYTZINGER_PREFETCH_DISTANCE nodes of a prefetch start a
+    // cache line whenever they fill whole lines
+    uintptr_t address = (uintptr_t) index->_allocation;
+    index->data = &index->_allocation[(GARRAY_EYTZINGER_ALIGNMENT - address % GARRAY_EYTZINGER_ALIGNMENT) % GARRAY_EYTZINGER_ALIGNMENT];
+
+    _g_array_eytzinger_fill(index, array, 0, 1);
 
-            return true;
+    return index;
+}
+
+// Same result as g_array_lower_bound on the array the index was built from.
+size_t g_array_eytzinger_lower_bound(GArrayEytzinger *index, const void *target, GCompareFunc compare_func)
+{
+    size_t size = index->element_size;
+    size_t k = 1;
+
+    while (k <= index->len) {
+        if (GARRAY_EYTZINGER_PREFETCH_DISTANCE * k <= index->len) {
+            _g_array_prefetch(&index->data[GARRAY_EYTZINGER_PREFETCH_DISTANCE * k * size]);
         }
+        // the siblings span two lines for 8 byte elements
+        if (GARRAY_EYTZINGER_PREFETCH_DISTANCE * (k + 1) <= index->len + 1) {
+            _g_array_prefetch(&index->data[GARRAY_EYTZINGER_PREFETCH_DISTANCE * (k + 1) * size - 1]);
+        }
+        k = 2 * k + (compare_func(&index->data[k * size], target) < 0);
     }
 
-    return false;
+    // the lower bound is where the search last went left
+    k >>= _g_array_ctz(~k) + 1;
+
+    return k ? index->ranks[k] : index->len;
 }
 
-GArray* g_array_set_size(GArray *array, unsigned int length)
+void g_array_eytzinger_free(GArrayEytzinger *index)
+{
+    if (index == NULL) {
+        return;
+    }
+
+    free(index->ranks);
+    free(index->_allocation);
+    free(index);
+}
+
+GArray* g_array_set_size(GArray *array, size_t length)
 {
     if (length <= array->len) {
-        if (array->_clear_func && array->len > length) {
+        if (array->_clear_func) {
             // call clear func on all elements that are going to be removed
-            int start_index = (array->len - length) - 1;
-            for (int i = start_index; i < array->len; i++) {
-                array->_clear_func(&array->data[i]);
+            for (size_t i = length; i < array->len; i++) {
+                array->_clear_func(&array->data[i * array->_element_size]);
             }
         }
 
@@ -374,6 +1465,7 @@ GArray* g_array_set_size(GArray *array, unsigned int length)
     }
 
     _g_array_resize_if_needed(array, length - array->len);
+    _g_array_clear_range(array, array->len, length);
     array->len = length;
     if (array->_zero_terminated) {
         _g_array_zero_terminate(array);
@@ -387,6 +1479,31 @@ void g_array_set_clear_func(GArray *array, GDestroyNotify clear_func)
     array->_clear_func = clear_func;
 }
 
+// Makes room for length elements, so the array can grow to that length
+// without reallocating.
+GArray* g_array_reserve(GArray *array, size_t length)
+{
+    size_t needed = _g_array_checked_add(length, array->_zero_terminated);
+
+    if (needed > array->_allocated_elements) {
+        _g_array_reallocate(array, needed);
+    }
+
+    return array;
+}
+
+// Gives back the room reserved or left over by growing the array.
+GArray* g_array_shrink_to_fit(GArray *array)
+{
+    size_t needed = array->len + array->_zero_terminated;
+
+    if (needed < array->_allocated_elements) {
+        _g_array_reallocate(array, needed);
+    }
+
+    return array;
+}
+
 char* g_array_free(GArray *array, bool free_segment)
 {
     char *data;
@@ -396,18 +1513,25 @@ char* g_array_free(GArray *array, bool free_segment)
     }
 
     if (free_segment == false) {
+        if (array->_backing != _G_ARRAY_HEAP) {
+            _g_array_move_to_heap(array);
+        }
         data = array->data;
         free(array);
         return data;
     }
 
     if (array->_clear_func != NULL) {
-        for (int i = 0; i < array->len; i++) {
-            array->_clear_func(&array->data[i]);
+        for (size_t i = 0; i < array->len; i++) {
+            array->_clear_func(&array->data[i * array->_element_size]);
         }
     }
 
-    free(array->data);
+    if (array->_backing != _G_ARRAY_HEAP) {
+        _g_array_unmap(array);
+    } else {
+        free(array->data);
+    }
     free(array);
 
     return NULL;
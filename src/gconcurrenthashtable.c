@@ -0,0 +1,589 @@
+#include <miniglib/gconcurrenthashtable.h>
+#include "ghashtableprivate.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Epoch based reclamation shared by all concurrent tables. Every thread that
+// reads a table publishes the global epoch it entered in; memory retired in
+// epoch e is freed once the global epoch reaches e + 2, which can only happen
+// after every reader that might still see it has left.
+
+struct _GEpochRecord {
+    _Atomic uint64_t epoch; // 0 while the thread is not pinned
+    atomic_bool in_use;
+    struct _GEpochRecord *next;
+};
+
+static _Atomic uint64_t _g_epoch_global = 1;
+static _Atomic(struct _GEpochRecord*) _g_epoch_records = NULL;
+static once_flag _g_epoch_once = ONCE_FLAG_INIT;
+static tss_t _g_epoch_key;
+static _Thread_local struct _GEpochRecord *_g_epoch_record = NULL;
+static _Thread_local uint32_t _g_epoch_depth = 0;
+
+void _g_epoch_release_record(void *data)
+{
+    struct _GEpochRecord *record = data;
+
+    atomic_store_explicit(&record->epoch, 0, memory_order_release);
+    atomic_store_explicit(&record->in_use, false, memory_order_release);
+}
+
+void _g_epoch_init(void)
+{
+    if (tss_create(&_g_epoch_key, _g_epoch_release_record) != thrd_success) {
+        fprintf(stderr, "FATAL ERROR: _g_epoch_init: Failed to create thread-specific storage");
+        exit(1);
+    }
+}
+
+struct _GEpochRecord *_g_epoch_get_record(void)
+{
+    if (_g_epoch_record) {
+        return _g_epoch_record;
+    }
+
+    call_once(&_g_epoch_once, _g_epoch_init);
+
+    // reuse the record of a thread that has exited
+    struct _GEpochRecord *record = atomic_load_explicit(&_g_epoch_records, memory_order_acquire);
+    for (; record; record = record->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&record->in_use, &expected, true)) {
+            break;
+        }
+    }
+
+    if (record == NULL) {
+        record = malloc(sizeof(struct _GEpochRecord));
+        if (record == NULL) {
+            fprintf(stderr, "FATAL ERROR: _g_epoch_get_record: Out of memory");
+            exit(1);
+        }
+
+        atomic_init(&record->epoch, 0);
+        atomic_init(&record->in_use, true);
+        record->next = atomic_load_explicit(&_g_epoch_records, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&_g_epoch_records, &record->next, record)) {
+        }
+    }
+
+    tss_set(_g_epoch_key, record);
+    _g_epoch_record = record;
+
+    return record;
+}
+
+void g_concurrent_hash_table_pin(void)
+{
+    if (_g_epoch_depth++ > 0) {
+        return;
+    }
+
+    struct _GEpochRecord *record = _g_epoch_get_record();
+    atomic_store(&record->epoch, atomic_load(&_g_epoch_global));
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void g_concurrent_hash_table_unpin(void)
+{
+    if (--_g_epoch_depth > 0) {
+        return;
+    }
+
+    atomic_store_explicit(&_g_epoch_record->epoch, 0, memory_order_release);
+}
+
+// Advances the global epoch if every pinned thread has caught up with it.
+uint64_t _g_epoch_try_advance(void)
+{
+    uint64_t epoch = atomic_load(&_g_epoch_global);
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    struct _GEpochRecord *record = atomic_load_explicit(&_g_epoch_records, memory_order_acquire);
+    for (; record; record = record->next) {
+        uint64_t local = atomic_load(&record->epoch);
+        if (local != 0 && local != epoch) {
+            return epoch;
+        }
+    }
+
+    atomic_compare_exchange_strong(&_g_epoch_global, &epoch, epoch + 1);
+
+    return atomic_load(&_g_epoch_global);
+}
+
+// Waits until every thread that was pinned when it was called has unpinned.
+// Must not be called while pinned.
+void _g_epoch_synchronize(void)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint64_t target = atomic_load(&_g_epoch_global) + 2;
+
+    while (_g_epoch_try_advance() < target) {
+        thrd_yield();
+    }
+}
+
+void _g_concurrent_hash_table_free_array(void *data)
+{
+    struct GConcurrentHashTableArray *array = data;
+
+    free(array->ctrl);
+    free(array->slots);
+    free(array);
+}
+
+// Must be called with the segment locked, after the data has been unlinked.
+void _g_concurrent_hash_table_retire(struct GConcurrentHashTableSegment *segment, void *data, GDestroyNotify destroy_func)
+{
+    struct GConcurrentHashTableRetired retired;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    retired.data = data;
+    retired.destroy_func = destroy_func;
+    retired.epoch = atomic_load(&_g_epoch_global);
+
+    g_array_append_vals(segment->retired, &retired, 1);
+}
+
+void _g_concurrent_hash_table_reclaim(struct GConcurrentHashTableSegment *segment)
+{
+    if (segment->retired->len < GCONCURRENTHASHTABLE_RECLAIM_BATCH) {
+        return;
+    }
+
+    uint64_t epoch = _g_epoch_try_advance();
+    struct GConcurrentHashTableRetired *retired = (struct GConcurrentHashTableRetired*) segment->retired->data;
+
+    // entries are retired in epoch order, so the reclaimable ones form a prefix
+    size_t count = 0;
+    while (count < segment->retired->len && retired[count].epoch + 2 <= epoch) {
+        retired[count].destroy_func(retired[count].data);
+        count++;
+    }
+
+    if (count > 0) {
+        g_array_remove_range(segment->retired, 0, count);
+    }
+}
+
+uint8_t _g_concurrent_hash_table_get_ctrl(struct GConcurrentHashTableArray *array, uint32_t slot)
+{
+    uint64_t word = atomic_load_explicit(&array->ctrl[slot / 8], memory_order_relaxed);
+    return (uint8_t) (word >> (slot % 8 * 8));
+}
+
+// Only called by writers holding the segment lock. The release store
+// publishes the slot contents written before it.
+void _g_concurrent_hash_table_set_ctrl(struct GConcurrentHashTableArray *array, uint32_t slot, uint8_t ctrl)
+{
+    uint64_t word = atomic_load_explicit(&array->ctrl[slot / 8], memory_order_relaxed);
+    word &= ~((uint64_t) 0xFF << (slot % 8 * 8));
+    word |= (uint64_t) ctrl << (slot % 8 * 8);
+    atomic_store_explicit(&array->ctrl[slot / 8], word, memory_order_release);
+}
+
+void _g_concurrent_hash_table_load_group(struct GConcurrentHashTableArray *array, uint32_t group, uint8_t *ret_ctrl)
+{
+    for (uint32_t w = 0; w < GHASHTABLE_GROUP_WIDTH / 8; w++) {
+        uint64_t word = atomic_load_explicit(&array->ctrl[group * (GHASHTABLE_GROUP_WIDTH / 8) + w], memory_order_acquire);
+        for (uint32_t i = 0; i < 8; i++) {
+            ret_ctrl[w * 8 + i] = (uint8_t) (word >> (i * 8));
+        }
+    }
+}
+
+struct GConcurrentHashTableArray *_g_concurrent_hash_table_alloc_array(uint32_t num_slots)
+{
+    struct GConcurrentHashTableArray *array = malloc(sizeof(struct GConcurrentHashTableArray));
+    if (array == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_concurrent_hash_table_alloc_array: Out of memory");
+        exit(1);
+    }
+
+    array->num_slots = num_slots;
+    array->num_used = 0;
+    array->num_deleted = 0;
+    array->resize_threshold = (uint32_t) (num_slots * GHASHTABLE_MAX_LOAD);
+    array->ctrl = malloc(num_slots / 8 * sizeof(_Atomic uint64_t));
+    array->slots = malloc(num_slots * sizeof(struct GConcurrentHashTableSlot));
+    if (array->ctrl == NULL || array->slots == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_concurrent_hash_table_alloc_array: Out of memory");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < num_slots / 8; i++) {
+        atomic_init(&array->ctrl[i], 0x8080808080808080ull);
+    }
+
+    return array;
+}
+
+GConcurrentHashTable *g_concurrent_hash_table_new(GHashFunc hash_func, GEqualFunc key_equal_func)
+{
+    if (hash_func == NULL) {
+        return NULL;
+    }
+
+    if (key_equal_func == NULL) {
+        return NULL;
+    }
+
+    GConcurrentHashTable *hash_table = malloc(sizeof(GConcurrentHashTable));
+    if (hash_table == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_concurrent_hash_table_new: Out of memory");
+        exit(1);
+    }
+
+    hash_table->seed = (uint32_t) _g_hash_mix(_g_hash_seed(), (uint64_t) (uintptr_t) hash_table);
+    hash_table->hash_func = hash_func;
+    hash_table->key_equal_func = key_equal_func;
+    hash_table->key_destroy_func = NULL;
+    hash_table->value_destroy_func = NULL;
+
+    for (uint32_t i = 0; i < GCONCURRENTHASHTABLE_NUM_SEGMENTS; i++) {
+        struct GConcurrentHashTableSegment *segment = &hash_table->segments[i];
+
+        if (mtx_init(&segment->lock, mtx_plain) != thrd_success) {
+            fprintf(stderr, "FATAL ERROR: g_concurrent_hash_table_new: Failed to create mutex");
+            exit(1);
+        }
+
+        atomic_init(&segment->seq, 0);
+        atomic_init(&segment->array, _g_concurrent_hash_table_alloc_array(GCONCURRENTHASHTABLE_SEGMENT_MIN_SLOTS));
+        atomic_init(&segment->size, 0);
+        segment->retired = g_array_new(false, false, sizeof(struct GConcurrentHashTableRetired));
+    }
+
+    return hash_table;
+}
+
+GConcurrentHashTable *g_concurrent_hash_table_new_full(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func)
+{
+    GConcurrentHashTable *hash_table = g_concurrent_hash_table_new(hash_func, key_equal_func);
+
+    if (hash_table == NULL) {
+        return NULL;
+    }
+
+    hash_table->key_destroy_func = key_destroy_func;
+    hash_table->value_destroy_func = value_destroy_func;
+
+    return hash_table;
+}
+
+uint32_t _g_concurrent_hash_table_hash(GConcurrentHashTable *hash_table, void *key)
+{
+    return _g_hash_fmix32(hash_table->hash_func(key) ^ hash_table->seed);
+}
+
+// The top bits pick the segment; the low bits are used for the tag and group
+// inside it.
+struct GConcurrentHashTableSegment *_g_concurrent_hash_table_segment(GConcurrentHashTable *hash_table, uint32_t hash)
+{
+    return &hash_table->segments[hash / (UINT32_MAX / GCONCURRENTHASHTABLE_NUM_SEGMENTS + 1)];
+}
+
+// Safe to call without the lock: slots are read atomically and every match
+// is checked against the cached hash before key_equal_func sees it.
+bool _g_concurrent_hash_table_find(GConcurrentHashTable *hash_table, struct GConcurrentHashTableArray *array, void *key, uint32_t hash, uint32_t *ret_slot)
+{
+    uint32_t num_groups = array->num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint32_t group = _g_hash_table_hash_group(array->num_slots, hash);
+    uint8_t tag = _g_hash_table_hash_tag(hash);
+    uint8_t ctrl[GHASHTABLE_GROUP_WIDTH];
+
+    for (uint32_t step = 1; step <= num_groups; step++) {
+        _g_concurrent_hash_table_load_group(array, group, ctrl);
+
+        for (uint32_t match = _g_hash_table_group_match(ctrl, tag); match; match &= match - 1) {
+            uint32_t slot = group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(match);
+            if (atomic_load_explicit(&array->slots[slot].hash, memory_order_relaxed) == hash
+                    && hash_table->key_equal_func(key, atomic_load_explicit(&array->slots[slot].key, memory_order_relaxed))) {
+                *ret_slot = slot;
+                return true;
+            }
+        }
+
+        if (_g_hash_table_group_match_empty(ctrl)) {
+            break;
+        }
+
+        group = (group + step) & (num_groups - 1);
+    }
+
+    return false;
+}
+
+uint32_t _g_concurrent_hash_table_find_free_slot(struct GConcurrentHashTableArray *array, uint32_t hash)
+{
+    uint32_t num_groups = array->num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint32_t group = _g_hash_table_hash_group(array->num_slots, hash);
+    uint8_t ctrl[GHASHTABLE_GROUP_WIDTH];
+
+    for (uint32_t step = 1; step <= num_groups; step++) {
+        _g_concurrent_hash_table_load_group(array, group, ctrl);
+
+        uint32_t free = _g_hash_table_group_match_free(ctrl);
+        if (free) {
+            return group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(free);
+        }
+
+        group = (group + step) & (num_groups - 1);
+    }
+
+    // this should never happen
+    fprintf(stderr, "BUG: _g_concurrent_hash_table_find_free_slot: Failed to find an empty slot.");
+    abort();
+
+    return 0;
+}
+
+void _g_concurrent_hash_table_fill_slot(struct GConcurrentHashTableArray *array, uint32_t slot, void *key, void *value, uint32_t hash)
+{
+    atomic_store_explicit(&array->slots[slot].key, key, memory_order_relaxed);
+    atomic_store_explicit(&array->slots[slot].value, value, memory_order_relaxed);
+    atomic_store_explicit(&array->slots[slot].hash, hash, memory_order_relaxed);
+
+    if (_g_concurrent_hash_table_get_ctrl(array, slot) == GHASHTABLE_CTRL_DELETED) {
+        array->num_deleted--;
+    }
+    _g_concurrent_hash_table_set_ctrl(array, slot, _g_hash_table_hash_tag(hash));
+    array->num_used++;
+}
+
+// Copies the segment into a fresh array and publishes it. Readers still
+// probing the old array see a consistent snapshot until it is reclaimed.
+struct GConcurrentHashTableArray *_g_concurrent_hash_table_resize(struct GConcurrentHashTableSegment *segment, struct GConcurrentHashTableArray *old_array)
+{
+    uint32_t num_slots = old_array->num_slots;
+
+    // grow unless tombstones make up most of the load
+    if (old_array->num_used > old_array->resize_threshold / 2) {
+        num_slots *= 2;
+    }
+
+    struct GConcurrentHashTableArray *array = _g_concurrent_hash_table_alloc_array(num_slots);
+
+    for (uint32_t i = 0; i < old_array->num_slots; i++) {
+        if (!_g_hash_table_ctrl_is_full(_g_concurrent_hash_table_get_ctrl(old_array, i))) {
+            continue;
+        }
+
+        struct GConcurrentHashTableSlot *old_slot = &old_array->slots[i];
+        uint32_t hash = atomic_load_explicit(&old_slot->hash, memory_order_relaxed);
+        _g_concurrent_hash_table_fill_slot(array, _g_concurrent_hash_table_find_free_slot(array, hash),
+                atomic_load_explicit(&old_slot->key, memory_order_relaxed),
+                atomic_load_explicit(&old_slot->value, memory_order_relaxed), hash);
+    }
+
+    atomic_store_explicit(&segment->array, array, memory_order_release);
+    _g_concurrent_hash_table_retire(segment, old_array, _g_concurrent_hash_table_free_array);
+
+    return array;
+}
+
+void g_concurrent_hash_table_insert(GConcurrentHashTable *hash_table, void *key, void *value)
+{
+    uint32_t hash = _g_concurrent_hash_table_hash(hash_table, key);
+    struct GConcurrentHashTableSegment *segment = _g_concurrent_hash_table_segment(hash_table, hash);
+    uint32_t slot = 0;
+
+    mtx_lock(&segment->lock);
+
+    struct GConcurrentHashTableArray *array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+
+    if (_g_concurrent_hash_table_find(hash_table, array, key, hash, &slot)) {
+        // key already exists in the hash table, keep the stored key. Readers
+        // see either the old or the new value, so no sequence bump is needed.
+        void *stored_key = atomic_load_explicit(&array->slots[slot].key, memory_order_relaxed);
+        void *old_value = atomic_load_explicit(&array->slots[slot].value, memory_order_relaxed);
+
+        atomic_store_explicit(&array->slots[slot].value, value, memory_order_release);
+
+        // the passed key was never visible to readers
+        if (hash_table->key_destroy_func && key != stored_key) {
+            hash_table->key_destroy_func(key);
+        }
+
+        if (hash_table->value_destroy_func && value != old_value) {
+            _g_concurrent_hash_table_retire(segment, old_value, hash_table->value_destroy_func);
+        }
+    } else {
+        if (array->num_used + array->num_deleted >= array->resize_threshold) {
+            array = _g_concurrent_hash_table_resize(segment, array);
+        }
+
+        // the slot is free, so no reader is looking at its contents
+        _g_concurrent_hash_table_fill_slot(array, _g_concurrent_hash_table_find_free_slot(array, hash), key, value, hash);
+        atomic_fetch_add_explicit(&segment->size, 1, memory_order_relaxed);
+    }
+
+    _g_concurrent_hash_table_reclaim(segment);
+
+    mtx_unlock(&segment->lock);
+}
+
+uint32_t g_concurrent_hash_table_size(GConcurrentHashTable *hash_table)
+{
+    uint32_t size = 0;
+
+    for (uint32_t i = 0; i < GCONCURRENTHASHTABLE_NUM_SEGMENTS; i++) {
+        size += atomic_load_explicit(&hash_table->segments[i].size, memory_order_relaxed);
+    }
+
+    return size;
+}
+
+void* g_concurrent_hash_table_lookup(GConcurrentHashTable *hash_table, void *key)
+{
+    uint32_t hash = _g_concurrent_hash_table_hash(hash_table, key);
+    struct GConcurrentHashTableSegment *segment = _g_concurrent_hash_table_segment(hash_table, hash);
+    void *value;
+
+    g_concurrent_hash_table_pin();
+
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&segment->seq, memory_order_acquire);
+        if (seq & 1) {
+            thrd_yield();
+            continue;
+        }
+
+        struct GConcurrentHashTableArray *array = atomic_load_explicit(&segment->array, memory_order_acquire);
+        uint32_t slot = 0;
+
+        value = NULL;
+        if (_g_concurrent_hash_table_find(hash_table, array, key, hash, &slot)) {
+            value = atomic_load_explicit(&array->slots[slot].value, memory_order_acquire);
+        }
+
+        // a removal may have reused the slot while we were reading it
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&segment->seq, memory_order_relaxed) == seq) {
+            break;
+        }
+    }
+
+    g_concurrent_hash_table_unpin();
+
+    return value;
+}
+
+bool g_concurrent_hash_table_remove(GConcurrentHashTable *hash_table, void *key)
+{
+    uint32_t hash = _g_concurrent_hash_table_hash(hash_table, key);
+    struct GConcurrentHashTableSegment *segment = _g_concurrent_hash_table_segment(hash_table, hash);
+    uint32_t slot = 0;
+
+    mtx_lock(&segment->lock);
+
+    struct GConcurrentHashTableArray *array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+
+    if (!_g_concurrent_hash_table_find(hash_table, array, key, hash, &slot)) {
+        mtx_unlock(&segment->lock);
+        return false;
+    }
+
+    void *stored_key = atomic_load_explicit(&array->slots[slot].key, memory_order_relaxed);
+    void *stored_value = atomic_load_explicit(&array->slots[slot].value, memory_order_relaxed);
+
+    // seqlock write side: readers that overlap this retry
+    uint32_t seq = atomic_load_explicit(&segment->seq, memory_order_relaxed);
+    atomic_store_explicit(&segment->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    uint8_t group[GHASHTABLE_GROUP_WIDTH];
+    _g_concurrent_hash_table_load_group(array, slot / GHASHTABLE_GROUP_WIDTH, group);
+    if (_g_hash_table_group_match_empty(group)) {
+        _g_concurrent_hash_table_set_ctrl(array, slot, GHASHTABLE_CTRL_EMPTY);
+    } else {
+        _g_concurrent_hash_table_set_ctrl(array, slot, GHASHTABLE_CTRL_DELETED);
+        array->num_deleted++;
+    }
+    array->num_used--;
+
+    atomic_store_explicit(&segment->seq, seq + 2, memory_order_release);
+    atomic_fetch_sub_explicit(&segment->size, 1, memory_order_relaxed);
+
+    if (hash_table->key_destroy_func) {
+        _g_concurrent_hash_table_retire(segment, stored_key, hash_table->key_destroy_func);
+    }
+
+    if (hash_table->value_destroy_func) {
+        _g_concurrent_hash_table_retire(segment, stored_value, hash_table->value_destroy_func);
+    }
+
+    _g_concurrent_hash_table_reclaim(segment);
+
+    mtx_unlock(&segment->lock);
+
+    return true;
+}
+
+// Visits one segment at a time with its lock held, so func must not modify
+// the table.
+void g_concurrent_hash_table_foreach(GConcurrentHashTable *hash_table, GHFunc func, void *user_data)
+{
+    for (uint32_t i = 0; i < GCONCURRENTHASHTABLE_NUM_SEGMENTS; i++) {
+        struct GConcurrentHashTableSegment *segment = &hash_table->segments[i];
+
+        mtx_lock(&segment->lock);
+
+        struct GConcurrentHashTableArray *array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+        for (uint32_t slot = 0; slot < array->num_slots; slot++) {
+            if (_g_hash_table_ctrl_is_full(_g_concurrent_hash_table_get_ctrl(array, slot))) {
+                func(atomic_load_explicit(&array->slots[slot].key, memory_order_relaxed),
+                        atomic_load_explicit(&array->slots[slot].value, memory_order_relaxed), user_data);
+            }
+        }
+
+        mtx_unlock(&segment->lock);
+    }
+}
+
+void g_concurrent_hash_table_destroy(GConcurrentHashTable *hash_table)
+{
+    if (hash_table == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < GCONCURRENTHASHTABLE_NUM_SEGMENTS; i++) {
+        struct GConcurrentHashTableSegment *segment = &hash_table->segments[i];
+        struct GConcurrentHashTableArray *array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+
+        for (uint32_t slot = 0; slot < array->num_slots; slot++) {
+            if (!_g_hash_table_ctrl_is_full(_g_concurrent_hash_table_get_ctrl(array, slot))) {
+                continue;
+            }
+
+            if (hash_table->key_destroy_func) {
+                hash_table->key_destroy_func(atomic_load_explicit(&array->slots[slot].key, memory_order_relaxed));
+            }
+
+            if (hash_table->value_destroy_func) {
+                hash_table->value_destroy_func(atomic_load_explicit(&array->slots[slot].value, memory_order_relaxed));
+            }
+        }
+        _g_concurrent_hash_table_free_array(array);
+
+        // no thread may use the table anymore, so everything retired can go
+        struct GConcurrentHashTableRetired *retired = (struct GConcurrentHashTableRetired*) segment->retired->data;
+        for (unsigned int j = 0; j < segment->retired->len; j++) {
+            retired[j].destroy_func(retired[j].data);
+        }
+        g_array_free(segment->retired, true);
+
+        mtx_destroy(&segment->lock);
+    }
+
+    free(hash_table);
+}
@@ -1,9 +1,21 @@
 #include <miniglib/ghashtable.h>
+#include "ghashtableprivate.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
+
+// Counts events of the hot paths into hash_table->counters, see
+// GHashTableCounters.
+#ifdef GHASHTABLE_COUNTERS
+#define _G_HASH_TABLE_COUNT(hash_table, counter) ((hash_table)->counters.counter++)
+#else
+#define _G_HASH_TABLE_COUNT(hash_table, counter) ((void) (hash_table))
+#endif
 
 uint32_t g_int_hash(void *v)
 {
@@ -21,18 +33,142 @@ bool g_int_equal(void *v1, void *v2)
     return (uint32_t*) v1 == (uint32_t*) v2;
 }
 
-uint32_t g_str_hash(void *v)
+// 64x64 -> 128 bit multiply, returning the low half in *a and the high half in *b
+void _g_hash_mum(uint64_t *a, uint64_t *b)
+{
+#if (defined __SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#elif (defined _MSC_VER && defined _M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+uint64_t _g_hash_mix(uint64_t a, uint64_t b)
+{
+    _g_hash_mum(&a, &b);
+    return a ^ b;
+}
+
+uint64_t _g_hash_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t _g_hash_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// wyhash (final version 4, public domain): reads 8 bytes at a time and folds
+// them with 64x64 -> 128 bit multiplies.
+uint64_t _g_hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+    static const uint64_t secret[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+    };
+    const uint8_t *p = (const uint8_t*) data;
+    uint64_t a, b;
+
+    seed ^= _g_hash_mix(seed ^ secret[0], secret[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (_g_hash_read32(p) << 32) | _g_hash_read32(p + ((len >> 3) << 2));
+            b = (_g_hash_read32(p + len - 4) << 32) | _g_hash_read32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = _g_hash_mix(_g_hash_read64(p) ^ secret[1], _g_hash_read64(p + 8) ^ seed);
+                see1 = _g_hash_mix(_g_hash_read64(p + 16) ^ secret[2], _g_hash_read64(p + 24) ^ see1);
+                see2 = _g_hash_mix(_g_hash_read64(p + 32) ^ secret[3], _g_hash_read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = _g_hash_mix(_g_hash_read64(p) ^ secret[1], _g_hash_read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        a = _g_hash_read64(p + i - 16);
+        b = _g_hash_read64(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    _g_hash_mum(&a, &b);
+
+    return _g_hash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+// The per-process seed makes string hashes unpredictable from outside, so
+// colliding keys can't be precomputed to flood a table.
+uint64_t _g_hash_seed(void)
 {
-    // djb2 hash function
-    uint32_t hash = 5381;
-    int c;
-    unsigned char *str = (unsigned char*) v;
+    static _Atomic uint64_t seed = 0;
+
+    uint64_t value = atomic_load_explicit(&seed, memory_order_acquire);
+    if (value != 0) {
+        return value;
+    }
+
+    struct timespec ts = {0};
+    timespec_get(&ts, TIME_UTC);
+
+    uint64_t candidate = _g_hash_mix((uint64_t) (uintptr_t) &value ^ (uint64_t) ts.tv_nsec,
+            (uint64_t) (uintptr_t) &seed ^ (uint64_t) ts.tv_sec ^ (uint64_t) clock());
+    if (candidate == 0) {
+        candidate = 1;
+    }
 
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    // whichever thread initializes the seed first wins
+    if (!atomic_compare_exchange_strong(&seed, &value, candidate)) {
+        return value;
     }
 
-    return hash;
+    return candidate;
+}
+
+uint64_t g_hash_seed(void)
+{
+    return _g_hash_seed();
+}
+
+uint32_t g_str_hash(void *v)
+{
+    return g_str_hash_len(v, strlen((const char*) v));
+}
+
+uint32_t g_str_hash_len(const void *v, size_t len)
+{
+    uint64_t hash = _g_hash_bytes(v, len, _g_hash_seed());
+    return (uint32_t) (hash ^ (hash >> 32));
 }
 
 bool g_str_equal(void *v1, void *v2)
@@ -40,7 +176,178 @@ bool g_str_equal(void *v1, void *v2)
     return strcmp((char*) v1, (char*) v2) == 0;
 }
 
+// Finalizes the user hash (murmur3 fmix32) so that weak hash functions, like
+// identity hashes of aligned pointers, still spread over the tag bits and the
+// group index. Mixing in a per-table seed gives every table its own slot
+// order, so copying one table into another doesn't cluster.
+uint32_t _g_hash_table_hash(GHashTable *hash_table, void *key)
+{
+    return _g_hash_fmix32(hash_table->hash_func(key) ^ hash_table->seed);
+}
+
+// Ordered tables never hold more entries than slots, so the narrowest index
+// that can address every slot is enough.
+uint32_t _g_hash_table_index_width(uint32_t num_slots)
+{
+    if (num_slots <= UINT8_MAX + 1) {
+        return sizeof(uint8_t);
+    }
+
+    if (num_slots <= UINT16_MAX + 1) {
+        return sizeof(uint16_t);
+    }
+
+    return sizeof(uint32_t);
+}
+
+uint32_t _g_hash_table_get_index(GHashTable *hash_table, uint32_t slot)
+{
+    uint32_t width = _g_hash_table_index_width(hash_table->num_slots);
+
+    if (width == sizeof(uint8_t)) {
+        return ((uint8_t*) hash_table->indices)[slot];
+    }
+
+    if (width == sizeof(uint16_t)) {
+        return ((uint16_t*) hash_table->indices)[slot];
+    }
+
+    return ((uint32_t*) hash_table->indices)[slot];
+}
+
+void _g_hash_table_set_index(GHashTable *hash_table, uint32_t slot, uint32_t index)
+{
+    uint32_t width = _g_hash_table_index_width(hash_table->num_slots);
+
+    if (width == sizeof(uint8_t)) {
+        ((uint8_t*) hash_table->indices)[slot] = (uint8_t) index;
+    } else if (width == sizeof(uint16_t)) {
+        ((uint16_t*) hash_table->indices)[slot] = (uint16_t) index;
+    } else {
+        ((uint32_t*) hash_table->indices)[slot] = index;
+    }
+}
+
+// Arrays are never allocated empty, so a separate values array can't compare
+// equal to the keys array.
+void *_g_hash_table_realloc_array(void *array, uint32_t count, size_t element_size)
+{
+    array = realloc(array, (count ? count : 1) * element_size);
+    if (array == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_hash_table_realloc_array: Out of memory");
+        exit(1);
+    }
+
+    return array;
+}
+
+bool _g_hash_table_is_set(GHashTable *hash_table)
+{
+    return hash_table->values == hash_table->keys;
+}
+
+// (Re)allocates keys, values and hashes for count entries. Sets stay sets.
+void _g_hash_table_realloc_storage(GHashTable *hash_table, uint32_t count)
+{
+    bool is_set = _g_hash_table_is_set(hash_table);
+
+    hash_table->keys = _g_hash_table_realloc_array(hash_table->keys, count, sizeof(void*));
+    hash_table->hashes = _g_hash_table_realloc_array(hash_table->hashes, count, sizeof(uint32_t));
+    if (is_set) {
+        hash_table->values = hash_table->keys;
+    } else {
+        hash_table->values = _g_hash_table_realloc_array(hash_table->values, count, sizeof(void*));
+    }
+}
+
+void **_g_hash_table_copy_keys(void **keys, uint32_t count)
+{
+    void **values = _g_hash_table_realloc_array(NULL, count, sizeof(void*));
+
+    if (count) {
+        memcpy(values, keys, count * sizeof(void*));
+    }
+
+    return values;
+}
+
+// Gives the table its own values array once a value differs from its key.
+// Entries keep their positions, so this is safe at any point.
+void _g_hash_table_ensure_values(GHashTable *hash_table)
+{
+    if (!_g_hash_table_is_set(hash_table)) {
+        return;
+    }
+
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        hash_table->values = _g_hash_table_copy_keys(hash_table->keys, hash_table->entries_capacity);
+    } else {
+        hash_table->values = _g_hash_table_copy_keys(hash_table->keys, hash_table->num_slots);
+    }
+
+    if (hash_table->old_keys) {
+        hash_table->old_values = _g_hash_table_copy_keys(hash_table->old_keys, hash_table->old_num_slots);
+    }
+}
+
+// Allocates empty slot arrays. The caller owns the previous ones.
+void _g_hash_table_alloc_slots(GHashTable *hash_table, uint32_t num_slots)
+{
+    hash_table->num_slots = num_slots;
+    hash_table->num_used = 0;
+    hash_table->num_deleted = 0;
+    hash_table->resize_threshold = (uint32_t) (num_slots * GHASHTABLE_MAX_LOAD);
+
+    hash_table->ctrl = malloc(num_slots);
+    if (hash_table->ctrl == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_hash_table_alloc_slots: Out of memory");
+        exit(1);
+    }
+
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        hash_table->indices = _g_hash_table_realloc_array(NULL, num_slots, _g_hash_table_index_width(num_slots));
+    } else {
+        bool is_set = _g_hash_table_is_set(hash_table);
+
+        hash_table->keys = _g_hash_table_realloc_array(NULL, num_slots, sizeof(void*));
+        hash_table->hashes = _g_hash_table_realloc_array(NULL, num_slots, sizeof(uint32_t));
+        hash_table->values = is_set ? hash_table->keys : _g_hash_table_realloc_array(NULL, num_slots, sizeof(void*));
+    }
+
+    memset(hash_table->ctrl, GHASHTABLE_CTRL_EMPTY, num_slots);
+}
+
+void _g_hash_table_free_arrays(void **keys, void **values, uint32_t *hashes)
+{
+    if (values != keys) {
+        free(values);
+    }
+    free(keys);
+    free(hashes);
+}
+
+// Smallest slot count that holds size entries without resizing.
+uint32_t _g_hash_table_slots_for_size(uint32_t size)
+{
+    uint32_t num_slots = GHASHTABLE_MIN_SLOTS;
+
+    while ((uint32_t) (num_slots * GHASHTABLE_MAX_LOAD) < size) {
+        if (num_slots > UINT32_MAX / 2) {
+            fprintf(stderr, "FATAL ERROR: _g_hash_table_slots_for_size: Too many entries");
+            exit(1);
+        }
+        num_slots *= 2;
+    }
+
+    return num_slots;
+}
+
 GHashTable *g_hash_table_new(GHashFunc hash_func, GEqualFunc key_equal_func)
+{
+    return g_hash_table_new_sized(hash_func, key_equal_func, 0);
+}
+
+GHashTable *g_hash_table_new_sized(GHashFunc hash_func, GEqualFunc key_equal_func, uint32_t size)
 {
     if (hash_func == NULL) {
         return NULL;
@@ -52,26 +359,34 @@ GHashTable *g_hash_table_new(GHashFunc hash_func, GEqualFunc key_equal_func)
 
     GHashTable *hash_table = (GHashTable*) malloc(sizeof(GHashTable));
     if (hash_table == NULL) {
-        fprintf(stderr, "FATAL ERROR: g_hash_table_new: Out of memory");
+        fprintf(stderr, "FATAL ERROR: g_hash_table_new_sized: Out of memory");
         exit(1);
     }
 
-    hash_table->num_slots = GHASHTABLE_MIN_SLOTS;
-    hash_table->num_used = 0;
-    hash_table->resize_threshold = (uint32_t) (hash_table->num_slots * GHASHTABLE_MAX_LOAD);
     hash_table->hash_func = hash_func;
     hash_table->key_equal_func = key_equal_func;
     hash_table->key_destroy_func = NULL;
     hash_table->value_destroy_func = NULL;
+    hash_table->flags = G_HASH_TABLE_FLAGS_NONE;
+    hash_table->keys = NULL;
+    hash_table->values = NULL;
+    hash_table->hashes = NULL;
+    hash_table->old_num_slots = 0;
+    hash_table->old_num_used = 0;
+    hash_table->rehash_index = 0;
+    hash_table->old_ctrl = NULL;
+    hash_table->old_keys = NULL;
+    hash_table->old_values = NULL;
+    hash_table->old_hashes = NULL;
+    hash_table->indices = NULL;
+    hash_table->num_entries = 0;
+    hash_table->entries_capacity = 0;
+    hash_table->num_resizes = 0;
+    hash_table->counters = (GHashTableCounters) {0};
+    hash_table->seed = (uint32_t) _g_hash_mix(_g_hash_seed(), (uint64_t) (uintptr_t) hash_table);
 
-    size_t buf_size = hash_table->num_slots * sizeof(struct GHashTableSlot);
-    hash_table->slots = malloc(buf_size);
-    if (hash_table->slots == NULL) {
-        fprintf(stderr, "FATAL ERROR: g_hash_table_new: Out of memory");
-        exit(1);
-    }
-
-    memset(hash_table->slots, 0, buf_size);
+    // every table starts out as a set
+    _g_hash_table_alloc_slots(hash_table, _g_hash_table_slots_for_size(size));
 
     return hash_table;
 }
@@ -90,26 +405,47 @@ GHashTable *g_hash_table_new_full(GHashFunc hash_func, GEqualFunc key_equal_func
     return hash_table;
 }
 
-uint32_t _g_hash_table_find_free_slot(GHashTable *hash_table, uint32_t start_slot, void *key)
+GHashTable *g_hash_table_new_with_flags(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func, GHashTableFlags flags)
 {
-    for (uint32_t i = start_slot; i < hash_table->num_slots; i++) {
-        if (hash_table->slots[i].used == false) {
-            return i;
-        }
+    GHashTable *hash_table = g_hash_table_new_full(hash_func, key_equal_func, key_destroy_func, value_destroy_func);
 
-        if (key && hash_table->key_equal_func(hash_table->slots[i].key, key)) {
-            return i;
-        }
+    if (hash_table == NULL) {
+        return NULL;
     }
 
-    for (uint32_t i = 0; i < start_slot; i++) {
-        if (hash_table->slots[i].used == false) {
-            return i;
-        }
+    hash_table->flags = flags;
+
+    if (flags & G_HASH_TABLE_ORDERED) {
+        // replace the slot arrays with an index of the same size, entries
+        // are allocated as they are added
+        free(hash_table->ctrl);
+        _g_hash_table_free_arrays(hash_table->keys, hash_table->values, hash_table->hashes);
+        hash_table->keys = NULL;
+        hash_table->values = NULL;
+        hash_table->hashes = NULL;
+        _g_hash_table_alloc_slots(hash_table, hash_table->num_slots);
+    }
+
+    return hash_table;
+}
+
+uint32_t _g_hash_table_find_free_slot_in(GHashTable *hash_table, const uint8_t *ctrl, uint32_t num_slots, uint32_t hash)
+{
+    uint32_t num_groups = num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint32_t group = _g_hash_table_hash_group(num_slots, hash);
+
+    _G_HASH_TABLE_COUNT(hash_table, free_slot_searches);
 
-        if (key && hash_table->key_equal_func(hash_table->slots[i].key, key)) {
-            return i;
+    // triangular probing visits every group once when num_groups is a power of two
+    for (uint32_t step = 1; step <= num_groups; step++) {
+        _G_HASH_TABLE_COUNT(hash_table, free_slot_groups);
+
+        uint32_t free = _g_hash_table_group_match_free(&ctrl[group * GHASHTABLE_GROUP_WIDTH]);
+        if (free) {
+            return group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(free);
         }
+
+        group = (group + step) & (num_groups - 1);
     }
 
     // this should never happen
@@ -119,183 +455,1396 @@ uint32_t _g_hash_table_find_free_slot(GHashTable *hash_table, uint32_t start_slo
     return 0;
 }
 
-uint32_t _g_hash_table_calc_start_slot(GHashTable *hash_table, void *key)
+uint32_t _g_hash_table_find_free_slot(GHashTable *hash_table, uint32_t hash)
 {
-    return hash_table->hash_func(key) % hash_table->num_slots;
+    return _g_hash_table_find_free_slot_in(hash_table, hash_table->ctrl, hash_table->num_slots, hash);
 }
 
-uint32_t _g_hash_table_find_slot_by_key(GHashTable *hash_table, void *key, uint32_t start_slot, bool *ret_found)
+uint32_t _g_hash_table_find_slot_in(GHashTable *hash_table, const uint8_t *ctrl, void **keys, const uint32_t *hashes, uint32_t num_slots, void *key, uint32_t hash, bool *ret_found)
 {
-    for (uint32_t i = start_slot; i < hash_table->num_slots; i++) {
-        if (hash_table->slots[i].used == false && hash_table->slots[i].deleted == false) {
-            *ret_found = false;
-            return 0;
+    uint32_t num_groups = num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint32_t group = _g_hash_table_hash_group(num_slots, hash);
+    uint8_t tag = _g_hash_table_hash_tag(hash);
+
+    _G_HASH_TABLE_COUNT(hash_table, probes);
+
+    for (uint32_t step = 1; step <= num_groups; step++) {
+        const uint8_t *group_ctrl = &ctrl[group * GHASHTABLE_GROUP_WIDTH];
+
+        _G_HASH_TABLE_COUNT(hash_table, probe_groups);
+
+        for (uint32_t match = _g_hash_table_group_match(group_ctrl, tag); match; match &= match - 1) {
+            uint32_t slot = group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(match);
+            if (hashes[slot] != hash) {
+                continue;
+            }
+
+            _G_HASH_TABLE_COUNT(hash_table, key_compares);
+            if (hash_table->key_equal_func(key, keys[slot])) {
+                *ret_found = true;
+                return slot;
+            }
         }
 
-        if (hash_table->key_equal_func(key, hash_table->slots[i].key)) {
-            *ret_found = true;
-            return i;
+        // an empty slot ends every probe sequence that reaches this group
+        if (_g_hash_table_group_match_empty(group_ctrl)) {
+            break;
         }
+
+        group = (group + step) & (num_groups - 1);
     }
 
-    for (uint32_t i = 0; i < start_slot; i++) {
-        if (hash_table->slots[i].used == false) {
-            *ret_found = false;
-            return 0;
+    *ret_found = false;
+    return 0;
+}
+
+// Finds the entry of an ordered table by probing the index.
+uint32_t _g_hash_table_find_entry(GHashTable *hash_table, void *key, uint32_t hash, bool *ret_found)
+{
+    uint32_t num_groups = hash_table->num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint32_t group = _g_hash_table_hash_group(hash_table->num_slots, hash);
+    uint8_t tag = _g_hash_table_hash_tag(hash);
+
+    _G_HASH_TABLE_COUNT(hash_table, probes);
+
+    for (uint32_t step = 1; step <= num_groups; step++) {
+        const uint8_t *group_ctrl = &hash_table->ctrl[group * GHASHTABLE_GROUP_WIDTH];
+
+        _G_HASH_TABLE_COUNT(hash_table, probe_groups);
+
+        for (uint32_t match = _g_hash_table_group_match(group_ctrl, tag); match; match &= match - 1) {
+            uint32_t index = _g_hash_table_get_index(hash_table, group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(match));
+            if (hash_table->hashes[index] != hash) {
+                continue;
+            }
+
+            _G_HASH_TABLE_COUNT(hash_table, key_compares);
+            if (hash_table->key_equal_func(key, hash_table->keys[index])) {
+                *ret_found = true;
+                return index;
+            }
         }
 
-        if (hash_table->key_equal_func(key, hash_table->slots[i].key)) {
-            *ret_found = true;
-            return i;
+        if (_g_hash_table_group_match_empty(group_ctrl)) {
+            break;
         }
+
+        group = (group + step) & (num_groups - 1);
     }
 
     *ret_found = false;
     return 0;
 }
 
-void _g_hash_table_resize(GHashTable *hash_table, uint32_t new_num_slots)
+// Finds the index slot pointing at an entry without calling key_equal_func.
+uint32_t _g_hash_table_find_entry_slot(GHashTable *hash_table, uint32_t index)
 {
-    uint32_t old_num_slots = hash_table->num_slots;
-    struct GHashTableSlot *old_slots = hash_table->slots;
-    struct GHashTableSlot *new_slots;
+    uint32_t hash = hash_table->hashes[index];
+    uint32_t num_groups = hash_table->num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint32_t group = _g_hash_table_hash_group(hash_table->num_slots, hash);
+    uint8_t tag = _g_hash_table_hash_tag(hash);
 
-    size_t buf_size = new_num_slots * sizeof(struct GHashTableSlot);
-    new_slots = malloc(buf_size);
-    if (new_slots == NULL) {
-        fprintf(stderr, "FATAL ERROR: _g_hash_table_resize: Out of memory");
-        exit(1);
+    for (uint32_t step = 1; step <= num_groups; step++) {
+        const uint8_t *group_ctrl = &hash_table->ctrl[group * GHASHTABLE_GROUP_WIDTH];
+
+        for (uint32_t match = _g_hash_table_group_match(group_ctrl, tag); match; match &= match - 1) {
+            uint32_t slot = group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(match);
+            if (_g_hash_table_get_index(hash_table, slot) == index) {
+                return slot;
+            }
+        }
+
+        group = (group + step) & (num_groups - 1);
     }
 
-    hash_table->slots = new_slots;
-    hash_table->num_used = 0;
-    hash_table->num_slots = new_num_slots;
-    hash_table->resize_threshold = (uint32_t) (hash_table->num_slots * GHASHTABLE_MAX_LOAD);
+    // this should never happen
+    fprintf(stderr, "BUG: _g_hash_table_find_entry_slot: Entry is not indexed.");
+    abort();
 
-    memset(hash_table->slots, 0, buf_size);
+    return 0;
+}
 
-    for (uint32_t i = 0; i < old_num_slots; i++) {
-        if (old_slots[i].used) {
-            g_hash_table_insert(hash_table, old_slots[i].key, old_slots[i].value);
-        }
+// Marks a slot as free, leaving a tombstone only where a probe sequence may
+// continue past its group. Returns whether a tombstone was left.
+bool _g_hash_table_clear_ctrl(uint8_t *ctrl, uint32_t slot)
+{
+    // Every probe sequence that reaches a group with an empty slot ends there,
+    // so the slot can become empty again. Only slots in full groups need a
+    // tombstone to keep longer probe sequences intact.
+    if (_g_hash_table_group_match_empty(&ctrl[slot - slot % GHASHTABLE_GROUP_WIDTH])) {
+        ctrl[slot] = GHASHTABLE_CTRL_EMPTY;
+        return false;
     }
 
-    free(old_slots);
+    ctrl[slot] = GHASHTABLE_CTRL_DELETED;
+    return true;
 }
 
-void g_hash_table_insert(GHashTable *hash_table, void *key, void *value)
+// Places an entry in a free slot of the current slot arrays.
+uint32_t _g_hash_table_place(GHashTable *hash_table, void *key, void *value, uint32_t hash)
 {
-    if (hash_table->num_used >= hash_table->resize_threshold) {
-        _g_hash_table_resize(hash_table, hash_table->num_slots * 2);
+    uint32_t slot = _g_hash_table_find_free_slot(hash_table, hash);
+    if (hash_table->ctrl[slot] == GHASHTABLE_CTRL_DELETED) {
+        hash_table->num_deleted--;
     }
 
-    uint32_t start_slot = _g_hash_table_calc_start_slot(hash_table, key);
-    uint32_t slot = 0;
+    hash_table->ctrl[slot] = _g_hash_table_hash_tag(hash);
+    hash_table->keys[slot] = key;
+    hash_table->values[slot] = value;
+    hash_table->hashes[slot] = hash;
+    hash_table->num_used++;
 
-    if (hash_table->slots[start_slot].used == false) {
-        slot = start_slot;
-    } else {
-        // hashed slot is already used
-        // search for next free one
-        slot = _g_hash_table_find_free_slot(hash_table, start_slot, key);
+    return slot;
+}
+
+// Moves one entry of the old slot arrays into the current ones and returns
+// its new slot.
+uint32_t _g_hash_table_migrate_slot(GHashTable *hash_table, uint32_t old_slot)
+{
+    uint32_t slot = _g_hash_table_place(hash_table, hash_table->old_keys[old_slot], hash_table->old_values[old_slot], hash_table->old_hashes[old_slot]);
+
+    // the rest of the old arrays is still probed by lookups
+    _g_hash_table_clear_ctrl(hash_table->old_ctrl, old_slot);
+    hash_table->old_num_used--;
+
+    return slot;
+}
+
+// Moves up to max_slots slots of the old slot arrays into the
+// new ones, freeing the old arrays once they are empty.
+void _g_hash_table_rehash_step(GHashTable *hash_table, uint32_t max_slots)
+{
+    uint32_t end = hash_table->rehash_index + max_slots;
+    if (end > hash_table->old_num_slots || end < hash_table->rehash_index) {
+        end = hash_table->old_num_slots;
     }
 
-    if (hash_table->slots[slot].used) {
-        // key already exists in the hash table
-        if (hash_table->key_destroy_func && key != hash_table->slots[slot].key) {
-            hash_table->key_destroy_func(hash_table->slots[slot].key);
+    for (uint32_t i = hash_table->rehash_index; i < end; i++) {
+        if (_g_hash_table_ctrl_is_full(hash_table->old_ctrl[i])) {
+            _g_hash_table_migrate_slot(hash_table, i);
         }
+    }
 
-        if (hash_table->value_destroy_func && value != hash_table->slots[slot].value) {
-            hash_table->value_destroy_func(hash_table->slots[slot].value);
-        }
+    hash_table->rehash_index = end;
 
-        hash_table->slots[slot].value = value;
-    } else {
-        hash_table->slots[slot].key = key;
-        hash_table->slots[slot].value = value;
-        hash_table->slots[slot].used = true;
-        hash_table->slots[slot].deleted = false;
-        hash_table->num_used++;
+    if (hash_table->rehash_index == hash_table->old_num_slots) {
+        free(hash_table->old_ctrl);
+        _g_hash_table_free_arrays(hash_table->old_keys, hash_table->old_values, hash_table->old_hashes);
+        hash_table->old_ctrl = NULL;
+        hash_table->old_keys = NULL;
+        hash_table->old_values = NULL;
+        hash_table->old_hashes = NULL;
+        hash_table->old_num_slots = 0;
+        hash_table->old_num_used = 0;
+        hash_table->rehash_index = 0;
     }
 }
 
-uint32_t g_hash_table_size(GHashTable *hash_table)
+void _g_hash_table_finish_resize(GHashTable *hash_table)
 {
-    return hash_table->num_used;
+    if (hash_table->old_ctrl) {
+        _g_hash_table_rehash_step(hash_table, UINT32_MAX);
+    }
 }
 
-void* g_hash_table_lookup(GHashTable *hash_table, void *key)
+// Returns the position of key in keys, values and hashes: its slot, or its
+// entry for ordered tables. Mid-resize, a key found in the old slot arrays is
+// moved over first, so positions always refer to the current arrays.
+uint32_t _g_hash_table_lookup_position(GHashTable *hash_table, void *key, uint32_t hash, bool *ret_found)
 {
-    bool found = false;
-    uint32_t start_slot = _g_hash_table_calc_start_slot(hash_table, key);
-    uint32_t slot = _g_hash_table_find_slot_by_key(hash_table, key, start_slot, &found);
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        return _g_hash_table_find_entry(hash_table, key, hash, ret_found);
+    }
 
-    if (!found) {
-        return NULL;
+    uint32_t slot = _g_hash_table_find_slot_in(hash_table, hash_table->ctrl, hash_table->keys, hash_table->hashes, hash_table->num_slots, key, hash, ret_found);
+
+    if (*ret_found || hash_table->old_ctrl == NULL) {
+        return slot;
+    }
+
+    slot = _g_hash_table_find_slot_in(hash_table, hash_table->old_ctrl, hash_table->old_keys, hash_table->old_hashes, hash_table->old_num_slots, key, hash, ret_found);
+    if (*ret_found) {
+        return _g_hash_table_migrate_slot(hash_table, slot);
     }
 
-    return hash_table->slots[slot].value;
+    return 0;
 }
 
-void g_hash_table_foreach(GHashTable *hash_table, GHFunc func, void *user_data)
+// Removed entries of an ordered table are marked by pointing their key here.
+static char _g_hash_table_removed_entry;
+
+bool _g_hash_table_entry_is_removed(GHashTable *hash_table, uint32_t index)
+{
+    return hash_table->keys[index] == &_g_hash_table_removed_entry;
+}
+
+// Drops removed entries from an ordered table, keeping the rest in order, and
+// indexes them in a new index of num_slots slots.
+void _g_hash_table_rebuild_ordered(GHashTable *hash_table, uint32_t num_slots)
 {
-    for (uint32_t i = 0; i < hash_table->num_slots; i++) {
-        if (hash_table->slots[i].used == true) {
-            func(hash_table->slots[i].key, hash_table->slots[i].value, user_data);
+    bool is_set = _g_hash_table_is_set(hash_table);
+    uint32_t num_entries = 0;
+
+    hash_table->num_resizes++;
+
+    for (uint32_t i = 0; i < hash_table->num_entries; i++) {
+        if (_g_hash_table_entry_is_removed(hash_table, i)) {
+            continue;
+        }
+
+        hash_table->keys[num_entries] = hash_table->keys[i];
+        hash_table->hashes[num_entries] = hash_table->hashes[i];
+        if (!is_set) {
+            hash_table->values[num_entries] = hash_table->values[i];
         }
+        num_entries++;
+    }
+    hash_table->num_entries = num_entries;
+
+    if (hash_table->entries_capacity > num_slots) {
+        hash_table->entries_capacity = num_slots;
+        _g_hash_table_realloc_storage(hash_table, num_slots);
+    }
+
+    free(hash_table->ctrl);
+    free(hash_table->indices);
+    _g_hash_table_alloc_slots(hash_table, num_slots);
+
+    for (uint32_t i = 0; i < num_entries; i++) {
+        uint32_t slot = _g_hash_table_find_free_slot(hash_table, hash_table->hashes[i]);
+        hash_table->ctrl[slot] = _g_hash_table_hash_tag(hash_table->hashes[i]);
+        _g_hash_table_set_index(hash_table, slot, i);
     }
+    hash_table->num_used = num_entries;
 }
 
-bool g_hash_table_remove(GHashTable *hash_table, void *key)
+void _g_hash_table_reserve_entries(GHashTable *hash_table, uint32_t capacity)
 {
-    bool found = false;
-    uint32_t start_slot = _g_hash_table_calc_start_slot(hash_table, key);
-    uint32_t slot = _g_hash_table_find_slot_by_key(hash_table, key, start_slot, &found);
+    if (capacity > hash_table->num_slots) {
+        capacity = hash_table->num_slots;
+    }
 
-    if (!found) {
-        return false;
+    if (capacity <= hash_table->entries_capacity) {
+        return;
     }
 
-    if (hash_table->key_destroy_func) {
-        hash_table->key_destroy_func(hash_table->slots[slot].key);
+    _g_hash_table_realloc_storage(hash_table, capacity);
+    hash_table->entries_capacity = capacity;
+}
+
+uint32_t _g_hash_table_append_entry(GHashTable *hash_table, void *key, void *value, uint32_t hash)
+{
+    // Entries grow separately from the index, by half each time. Once they
+    // fill the index the removed ones are dropped instead.
+    if (hash_table->num_entries == hash_table->entries_capacity) {
+        if (hash_table->entries_capacity < hash_table->num_slots) {
+            _g_hash_table_reserve_entries(hash_table, hash_table->entries_capacity + hash_table->entries_capacity / 2 + 8);
+        } else {
+            _g_hash_table_rebuild_ordered(hash_table, hash_table->num_slots);
+        }
     }
 
-    if (hash_table->value_destroy_func) {
-        hash_table->value_destroy_func(hash_table->slots[slot].value);
+    uint32_t index = hash_table->num_entries++;
+    uint32_t slot = _g_hash_table_find_free_slot(hash_table, hash);
+    if (hash_table->ctrl[slot] == GHASHTABLE_CTRL_DELETED) {
+        hash_table->num_deleted--;
     }
 
-    hash_table->slots[slot].key = 0;
-    hash_table->slots[slot].value = 0;
-    hash_table->slots[slot].used = false;
-    hash_table->slots[slot].deleted = true;
+    hash_table->ctrl[slot] = _g_hash_table_hash_tag(hash);
+    _g_hash_table_set_index(hash_table, slot, index);
+    hash_table->keys[index] = key;
+    hash_table->values[index] = value;
+    hash_table->hashes[index] = hash;
+    hash_table->num_used++;
+
+    return index;
+}
+
+void _g_hash_table_erase_entry(GHashTable *hash_table, uint32_t index)
+{
+    if (_g_hash_table_clear_ctrl(hash_table->ctrl, _g_hash_table_find_entry_slot(hash_table, index))) {
+        hash_table->num_deleted++;
+    }
     hash_table->num_used--;
 
-    return true;
+    if (index == hash_table->num_entries - 1) {
+        hash_table->num_entries--;
+    } else {
+        hash_table->keys[index] = &_g_hash_table_removed_entry;
+    }
 }
 
-void g_hash_table_destroy(GHashTable *hash_table)
+void _g_hash_table_resize(GHashTable *hash_table, uint32_t new_num_slots)
 {
-    if (hash_table) {
-        if (hash_table->key_destroy_func || hash_table->value_destroy_func) {
-            for (uint32_t i = 0; i < hash_table->num_slots; i++) {
-                if (hash_table->slots[i].used == false) {
-                    continue;
-                }
+    _g_hash_table_finish_resize(hash_table);
 
-                if (hash_table->key_destroy_func) {
-                    hash_table->key_destroy_func(hash_table->slots[i].key);
-                }
+    // only the index is rebuilt, entries keep their place
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        _g_hash_table_rebuild_ordered(hash_table, new_num_slots);
+        return;
+    }
 
-                if (hash_table->value_destroy_func) {
-                    hash_table->value_destroy_func(hash_table->slots[i].value);
-                }
-            }
-        }
+    hash_table->num_resizes++;
+
+    uint32_t old_num_slots = hash_table->num_slots;
+    uint32_t old_num_used = hash_table->num_used;
+    uint8_t *old_ctrl = hash_table->ctrl;
+    void **old_keys = hash_table->keys;
+    void **old_values = hash_table->values;
+    uint32_t *old_hashes = hash_table->hashes;
+
+    _g_hash_table_alloc_slots(hash_table, new_num_slots);
+
+    // keep both arrays and let later operations migrate the entries
+    if (hash_table->flags & G_HASH_TABLE_INCREMENTAL_RESIZE) {
+        hash_table->old_num_slots = old_num_slots;
+        hash_table->old_num_used = old_num_used;
+        hash_table->old_ctrl = old_ctrl;
+        hash_table->old_keys = old_keys;
+        hash_table->old_values = old_values;
+        hash_table->old_hashes = old_hashes;
+        hash_table->rehash_index = 0;
+        return;
+    }
 
-        if (hash_table->slots) {
-            free(hash_table->slots);
+    // keys are already unique, so entries move by their cached hash without
+    // calling hash_func or key_equal_func
+    for (uint32_t i = 0; i < old_num_slots; i++) {
+        if (_g_hash_table_ctrl_is_full(old_ctrl[i])) {
+            _g_hash_table_place(hash_table, old_keys[i], old_values[i], old_hashes[i]);
         }
+    }
+
+    free(old_ctrl);
+    _g_hash_table_free_arrays(old_keys, old_values, old_hashes);
+}
+
+void _g_hash_table_swap_slots(GHashTable *hash_table, uint32_t a, uint32_t b)
+{
+    void *key = hash_table->keys[a];
+    hash_table->keys[a] = hash_table->keys[b];
+    hash_table->keys[b] = key;
+
+    uint32_t hash = hash_table->hashes[a];
+    hash_table->hashes[a] = hash_table->hashes[b];
+    hash_table->hashes[b] = hash;
+
+    if (!_g_hash_table_is_set(hash_table)) {
+        void *value = hash_table->values[a];
+        hash_table->values[a] = hash_table->values[b];
+        hash_table->values[b] = value;
+    }
+}
+
+// Drops all tombstones without allocating by reinserting every entry into
+// the same slot arrays.
+void _g_hash_table_rehash_in_place(GHashTable *hash_table)
+{
+    uint8_t *ctrl = hash_table->ctrl;
+    uint32_t num_slots = hash_table->num_slots;
+
+    hash_table->num_resizes++;
+
+    // mark every full slot as deleted and every free slot as empty, then
+    // place the deleted ones again
+    for (uint32_t i = 0; i < num_slots; i++) {
+        ctrl[i] = _g_hash_table_ctrl_is_full(ctrl[i]) ? GHASHTABLE_CTRL_DELETED : GHASHTABLE_CTRL_EMPTY;
+    }
+
+    for (uint32_t i = 0; i < num_slots; i++) {
+        if (ctrl[i] != GHASHTABLE_CTRL_DELETED) {
+            continue;
+        }
+
+        uint32_t hash = hash_table->hashes[i];
+        uint32_t target = _g_hash_table_find_free_slot_in(hash_table, ctrl, num_slots, hash);
+
+        // slot i is free itself, so the target group never comes after it in
+        // the probe sequence
+        if (target / GHASHTABLE_GROUP_WIDTH == i / GHASHTABLE_GROUP_WIDTH) {
+            ctrl[i] = _g_hash_table_hash_tag(hash);
+            continue;
+        }
+
+        // an empty target is simply filled, a deleted one still holds an
+        // entry waiting to be placed, which is placed next
+        bool target_empty = ctrl[target] == GHASHTABLE_CTRL_EMPTY;
+
+        _g_hash_table_swap_slots(hash_table, i, target);
+        ctrl[target] = _g_hash_table_hash_tag(hash);
+
+        if (target_empty) {
+            ctrl[i] = GHASHTABLE_CTRL_EMPTY;
+        } else {
+            i--;
+        }
+    }
+
+    hash_table->num_deleted = 0;
+}
+
+// Rebuilds the slot arrays at the same size to drop tombstones.
+void _g_hash_table_purge_deleted(GHashTable *hash_table)
+{
+    if (hash_table->flags & (G_HASH_TABLE_INCREMENTAL_RESIZE | G_HASH_TABLE_ORDERED)) {
+        _g_hash_table_resize(hash_table, hash_table->num_slots);
+    } else {
+        _g_hash_table_rehash_in_place(hash_table);
+    }
+}
+
+void g_hash_table_reserve(GHashTable *hash_table, uint32_t size)
+{
+    uint32_t num_slots = _g_hash_table_slots_for_size(size);
+
+    if (num_slots > hash_table->num_slots) {
+        _g_hash_table_resize(hash_table, num_slots);
+    }
+
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        _g_hash_table_reserve_entries(hash_table, size);
+    }
+}
+
+void g_hash_table_compact(GHashTable *hash_table)
+{
+    _g_hash_table_finish_resize(hash_table);
+
+    uint32_t num_slots = _g_hash_table_slots_for_size(hash_table->num_used);
+
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        if (num_slots > hash_table->num_slots) {
+            num_slots = hash_table->num_slots;
+        }
+        _g_hash_table_rebuild_ordered(hash_table, num_slots);
+
+        // size the entries to fit exactly
+        hash_table->entries_capacity = hash_table->num_entries;
+        _g_hash_table_realloc_storage(hash_table, hash_table->entries_capacity);
+    } else if (num_slots < hash_table->num_slots) {
+        _g_hash_table_resize(hash_table, num_slots);
+        _g_hash_table_finish_resize(hash_table);
+    } else if (hash_table->num_deleted) {
+        _g_hash_table_rehash_in_place(hash_table);
+    }
+}
+
+size_t _g_hash_table_bytes_allocated(GHashTable *hash_table)
+{
+    size_t value_bytes = _g_hash_table_is_set(hash_table) ? 0 : sizeof(void*);
+    size_t bytes = sizeof(GHashTable) + hash_table->num_slots;
+
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        bytes += (size_t) hash_table->num_slots * _g_hash_table_index_width(hash_table->num_slots);
+        bytes += (size_t) hash_table->entries_capacity * (sizeof(void*) + sizeof(uint32_t) + value_bytes);
+    } else {
+        bytes += (size_t) hash_table->num_slots * (sizeof(void*) + sizeof(uint32_t) + value_bytes);
+    }
+
+    if (hash_table->old_ctrl) {
+        size_t old_value_bytes = hash_table->old_values == hash_table->old_keys ? 0 : sizeof(void*);
+        bytes += (size_t) hash_table->old_num_slots * (1 + sizeof(void*) + sizeof(uint32_t) + old_value_bytes);
+    }
+
+    return bytes;
+}
+
+void _g_hash_table_stats_add(uint32_t *histogram, uint32_t *max, uint64_t *sum, uint32_t length)
+{
+    histogram[length < GHASHTABLE_STATS_HISTOGRAM_SIZE ? length - 1 : GHASHTABLE_STATS_HISTOGRAM_SIZE - 1]++;
+    if (length > *max) {
+        *max = length;
+    }
+    *sum += length;
+}
+
+// Walks the probe sequences of the slot arrays without calling hash_func or
+// key_equal_func, so it is safe to call on any table.
+void g_hash_table_get_stats(GHashTable *hash_table, GHashTableStats *stats)
+{
+    uint32_t num_groups = hash_table->num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint64_t found_sum = 0;
+    uint64_t missing_sum = 0;
+
+    memset(stats, 0, sizeof(GHashTableStats));
+    stats->size = g_hash_table_size(hash_table);
+    stats->num_slots = hash_table->num_slots;
+    stats->num_tombstones = hash_table->num_deleted;
+    stats->load_factor = (double) hash_table->num_used / hash_table->num_slots;
+    stats->tombstone_ratio = (double) hash_table->num_deleted / hash_table->num_slots;
+    stats->num_resizes = hash_table->num_resizes;
+    stats->bytes_allocated = _g_hash_table_bytes_allocated(hash_table);
+#ifdef GHASHTABLE_COUNTERS
+    stats->counters_enabled = true;
+#endif
+    stats->counters = hash_table->counters;
+
+    for (uint32_t slot = 0; slot < hash_table->num_slots; slot++) {
+        if (!_g_hash_table_ctrl_is_full(hash_table->ctrl[slot])) {
+            continue;
+        }
+
+        uint32_t hash = hash_table->flags & G_HASH_TABLE_ORDERED ? hash_table->hashes[_g_hash_table_get_index(hash_table, slot)] : hash_table->hashes[slot];
+        uint32_t group = _g_hash_table_hash_group(hash_table->num_slots, hash);
+        uint32_t length = 1;
+
+        for (uint32_t step = 1; group != slot / GHASHTABLE_GROUP_WIDTH; step++) {
+            group = (group + step) & (num_groups - 1);
+            length++;
+        }
+
+        _g_hash_table_stats_add(stats->probe_length_found, &stats->max_probe_length_found, &found_sum, length);
+    }
+
+    // a missing key probes until the first group with an empty slot
+    for (uint32_t home = 0; home < num_groups; home++) {
+        uint32_t group = home;
+        uint32_t length = 1;
+
+        for (uint32_t step = 1; step < num_groups && !_g_hash_table_group_match_empty(&hash_table->ctrl[group * GHASHTABLE_GROUP_WIDTH]); step++) {
+            group = (group + step) & (num_groups - 1);
+            length++;
+        }
+
+        _g_hash_table_stats_add(stats->probe_length_missing, &stats->max_probe_length_missing, &missing_sum, length);
+    }
+
+    if (hash_table->num_used) {
+        stats->mean_probe_length_found = (double) found_sum / hash_table->num_used;
+    }
+    stats->mean_probe_length_missing = (double) missing_sum / num_groups;
+}
+
+// Halves the slot arrays (or more) once the live entries fall below
+// GHASHTABLE_MIN_LOAD, leaving room to grow back to twice the current size.
+void _g_hash_table_maybe_shrink(GHashTable *hash_table)
+{
+    if (hash_table->old_ctrl || hash_table->num_slots <= GHASHTABLE_MIN_SLOTS) {
+        return;
+    }
+
+    if (hash_table->num_used >= (uint32_t) (hash_table->num_slots * GHASHTABLE_MIN_LOAD)) {
+        return;
+    }
+
+    _g_hash_table_resize(hash_table, _g_hash_table_slots_for_size(hash_table->num_used * 2));
+}
+
+// Returns the position holding key, or claims a new position holding key if
+// the table doesn't contain it yet. A new entry's value is NULL, or the key
+// itself in a set. The table only grows before the probe, so the position
+// stays valid until the next call into the table.
+uint32_t _g_hash_table_find_or_claim(GHashTable *hash_table, void *key, bool *ret_found)
+{
+    if (hash_table->old_ctrl) {
+        _g_hash_table_rehash_step(hash_table, GHASHTABLE_REHASH_STEP);
+    }
+
+    // tombstones lengthen probe sequences just like live entries, so they
+    // count towards the load factor. If they make up most of it we rebuild
+    // at the same size to purge them instead of growing.
+    if (hash_table->num_used + hash_table->num_deleted >= hash_table->resize_threshold) {
+        if (g_hash_table_size(hash_table) > hash_table->resize_threshold / 2) {
+            _g_hash_table_resize(hash_table, hash_table->num_slots * 2);
+        } else {
+            _g_hash_table_finish_resize(hash_table);
+            _g_hash_table_purge_deleted(hash_table);
+        }
+    }
+
+    uint32_t hash = _g_hash_table_hash(hash_table, key);
+    uint32_t position = _g_hash_table_lookup_position(hash_table, key, hash, ret_found);
+
+    if (*ret_found) {
+        return position;
+    }
+
+    void *value = _g_hash_table_is_set(hash_table) ? key : NULL;
+
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        return _g_hash_table_append_entry(hash_table, key, value, hash);
+    }
+
+    return _g_hash_table_place(hash_table, key, value, hash);
+}
+
+void _g_hash_table_set_value(GHashTable *hash_table, uint32_t position, void *value)
+{
+    if (value != hash_table->keys[position]) {
+        _g_hash_table_ensure_values(hash_table);
+    }
+
+    hash_table->values[position] = value;
+}
+
+// Stores value for key at a position returned by _g_hash_table_find_or_claim.
+void _g_hash_table_store(GHashTable *hash_table, uint32_t position, bool found, void *key, void *value)
+{
+    if (found) {
+        // key already exists in the hash table, keep the stored key
+        if (hash_table->key_destroy_func && key != hash_table->keys[position]) {
+            hash_table->key_destroy_func(key);
+        }
+
+        if (hash_table->value_destroy_func && value != hash_table->values[position]) {
+            hash_table->value_destroy_func(hash_table->values[position]);
+        }
+    }
+
+    _g_hash_table_set_value(hash_table, position, value);
+}
+
+// Stores key as its own value, replacing an equal stored key.
+void _g_hash_table_store_key(GHashTable *hash_table, uint32_t position, bool found, void *key)
+{
+    if (found) {
+        void *old_key = hash_table->keys[position];
+        void *old_value = hash_table->values[position];
+
+        hash_table->keys[position] = key;
+        hash_table->values[position] = key;
+
+        if (hash_table->key_destroy_func && old_key != key) {
+            hash_table->key_destroy_func(old_key);
+        }
+
+        if (hash_table->value_destroy_func && old_value != key) {
+            hash_table->value_destroy_func(old_value);
+        }
+    } else {
+        hash_table->values[position] = key;
+    }
+}
+
+void g_hash_table_insert(GHashTable *hash_table, void *key, void *value)
+{
+    bool found = false;
+    uint32_t position = _g_hash_table_find_or_claim(hash_table, key, &found);
+
+    _g_hash_table_store(hash_table, position, found, key, value);
+}
+
+// Adds key as its own value, keeping the table a set. Like GLib, an existing
+// equal key is replaced. Returns whether key was new.
+bool g_hash_table_add(GHashTable *hash_table, void *key)
+{
+    bool found = false;
+    uint32_t position = _g_hash_table_find_or_claim(hash_table, key, &found);
+
+    _g_hash_table_store_key(hash_table, position, found, key);
+
+    return !found;
+}
+
+// Returns a pointer to the value stored for key, inserting key with a NULL
+// value first if it is missing. If key is already present the table keeps its
+// stored key and the caller keeps ownership of the passed one. The pointer is
+// valid until the next call into the table.
+void** g_hash_table_lookup_or_insert(GHashTable *hash_table, void *key, bool *ret_found)
+{
+    bool found = false;
+
+    // the caller may store anything through the pointer
+    _g_hash_table_ensure_values(hash_table);
+
+    uint32_t position = _g_hash_table_find_or_claim(hash_table, key, &found);
+
+    if (ret_found) {
+        *ret_found = found;
+    }
+
+    return &hash_table->values[position];
+}
+
+void _g_hash_table_run_threads(thrd_start_t func, void *tasks, size_t task_size, uint32_t num_threads)
+{
+    thrd_t *threads = malloc(num_threads * sizeof(thrd_t));
+    if (threads == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_hash_table_run_threads: Out of memory");
+        exit(1);
+    }
+
+    for (uint32_t t = 1; t < num_threads; t++) {
+        if (thrd_create(&threads[t], func, (char*) tasks + t * task_size) != thrd_success) {
+            fprintf(stderr, "FATAL ERROR: _g_hash_table_run_threads: Failed to create thread");
+            exit(1);
+        }
+    }
+
+    func(tasks);
+
+    for (uint32_t t = 1; t < num_threads; t++) {
+        thrd_join(threads[t], NULL);
+    }
+
+    free(threads);
+}
+
+struct _GHashTableBuild;
+
+struct _GHashTableBuildTask {
+    struct _GHashTableBuild *build;
+    uint32_t thread;
+};
+
+struct _GHashTableBuild {
+    GHashTable *hash_table;
+    void **keys;
+    void **values;
+    uint32_t n;
+    uint32_t num_threads;
+    struct _GHashTableBuildTask *tasks;
+    uint32_t *key_hashes;
+    // key indices grouped by region, in index order within a region
+    uint32_t *order;
+    // counts[thread * num_threads + region], turned into scatter offsets
+    uint32_t *counts;
+    // region r owns order[region_start[r]] up to order[region_start[r + 1]]
+    uint32_t *region_start;
+    uint32_t *num_used;
+    uint32_t *num_deferred;
+};
+
+// Every thread owns one region of contiguous groups, picked by the high bits
+// of the group index.
+uint32_t _g_hash_table_build_region(struct _GHashTableBuild *build, uint32_t group)
+{
+    return (uint32_t) ((uint64_t) group * build->num_threads / (build->hash_table->num_slots / GHASHTABLE_GROUP_WIDTH));
+}
+
+// Hashes one chunk of the keys and counts them per region.
+int _g_hash_table_build_hash(void *data)
+{
+    struct _GHashTableBuildTask *task = data;
+    struct _GHashTableBuild *build = task->build;
+    uint32_t start = (uint32_t) ((uint64_t) build->n * task->thread / build->num_threads);
+    uint32_t end = (uint32_t) ((uint64_t) build->n * (task->thread + 1) / build->num_threads);
+    uint32_t *counts = &build->counts[task->thread * build->num_threads];
+
+    for (uint32_t i = start; i < end; i++) {
+        uint32_t hash = _g_hash_table_hash(build->hash_table, build->keys[i]);
+        build->key_hashes[i] = hash;
+        counts[_g_hash_table_build_region(build, _g_hash_table_hash_group(build->hash_table->num_slots, hash))]++;
+    }
+
+    return 0;
+}
+
+// Sorts the same chunk into the regions, keeping index order.
+int _g_hash_table_build_scatter(void *data)
+{
+    struct _GHashTableBuildTask *task = data;
+    struct _GHashTableBuild *build = task->build;
+    uint32_t start = (uint32_t) ((uint64_t) build->n * task->thread / build->num_threads);
+    uint32_t end = (uint32_t) ((uint64_t) build->n * (task->thread + 1) / build->num_threads);
+    uint32_t *offsets = &build->counts[task->thread * build->num_threads];
+
+    for (uint32_t i = start; i < end; i++) {
+        uint32_t region = _g_hash_table_build_region(build, _g_hash_table_hash_group(build->hash_table->num_slots, build->key_hashes[i]));
+        build->order[offsets[region]++] = i;
+    }
+
+    return 0;
+}
+
+// Inserts the keys of one region without locks, as no other thread touches
+// its groups. A key whose probe sequence leaves the region is deferred. Its
+// later duplicates are deferred too, because the groups it probed only fill
+// up, so duplicates are still resolved in index order.
+int _g_hash_table_build_fill(void *data)
+{
+    struct _GHashTableBuildTask *task = data;
+    struct _GHashTableBuild *build = task->build;
+    GHashTable *hash_table = build->hash_table;
+    uint32_t region = task->thread;
+    uint32_t num_groups = hash_table->num_slots / GHASHTABLE_GROUP_WIDTH;
+    uint32_t *deferred = &build->order[build->region_start[region]];
+    uint32_t num_used = 0;
+    uint32_t num_deferred = 0;
+
+    for (uint32_t o = build->region_start[region]; o < build->region_start[region + 1]; o++) {
+        uint32_t i = build->order[o];
+        void *key = build->keys[i];
+        uint32_t hash = build->key_hashes[i];
+        uint32_t group = _g_hash_table_hash_group(hash_table->num_slots, hash);
+        uint8_t tag = _g_hash_table_hash_tag(hash);
+        bool found = false;
+        bool placed = false;
+        uint32_t slot = 0;
+
+        for (uint32_t step = 1; step <= num_groups && _g_hash_table_build_region(build, group) == region; step++) {
+            const uint8_t *group_ctrl = &hash_table->ctrl[group * GHASHTABLE_GROUP_WIDTH];
+
+            for (uint32_t match = _g_hash_table_group_match(group_ctrl, tag); match; match &= match - 1) {
+                slot = group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(match);
+                if (hash_table->hashes[slot] == hash && hash_table->key_equal_func(key, hash_table->keys[slot])) {
+                    found = true;
+                    break;
+                }
+            }
+
+            // nothing is removed during the build, so the first free slot
+            // is also where lookups stop
+            uint32_t free = _g_hash_table_group_match_free(group_ctrl);
+            if (!found && free) {
+                slot = group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(free);
+                hash_table->ctrl[slot] = tag;
+                hash_table->keys[slot] = key;
+                hash_table->hashes[slot] = hash;
+                num_used++;
+            }
+
+            if (found || free) {
+                placed = true;
+                break;
+            }
+
+            group = (group + step) & (num_groups - 1);
+        }
+
+        if (!placed) {
+            deferred[num_deferred++] = i;
+        } else if (build->values) {
+            _g_hash_table_store(hash_table, slot, found, key, build->values[i]);
+        } else {
+            _g_hash_table_store_key(hash_table, slot, found, key);
+        }
+    }
+
+    build->num_used[region] = num_used;
+    build->num_deferred[region] = num_deferred;
+
+    return 0;
+}
+
+// Builds a table from n keys and values (or a set from the keys alone if
+// values is NULL) on up to num_threads threads. The table is sized once.
+// Keys are hashed in parallel, partitioned by region and inserted by one
+// thread per region. Duplicate keys resolve as if the keys had been inserted
+// one by one, but hash_func, key_equal_func and the destroy functions may be
+// called from any of the threads.
+GHashTable *g_hash_table_new_from_arrays(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func, void **keys, void **values, uint32_t n, uint32_t num_threads)
+{
+    GHashTable *hash_table = g_hash_table_new_sized(hash_func, key_equal_func, n);
+
+    if (hash_table == NULL) {
+        return NULL;
+    }
+
+    hash_table->key_destroy_func = key_destroy_func;
+    hash_table->value_destroy_func = value_destroy_func;
+
+    if (values) {
+        _g_hash_table_ensure_values(hash_table);
+    }
+
+    if (num_threads > n / GHASHTABLE_BUILD_MIN_KEYS) {
+        num_threads = n / GHASHTABLE_BUILD_MIN_KEYS;
+    }
+    if (num_threads > hash_table->num_slots / GHASHTABLE_GROUP_WIDTH) {
+        num_threads = hash_table->num_slots / GHASHTABLE_GROUP_WIDTH;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    struct _GHashTableBuild build = {
+        .hash_table = hash_table,
+        .keys = keys,
+        .values = values,
+        .n = n,
+        .num_threads = num_threads,
+        .tasks = malloc(num_threads * sizeof(struct _GHashTableBuildTask)),
+        .key_hashes = malloc((n ? n : 1) * sizeof(uint32_t)),
+        .order = malloc((n ? n : 1) * sizeof(uint32_t)),
+        .counts = calloc((size_t) num_threads * num_threads, sizeof(uint32_t)),
+        .region_start = malloc((num_threads + 1) * sizeof(uint32_t)),
+        .num_used = malloc(num_threads * sizeof(uint32_t)),
+        .num_deferred = malloc(num_threads * sizeof(uint32_t)),
+    };
+    if (build.tasks == NULL || build.key_hashes == NULL || build.order == NULL || build.counts == NULL
+            || build.region_start == NULL || build.num_used == NULL || build.num_deferred == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_hash_table_new_from_arrays: Out of memory");
+        exit(1);
+    }
+
+    for (uint32_t t = 0; t < num_threads; t++) {
+        build.tasks[t].build = &build;
+        build.tasks[t].thread = t;
+    }
+
+    _g_hash_table_run_threads(_g_hash_table_build_hash, build.tasks, sizeof(struct _GHashTableBuildTask), num_threads);
+
+    // turn the counts into offsets, region by region and within a region
+    // chunk by chunk, so the scatter keeps index order
+    uint32_t offset = 0;
+    for (uint32_t region = 0; region < num_threads; region++) {
+        build.region_start[region] = offset;
+        for (uint32_t t = 0; t < num_threads; t++) {
+            uint32_t count = build.counts[t * num_threads + region];
+            build.counts[t * num_threads + region] = offset;
+            offset += count;
+        }
+    }
+    build.region_start[num_threads] = offset;
+
+    _g_hash_table_run_threads(_g_hash_table_build_scatter, build.tasks, sizeof(struct _GHashTableBuildTask), num_threads);
+    _g_hash_table_run_threads(_g_hash_table_build_fill, build.tasks, sizeof(struct _GHashTableBuildTask), num_threads);
+
+    for (uint32_t region = 0; region < num_threads; region++) {
+        hash_table->num_used += build.num_used[region];
+    }
+
+    // only keys near a region boundary end up here
+    for (uint32_t region = 0; region < num_threads; region++) {
+        for (uint32_t k = 0; k < build.num_deferred[region]; k++) {
+            uint32_t i = build.order[build.region_start[region] + k];
+            if (values) {
+                g_hash_table_insert(hash_table, keys[i], values[i]);
+            } else {
+                g_hash_table_add(hash_table, keys[i]);
+            }
+        }
+    }
+
+    free(build.num_deferred);
+    free(build.num_used);
+    free(build.region_start);
+    free(build.counts);
+    free(build.order);
+    free(build.key_hashes);
+    free(build.tasks);
+
+    return hash_table;
+}
+
+uint32_t g_hash_table_size(GHashTable *hash_table)
+{
+    return hash_table->num_used + hash_table->old_num_used;
+}
+
+void* g_hash_table_lookup(GHashTable *hash_table, void *key)
+{
+    if (hash_table->old_ctrl) {
+        _g_hash_table_rehash_step(hash_table, GHASHTABLE_REHASH_STEP);
+    }
+
+    bool found = false;
+    uint32_t position = _g_hash_table_lookup_position(hash_table, key, _g_hash_table_hash(hash_table, key), &found);
+
+    if (!found) {
+        return NULL;
+    }
+
+    return hash_table->values[position];
+}
+
+// Tells a stored NULL value apart from a missing key.
+bool g_hash_table_lookup_extended(GHashTable *hash_table, void *lookup_key, void **orig_key, void **value)
+{
+    if (hash_table->old_ctrl) {
+        _g_hash_table_rehash_step(hash_table, GHASHTABLE_REHASH_STEP);
+    }
+
+    bool found = false;
+    uint32_t position = _g_hash_table_lookup_position(hash_table, lookup_key, _g_hash_table_hash(hash_table, lookup_key), &found);
+
+    if (!found) {
+        return false;
+    }
+
+    if (orig_key) {
+        *orig_key = hash_table->keys[position];
+    }
+
+    if (value) {
+        *value = hash_table->values[position];
+    }
+
+    return true;
+}
+
+bool g_hash_table_contains(GHashTable *hash_table, void *key)
+{
+    return g_hash_table_lookup_extended(hash_table, key, NULL, NULL);
+}
+
+// Looks keys up GHASHTABLE_LOOKUP_BATCH at a time. Every key of a batch is
+// hashed and its control group prefetched first, then the key of the first
+// tag match is prefetched, and only then are the probes resolved, so the
+// cache misses of a batch overlap instead of following each other.
+void g_hash_table_lookup_batch(GHashTable *hash_table, void **keys, uint32_t n, void **out_values)
+{
+    uint32_t hashes[GHASHTABLE_LOOKUP_BATCH];
+
+    if (hash_table->old_ctrl) {
+        _g_hash_table_rehash_step(hash_table, GHASHTABLE_REHASH_STEP);
+    }
+
+    for (uint32_t start = 0; start < n; start += GHASHTABLE_LOOKUP_BATCH) {
+        uint32_t count = n - start < GHASHTABLE_LOOKUP_BATCH ? n - start : GHASHTABLE_LOOKUP_BATCH;
+
+        for (uint32_t i = 0; i < count; i++) {
+            hashes[i] = _g_hash_table_hash(hash_table, keys[start + i]);
+            _g_hash_table_prefetch(&hash_table->ctrl[_g_hash_table_hash_group(hash_table->num_slots, hashes[i]) * GHASHTABLE_GROUP_WIDTH]);
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t group = _g_hash_table_hash_group(hash_table->num_slots, hashes[i]);
+            uint32_t match = _g_hash_table_group_match(&hash_table->ctrl[group * GHASHTABLE_GROUP_WIDTH], _g_hash_table_hash_tag(hashes[i]));
+
+            if (match == 0) {
+                continue;
+            }
+
+            uint32_t position = group * GHASHTABLE_GROUP_WIDTH + _g_hash_table_ctz(match);
+            if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+                position = _g_hash_table_get_index(hash_table, position);
+            }
+            _g_hash_table_prefetch(&hash_table->hashes[position]);
+            _g_hash_table_prefetch(&hash_table->keys[position]);
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            bool found = false;
+            uint32_t position = _g_hash_table_lookup_position(hash_table, keys[start + i], hashes[i], &found);
+            out_values[start + i] = found ? hash_table->values[position] : NULL;
+        }
+    }
+}
+
+// Entries are visited by position: slots of the slot arrays, or entries of an
+// ordered table.
+uint32_t _g_hash_table_num_positions(GHashTable *hash_table)
+{
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        return hash_table->num_entries;
+    }
+
+    return hash_table->num_slots;
+}
+
+bool _g_hash_table_position_is_full(GHashTable *hash_table, uint32_t position)
+{
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        return !_g_hash_table_entry_is_removed(hash_table, position);
+    }
+
+    return _g_hash_table_ctrl_is_full(hash_table->ctrl[position]);
+}
+
+void g_hash_table_foreach(GHashTable *hash_table, GHFunc func, void *user_data)
+{
+    for (uint32_t i = 0; hash_table->old_ctrl && i < hash_table->old_num_slots; i++) {
+        if (_g_hash_table_ctrl_is_full(hash_table->old_ctrl[i])) {
+            func(hash_table->old_keys[i], hash_table->old_values[i], user_data);
+        }
+    }
+
+    for (uint32_t i = 0; i < _g_hash_table_num_positions(hash_table); i++) {
+        if (_g_hash_table_position_is_full(hash_table, i)) {
+            func(hash_table->keys[i], hash_table->values[i], user_data);
+        }
+    }
+}
+
+struct _GHashTableScan {
+    GHashTable *hash_table;
+    GHFunc func;
+    GHReduceFunc reduce_func;
+    void *user_data;
+    uint32_t num_chunks;
+    _Atomic uint32_t next_chunk;
+    // one accumulator per thread, each on its own cache lines
+    char *accumulators;
+    size_t accumulator_stride;
+};
+
+struct _GHashTableScanTask {
+    struct _GHashTableScan *scan;
+    uint32_t thread;
+};
+
+// Threads take chunks of GHASHTABLE_PARALLEL_CHUNK positions until none are
+// left, so a thread that hits a dense part of the table doesn't hold the
+// others up.
+int _g_hash_table_scan(void *data)
+{
+    struct _GHashTableScanTask *task = data;
+    struct _GHashTableScan *scan = task->scan;
+    GHashTable *hash_table = scan->hash_table;
+    uint32_t num_positions = _g_hash_table_num_positions(hash_table);
+    // foreach has no accumulators
+    void *accumulator = scan->accumulators ? scan->accumulators + task->thread * scan->accumulator_stride : NULL;
+
+    for (uint32_t chunk = atomic_fetch_add(&scan->next_chunk, 1); chunk < scan->num_chunks; chunk = atomic_fetch_add(&scan->next_chunk, 1)) {
+        uint32_t start = chunk * GHASHTABLE_PARALLEL_CHUNK;
+        uint32_t end = num_positions - start < GHASHTABLE_PARALLEL_CHUNK ? num_positions : start + GHASHTABLE_PARALLEL_CHUNK;
+
+        for (uint32_t i = start; i < end; i++) {
+            if (!_g_hash_table_position_is_full(hash_table, i)) {
+                continue;
+            }
+
+            if (scan->reduce_func) {
+                scan->reduce_func(hash_table->keys[i], hash_table->values[i], accumulator, scan->user_data);
+            } else {
+                scan->func(hash_table->keys[i], hash_table->values[i], scan->user_data);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void _g_hash_table_scan_parallel(struct _GHashTableScan *scan, uint32_t num_threads, void *accumulator, size_t accumulator_size, GHCombineFunc combine_func)
+{
+    // a pending incremental resize is completed first, like for iterators
+    _g_hash_table_finish_resize(scan->hash_table);
+
+    uint32_t num_positions = _g_hash_table_num_positions(scan->hash_table);
+
+    scan->num_chunks = num_positions / GHASHTABLE_PARALLEL_CHUNK + (num_positions % GHASHTABLE_PARALLEL_CHUNK != 0);
+    atomic_init(&scan->next_chunk, 0);
+
+    if (num_threads > scan->num_chunks) {
+        num_threads = scan->num_chunks;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    // accumulators start out zero-filled, on cache lines of their own
+    char *accumulators = NULL;
+    scan->accumulator_stride = (accumulator_size + 63) & ~(size_t) 63;
+    scan->accumulators = NULL;
+    if (scan->reduce_func) {
+        accumulators = calloc(1, scan->accumulator_stride * num_threads + 64);
+        if (accumulators == NULL) {
+            fprintf(stderr, "FATAL ERROR: _g_hash_table_scan_parallel: Out of memory");
+            exit(1);
+        }
+        scan->accumulators = accumulators + (64 - (uintptr_t) accumulators % 64) % 64;
+    }
+
+    struct _GHashTableScanTask *tasks = malloc(num_threads * sizeof(struct _GHashTableScanTask));
+    if (tasks == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_hash_table_scan_parallel: Out of memory");
+        exit(1);
+    }
+
+    for (uint32_t t = 0; t < num_threads; t++) {
+        tasks[t].scan = scan;
+        tasks[t].thread = t;
+    }
+
+    _g_hash_table_run_threads(_g_hash_table_scan, tasks, sizeof(struct _GHashTableScanTask), num_threads);
+
+    for (uint32_t t = 0; scan->reduce_func && t < num_threads; t++) {
+        combine_func(accumulator, scan->accumulators + t * scan->accumulator_stride, scan->user_data);
+    }
+
+    free(accumulators);
+    free(tasks);
+}
+
+// Calls func for every entry on up to num_threads threads. func may be
+// called concurrently and must not modify the table.
+void g_hash_table_foreach_parallel(GHashTable *hash_table, GHFunc func, void *user_data, uint32_t num_threads)
+{
+    struct _GHashTableScan scan = {
+        .hash_table = hash_table,
+        .func = func,
+        .user_data = user_data,
+    };
+
+    _g_hash_table_scan_parallel(&scan, num_threads, NULL, 0, NULL);
+}
+
+// Reduces every entry on up to num_threads threads. Each thread reduces into
+// its own zero-filled accumulator of accumulator_size bytes, which
+// combine_func then merges into accumulator, in thread order, on the calling
+// thread.
+void g_hash_table_reduce_parallel(GHashTable *hash_table, GHReduceFunc reduce_func, GHCombineFunc combine_func, void *accumulator, size_t accumulator_size, void *user_data, uint32_t num_threads)
+{
+    struct _GHashTableScan scan = {
+        .hash_table = hash_table,
+        .reduce_func = reduce_func,
+        .user_data = user_data,
+    };
+
+    _g_hash_table_scan_parallel(&scan, num_threads, accumulator, accumulator_size, combine_func);
+}
+
+void _g_hash_table_erase_position(GHashTable *hash_table, uint32_t position)
+{
+    if (hash_table->flags & G_HASH_TABLE_ORDERED) {
+        _g_hash_table_erase_entry(hash_table, position);
+        return;
+    }
+
+    hash_table->num_used--;
+
+    if (_g_hash_table_clear_ctrl(hash_table->ctrl, position)) {
+        hash_table->num_deleted++;
+    }
+}
+
+void _g_hash_table_destroy_position(GHashTable *hash_table, uint32_t position)
+{
+    if (hash_table->key_destroy_func) {
+        hash_table->key_destroy_func(hash_table->keys[position]);
+    }
+
+    if (hash_table->value_destroy_func) {
+        hash_table->value_destroy_func(hash_table->values[position]);
+    }
+}
+
+bool g_hash_table_remove(GHashTable *hash_table, void *key)
+{
+    if (hash_table->old_ctrl) {
+        _g_hash_table_rehash_step(hash_table, GHASHTABLE_REHASH_STEP);
+    }
+
+    bool found = false;
+    uint32_t position = _g_hash_table_lookup_position(hash_table, key, _g_hash_table_hash(hash_table, key), &found);
+
+    if (!found) {
+        return false;
+    }
+
+    _g_hash_table_destroy_position(hash_table, position);
+    _g_hash_table_erase_position(hash_table, position);
+    _g_hash_table_maybe_shrink(hash_table);
+
+    return true;
+}
+
+// Removes every entry func returns true for in one pass over the slots. The
+// table is only shrunk once the pass is done.
+uint32_t _g_hash_table_foreach_remove_or_steal(GHashTable *hash_table, GHRFunc func, void *user_data, bool notify)
+{
+    uint32_t removed = 0;
+
+    _g_hash_table_finish_resize(hash_table);
+
+    for (uint32_t i = 0; i < _g_hash_table_num_positions(hash_table); i++) {
+        if (!_g_hash_table_position_is_full(hash_table, i) || !func(hash_table->keys[i], hash_table->values[i], user_data)) {
+            continue;
+        }
+
+        if (notify) {
+            _g_hash_table_destroy_position(hash_table, i);
+        }
+
+        _g_hash_table_erase_position(hash_table, i);
+        removed++;
+    }
+
+    _g_hash_table_maybe_shrink(hash_table);
+
+    return removed;
+}
+
+uint32_t g_hash_table_foreach_remove(GHashTable *hash_table, GHRFunc func, void *user_data)
+{
+    return _g_hash_table_foreach_remove_or_steal(hash_table, func, user_data, true);
+}
+
+uint32_t g_hash_table_foreach_steal(GHashTable *hash_table, GHRFunc func, void *user_data)
+{
+    return _g_hash_table_foreach_remove_or_steal(hash_table, func, user_data, false);
+}
+
+// Iterators walk a single slot array, so a pending incremental resize is
+// completed first. Removing through the iterator never resizes the table.
+void g_hash_table_iter_init(GHashTableIter *iter, GHashTable *hash_table)
+{
+    _g_hash_table_finish_resize(hash_table);
+
+    iter->hash_table = hash_table;
+    iter->position = 0;
+}
+
+bool g_hash_table_iter_next(GHashTableIter *iter, void **key, void **value)
+{
+    GHashTable *hash_table = iter->hash_table;
+
+    while (iter->position < _g_hash_table_num_positions(hash_table)) {
+        uint32_t i = iter->position++;
+
+        if (_g_hash_table_position_is_full(hash_table, i)) {
+            if (key) {
+                *key = hash_table->keys[i];
+            }
+
+            if (value) {
+                *value = hash_table->values[i];
+            }
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t _g_hash_table_iter_position(GHashTableIter *iter)
+{
+    uint32_t i = iter->position - 1;
+
+    if (iter->position == 0 || i >= _g_hash_table_num_positions(iter->hash_table) || !_g_hash_table_position_is_full(iter->hash_table, i)) {
+        fprintf(stderr, "BUG: _g_hash_table_iter_position: Iterator is not positioned on an entry.");
+        abort();
+    }
+
+    return i;
+}
+
+void g_hash_table_iter_remove(GHashTableIter *iter)
+{
+    uint32_t position = _g_hash_table_iter_position(iter);
+
+    _g_hash_table_destroy_position(iter->hash_table, position);
+    _g_hash_table_erase_position(iter->hash_table, position);
+}
+
+void g_hash_table_iter_replace(GHashTableIter *iter, void *value)
+{
+    GHashTable *hash_table = iter->hash_table;
+    uint32_t position = _g_hash_table_iter_position(iter);
+
+    if (hash_table->value_destroy_func && hash_table->values[position] != value) {
+        hash_table->value_destroy_func(hash_table->values[position]);
+    }
+
+    _g_hash_table_set_value(hash_table, position, value);
+}
+
+void g_hash_table_iter_steal(GHashTableIter *iter)
+{
+    _g_hash_table_erase_position(iter->hash_table, _g_hash_table_iter_position(iter));
+}
+
+void g_hash_table_destroy(GHashTable *hash_table)
+{
+    if (hash_table) {
+        if (hash_table->key_destroy_func || hash_table->value_destroy_func) {
+            _g_hash_table_finish_resize(hash_table);
+
+            for (uint32_t i = 0; i < _g_hash_table_num_positions(hash_table); i++) {
+                if (_g_hash_table_position_is_full(hash_table, i)) {
+                    _g_hash_table_destroy_position(hash_table, i);
+                }
+            }
+        }
+
+        free(hash_table->old_ctrl);
+        _g_hash_table_free_arrays(hash_table->old_keys, hash_table->old_values, hash_table->old_hashes);
+        free(hash_table->ctrl);
+        _g_hash_table_free_arrays(hash_table->keys, hash_table->values, hash_table->hashes);
+        free(hash_table->indices);
         free(hash_table);
     }
 }
@@ -0,0 +1,134 @@
+#pragma once
+// Internals shared by GHashTable and the tables built on top of its layout.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+#include <miniglib/ghashtable.h>
+
+#if (defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define GHASHTABLE_USE_SSE2
+#elif ((defined __ARM_NEON && defined __aarch64__) || defined _M_ARM64)
+#include <arm_neon.h>
+#define GHASHTABLE_USE_NEON
+#endif
+
+#if (defined _MSC_VER && !defined __clang__)
+#include <intrin.h>
+#endif
+
+static inline uint32_t _g_hash_table_ctz(uint32_t x)
+{
+#if (defined _MSC_VER && !defined __clang__)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (uint32_t) index;
+#else
+    return (uint32_t) __builtin_ctz(x);
+#endif
+}
+
+static inline uint32_t _g_hash_table_popcount(uint32_t x)
+{
+#if (defined _MSC_VER && !defined __clang__)
+    return (uint32_t) __popcnt(x);
+#else
+    return (uint32_t) __builtin_popcount(x);
+#endif
+}
+
+static inline void _g_hash_table_prefetch(const void *address)
+{
+#if (defined __GNUC__ || defined __clang__)
+    __builtin_prefetch(address);
+#elif (defined GHASHTABLE_USE_SSE2)
+    _mm_prefetch((const char*) address, _MM_HINT_T0);
+#else
+    (void) address;
+#endif
+}
+
+// Returns a bitmask with bit i set for every control byte in the group equal
+// to tag.
+static inline uint32_t _g_hash_table_group_match(const uint8_t *group, uint8_t tag)
+{
+#if (defined GHASHTABLE_USE_SSE2)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) tag)));
+#elif (defined GHASHTABLE_USE_NEON)
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t eq = vceqq_u8(vld1q_u8(group), vdupq_n_u8(tag));
+    uint8x16_t masked = vandq_u8(eq, vld1q_u8(bits));
+    return (uint32_t) vaddv_u8(vget_low_u8(masked)) | ((uint32_t) vaddv_u8(vget_high_u8(masked)) << 8);
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < GHASHTABLE_GROUP_WIDTH; i++) {
+        if (group[i] == tag) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static inline uint32_t _g_hash_table_group_match_empty(const uint8_t *group)
+{
+    return _g_hash_table_group_match(group, GHASHTABLE_CTRL_EMPTY);
+}
+
+// Empty and deleted control bytes are the only ones with the high bit set.
+static inline uint32_t _g_hash_table_group_match_free(const uint8_t *group)
+{
+#if (defined GHASHTABLE_USE_SSE2)
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < GHASHTABLE_GROUP_WIDTH; i++) {
+        if (group[i] & 0x80) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static inline bool _g_hash_table_ctrl_is_full(uint8_t ctrl)
+{
+    return (ctrl & 0x80) == 0;
+}
+
+static inline uint8_t _g_hash_table_hash_tag(uint32_t hash)
+{
+    return (uint8_t) (hash & 0x7F);
+}
+
+static inline uint32_t _g_hash_fmix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static inline uint32_t _g_hash_table_hash_group(uint32_t num_slots, uint32_t hash)
+{
+    return (hash >> 7) & (num_slots / GHASHTABLE_GROUP_WIDTH - 1);
+}
+
+uint64_t _g_hash_mix(uint64_t a, uint64_t b);
+uint64_t _g_hash_bytes(const void *data, size_t len, uint64_t seed);
+uint64_t _g_hash_seed(void);
+
+// Runs func once per task on num_threads threads, the first task on the
+// calling thread. GArray's parallel sort runs on it too.
+void _g_hash_table_run_threads(thrd_start_t func, void *tasks, size_t task_size, uint32_t num_threads);
+
+// Epochs shared by GConcurrentHashTable and GPersistentHashTable, readers
+// enter them with g_concurrent_hash_table_pin/unpin.
+uint64_t _g_epoch_try_advance(void);
+void _g_epoch_synchronize(void);
@@ -0,0 +1,378 @@
+#include <miniglib/ghashtablesnapshot.h>
+#include "ghashtableprivate.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct _GHashTableSnapshotWriter {
+    FILE *file;
+    // the data checksum so far, seeded with the header seed
+    uint64_t checksum;
+    size_t fill;
+    char *block;
+};
+
+uint64_t _g_hash_table_snapshot_align(uint64_t size)
+{
+    return (size + 7) & ~(uint64_t) 7;
+}
+
+uint64_t _g_hash_table_snapshot_entry_size(uint32_t value_size, size_t key_len)
+{
+    return _g_hash_table_snapshot_align(value_size) + _g_hash_table_snapshot_align(sizeof(uint32_t) + key_len + 1);
+}
+
+uint64_t _g_hash_table_snapshot_header_checksum(const struct GHashTableSnapshotHeader *header)
+{
+    return _g_hash_bytes(header, offsetof(struct GHashTableSnapshotHeader, header_checksum), header->seed);
+}
+
+bool _g_hash_table_snapshot_flush(struct _GHashTableSnapshotWriter *writer)
+{
+    if (writer->fill == 0) {
+        return true;
+    }
+
+    writer->checksum = _g_hash_bytes(writer->block, writer->fill, writer->checksum);
+
+    bool written = fwrite(writer->block, 1, writer->fill, writer->file) == writer->fill;
+    writer->fill = 0;
+
+    return written;
+}
+
+bool _g_hash_table_snapshot_write_bytes(struct _GHashTableSnapshotWriter *writer, const void *data, uint64_t len)
+{
+    while (len) {
+        size_t n = GHASHTABLESNAPSHOT_BLOCK_SIZE - writer->fill;
+        if (n > len) {
+            n = (size_t) len;
+        }
+
+        if (data) {
+            memcpy(writer->block + writer->fill, data, n);
+            data = (const char*) data + n;
+        } else {
+            memset(writer->block + writer->fill, 0, n);
+        }
+        writer->fill += n;
+        len -= n;
+
+        if (writer->fill == GHASHTABLESNAPSHOT_BLOCK_SIZE && !_g_hash_table_snapshot_flush(writer)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool _g_hash_table_snapshot_write_entry(struct _GHashTableSnapshotWriter *writer, const char *key, const void *value, uint32_t value_size)
+{
+    uint32_t key_len = (uint32_t) strlen(key);
+
+    // NULL data writes zeros, which also pads the value and the key
+    return _g_hash_table_snapshot_write_bytes(writer, value, value_size)
+        && _g_hash_table_snapshot_write_bytes(writer, NULL, _g_hash_table_snapshot_align(value_size) - value_size)
+        && _g_hash_table_snapshot_write_bytes(writer, &key_len, sizeof(key_len))
+        && _g_hash_table_snapshot_write_bytes(writer, key, key_len)
+        && _g_hash_table_snapshot_write_bytes(writer, NULL, _g_hash_table_snapshot_align(sizeof(uint32_t) + key_len + 1) - sizeof(uint32_t) - key_len);
+}
+
+bool g_hash_table_snapshot_write(GHashTable *hash_table, const char *path, uint32_t value_size)
+{
+    struct GHashTableSnapshotHeader header = {0};
+    GHashTableIter iter;
+    void *key, *value;
+
+    if (hash_table == NULL || path == NULL) {
+        return false;
+    }
+
+    memcpy(header.magic, GHASHTABLESNAPSHOT_MAGIC, sizeof(GHASHTABLESNAPSHOT_MAGIC));
+    header.version = GHASHTABLESNAPSHOT_VERSION;
+    header.byte_order = GHASHTABLESNAPSHOT_BYTE_ORDER;
+    header.seed = _g_hash_mix(_g_hash_seed(), (uint64_t) (uintptr_t) hash_table);
+    header.num_entries = g_hash_table_size(hash_table);
+    header.num_slots = GHASHTABLESNAPSHOT_MIN_SLOTS;
+    while (header.num_slots < header.num_entries * 2) {
+        header.num_slots *= 2;
+    }
+    header.value_size = value_size;
+    header.slots_offset = sizeof(struct GHashTableSnapshotHeader);
+    header.entries_offset = header.slots_offset + header.num_slots * sizeof(struct GHashTableSnapshotSlot);
+
+    struct GHashTableSnapshotSlot *slots = calloc(header.num_slots, sizeof(struct GHashTableSnapshotSlot));
+    if (slots == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_hash_table_snapshot_write: Out of memory");
+        exit(1);
+    }
+
+    // Lay the entries out in iteration order and index them first, so the
+    // file can be written front to back. The table isn't modified in
+    // between, so the second pass visits the entries in the same order.
+    uint64_t offset = header.entries_offset;
+    g_hash_table_iter_init(&iter, hash_table);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        size_t key_len = strlen(key);
+        if (key_len > UINT32_MAX - sizeof(uint32_t) - 1) {
+            free(slots);
+            return false;
+        }
+
+        uint64_t hash = _g_hash_bytes(key, key_len, header.seed);
+        uint64_t slot = hash & (header.num_slots - 1);
+        while (slots[slot].entry_offset) {
+            slot = (slot + 1) & (header.num_slots - 1);
+        }
+
+        slots[slot].hash = hash;
+        slots[slot].entry_offset = offset;
+        offset += _g_hash_table_snapshot_entry_size(value_size, key_len);
+    }
+    header.file_size = offset;
+
+    struct _GHashTableSnapshotWriter writer = {0};
+    writer.checksum = header.seed;
+    writer.block = malloc(GHASHTABLESNAPSHOT_BLOCK_SIZE);
+    if (writer.block == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_hash_table_snapshot_write: Out of memory");
+        exit(1);
+    }
+
+    writer.file = fopen(path, "wb");
+    if (writer.file == NULL) {
+        free(writer.block);
+        free(slots);
+        return false;
+    }
+
+    // the header is written last, once the checksum is known
+    bool written = fwrite(&header, sizeof(header), 1, writer.file) == 1
+        && _g_hash_table_snapshot_write_bytes(&writer, slots, header.num_slots * sizeof(struct GHashTableSnapshotSlot));
+
+    g_hash_table_iter_init(&iter, hash_table);
+    while (written && g_hash_table_iter_next(&iter, &key, &value)) {
+        written = _g_hash_table_snapshot_write_entry(&writer, key, value, value_size);
+    }
+
+    written = written && _g_hash_table_snapshot_flush(&writer);
+
+    header.data_checksum = writer.checksum;
+    header.header_checksum = _g_hash_table_snapshot_header_checksum(&header);
+
+    written = written && fseek(writer.file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, writer.file) == 1;
+    written = fclose(writer.file) == 0 && written;
+
+    if (!written) {
+        remove(path);
+    }
+
+    free(writer.block);
+    free(slots);
+
+    return written;
+}
+
+void _g_hash_table_snapshot_unmap(const char *data, uint64_t size)
+{
+#if (defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+    (void) size;
+    UnmapViewOfFile(data);
+#else
+    munmap((void*) data, (size_t) size);
+#endif
+}
+
+// Maps the whole file read-only. Returns NULL for empty or unreadable files.
+const char *_g_hash_table_snapshot_map(const char *path, uint64_t *ret_size)
+{
+#if (defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        return NULL;
+    }
+
+    // the view keeps the mapping alive
+    const char *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    *ret_size = (uint64_t) size.QuadPart;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *ret_size = (uint64_t) st.st_size;
+    return data;
+#endif
+}
+
+bool _g_hash_table_snapshot_header_is_valid(const struct GHashTableSnapshotHeader *header, uint64_t size)
+{
+    if (size < sizeof(struct GHashTableSnapshotHeader)) {
+        return false;
+    }
+
+    if (memcmp(header->magic, GHASHTABLESNAPSHOT_MAGIC, sizeof(GHASHTABLESNAPSHOT_MAGIC)) != 0
+            || header->version != GHASHTABLESNAPSHOT_VERSION
+            || header->byte_order != GHASHTABLESNAPSHOT_BYTE_ORDER
+            || header->header_checksum != _g_hash_table_snapshot_header_checksum(header)) {
+        return false;
+    }
+
+    // the layout checks keep lookups inside the mapping even if the data
+    // checksum was never verified
+    uint64_t max_slots = size / sizeof(struct GHashTableSnapshotSlot);
+
+    return header->file_size == size
+        && header->num_slots >= GHASHTABLESNAPSHOT_MIN_SLOTS
+        && header->num_slots <= max_slots
+        && (header->num_slots & (header->num_slots - 1)) == 0
+        && header->num_entries <= header->num_slots / 2
+        && header->slots_offset == sizeof(struct GHashTableSnapshotHeader)
+        && header->entries_offset == header->slots_offset + header->num_slots * sizeof(struct GHashTableSnapshotSlot)
+        && header->entries_offset <= size;
+}
+
+GHashTableSnapshot *g_hash_table_snapshot_open(const char *path)
+{
+    uint64_t size = 0;
+
+    if (path == NULL) {
+        return NULL;
+    }
+
+    const char *data = _g_hash_table_snapshot_map(path, &size);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    if (!_g_hash_table_snapshot_header_is_valid((const struct GHashTableSnapshotHeader*) data, size)) {
+        _g_hash_table_snapshot_unmap(data, size);
+        return NULL;
+    }
+
+    GHashTableSnapshot *snapshot = malloc(sizeof(GHashTableSnapshot));
+    if (snapshot == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_hash_table_snapshot_open: Out of memory");
+        exit(1);
+    }
+
+    snapshot->data = data;
+    snapshot->size = size;
+    snapshot->header = (const struct GHashTableSnapshotHeader*) data;
+    snapshot->slots = (const struct GHashTableSnapshotSlot*) (data + snapshot->header->slots_offset);
+
+    return snapshot;
+}
+
+bool g_hash_table_snapshot_verify(GHashTableSnapshot *snapshot)
+{
+    uint64_t checksum = snapshot->header->seed;
+
+    for (uint64_t offset = sizeof(struct GHashTableSnapshotHeader); offset < snapshot->size; offset += GHASHTABLESNAPSHOT_BLOCK_SIZE) {
+        uint64_t len = snapshot->size - offset;
+        if (len > GHASHTABLESNAPSHOT_BLOCK_SIZE) {
+            len = GHASHTABLESNAPSHOT_BLOCK_SIZE;
+        }
+
+        checksum = _g_hash_bytes(snapshot->data + offset, (size_t) len, checksum);
+    }
+
+    return checksum == snapshot->header->data_checksum;
+}
+
+uint64_t g_hash_table_snapshot_size(GHashTableSnapshot *snapshot)
+{
+    return snapshot->header->num_entries;
+}
+
+uint32_t g_hash_table_snapshot_value_size(GHashTableSnapshot *snapshot)
+{
+    return snapshot->header->value_size;
+}
+
+const void *g_hash_table_snapshot_lookup(GHashTableSnapshot *snapshot, const char *key)
+{
+    return g_hash_table_snapshot_lookup_len(snapshot, key, strlen(key));
+}
+
+const void *g_hash_table_snapshot_lookup_len(GHashTableSnapshot *snapshot, const char *key, size_t len)
+{
+    const struct GHashTableSnapshotHeader *header = snapshot->header;
+    uint64_t key_offset = _g_hash_table_snapshot_align(header->value_size);
+    uint64_t hash = _g_hash_bytes(key, len, header->seed);
+    uint64_t mask = header->num_slots - 1;
+    uint64_t slot = hash & mask;
+
+    // the slot array is at most half full, but a corrupt one might not be
+    for (uint64_t i = 0; i < header->num_slots; i++) {
+        const struct GHashTableSnapshotSlot *s = &snapshot->slots[slot];
+
+        if (s->entry_offset == 0) {
+            return NULL;
+        }
+
+        if (s->hash == hash
+                && s->entry_offset >= header->entries_offset
+                && s->entry_offset < snapshot->size
+                && snapshot->size - s->entry_offset > key_offset + sizeof(uint32_t) + len) {
+            const char *entry = snapshot->data + s->entry_offset;
+            uint32_t key_len;
+
+            memcpy(&key_len, entry + key_offset, sizeof(key_len));
+            if (key_len == len && memcmp(entry + key_offset + sizeof(uint32_t), key, len) == 0) {
+                return entry;
+            }
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+void g_hash_table_snapshot_close(GHashTableSnapshot *snapshot)
+{
+    if (snapshot) {
+        _g_hash_table_snapshot_unmap(snapshot->data, snapshot->size);
+        free(snapshot);
+    }
+}
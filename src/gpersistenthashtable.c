@@ -0,0 +1,605 @@
+#include <miniglib/gpersistenthashtable.h>
+#include <miniglib/gconcurrenthashtable.h>
+#include "ghashtableprivate.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Node functions take ownership of the references they are passed and return
+// a new reference, except for the node being updated, which stays owned by
+// the version it belongs to.
+
+void _g_persistent_hash_table_node_ref(struct GPersistentHashTableNode *node)
+{
+    atomic_fetch_add_explicit(&node->ref_count, 1, memory_order_relaxed);
+}
+
+// The key and the memory of its owner go with the last leaf sharing it.
+void _g_persistent_hash_table_key_unref(GPersistentHashTable *hash_table, struct GPersistentHashTableLeaf *owner)
+{
+    if (atomic_fetch_sub_explicit(&owner->key_ref_count, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    if (hash_table->key_destroy_func) {
+        hash_table->key_destroy_func(owner->key);
+    }
+
+    free(owner);
+}
+
+void _g_persistent_hash_table_node_unref(GPersistentHashTable *hash_table, struct GPersistentHashTableNode *node)
+{
+    if (atomic_fetch_sub_explicit(&node->ref_count, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    switch (node->kind) {
+        case G_PERSISTENT_HASH_TABLE_LEAF: {
+            struct GPersistentHashTableLeaf *leaf = (struct GPersistentHashTableLeaf*) node;
+            struct GPersistentHashTableLeaf *owner = leaf->key_owner;
+
+            if (hash_table->value_destroy_func) {
+                hash_table->value_destroy_func(leaf->value);
+            }
+
+            _g_persistent_hash_table_key_unref(hash_table, owner);
+            if (owner != leaf) {
+                free(leaf);
+            }
+            return;
+        }
+        case G_PERSISTENT_HASH_TABLE_BRANCH: {
+            struct GPersistentHashTableBranch *branch = (struct GPersistentHashTableBranch*) node;
+            uint32_t count = _g_hash_table_popcount(branch->bitmap);
+
+            for (uint32_t i = 0; i < count; i++) {
+                _g_persistent_hash_table_node_unref(hash_table, branch->children[i]);
+            }
+            break;
+        }
+        case G_PERSISTENT_HASH_TABLE_COLLISION: {
+            struct GPersistentHashTableCollision *collision = (struct GPersistentHashTableCollision*) node;
+
+            for (uint32_t i = 0; i < collision->num_leaves; i++) {
+                _g_persistent_hash_table_node_unref(hash_table, &collision->leaves[i]->node);
+            }
+            break;
+        }
+    }
+
+    free(node);
+}
+
+struct GPersistentHashTableLeaf *_g_persistent_hash_table_leaf_new(uint32_t hash, void *key, void *value)
+{
+    struct GPersistentHashTableLeaf *leaf = malloc(sizeof(struct GPersistentHashTableLeaf));
+    if (leaf == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_persistent_hash_table_leaf_new: Out of memory");
+        exit(1);
+    }
+
+    atomic_init(&leaf->node.ref_count, 1);
+    leaf->node.kind = G_PERSISTENT_HASH_TABLE_LEAF;
+    leaf->hash = hash;
+    leaf->key = key;
+    leaf->value = value;
+    leaf->key_owner = leaf;
+    atomic_init(&leaf->key_ref_count, 1);
+
+    return leaf;
+}
+
+struct GPersistentHashTableBranch *_g_persistent_hash_table_branch_new(uint32_t bitmap)
+{
+    uint32_t count = _g_hash_table_popcount(bitmap);
+
+    struct GPersistentHashTableBranch *branch = malloc(sizeof(struct GPersistentHashTableBranch) + count * sizeof(struct GPersistentHashTableNode*));
+    if (branch == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_persistent_hash_table_branch_new: Out of memory");
+        exit(1);
+    }
+
+    atomic_init(&branch->node.ref_count, 1);
+    branch->node.kind = G_PERSISTENT_HASH_TABLE_BRANCH;
+    branch->bitmap = bitmap;
+
+    return branch;
+}
+
+struct GPersistentHashTableCollision *_g_persistent_hash_table_collision_new(uint32_t hash, uint32_t num_leaves)
+{
+    struct GPersistentHashTableCollision *collision = malloc(sizeof(struct GPersistentHashTableCollision) + num_leaves * sizeof(struct GPersistentHashTableLeaf*));
+    if (collision == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_persistent_hash_table_collision_new: Out of memory");
+        exit(1);
+    }
+
+    atomic_init(&collision->node.ref_count, 1);
+    collision->node.kind = G_PERSISTENT_HASH_TABLE_COLLISION;
+    collision->hash = hash;
+    collision->num_leaves = num_leaves;
+
+    return collision;
+}
+
+uint32_t _g_persistent_hash_table_index(uint32_t hash, uint32_t shift)
+{
+    return (hash >> shift) & (GPERSISTENTHASHTABLE_BRANCHING - 1);
+}
+
+// Builds the branches that separate two nodes with different hashes. They
+// always differ within 32 bits, so shift never runs past the hash.
+struct GPersistentHashTableNode *_g_persistent_hash_table_merge(struct GPersistentHashTableNode *a, uint32_t hash_a, struct GPersistentHashTableNode *b, uint32_t hash_b, uint32_t shift)
+{
+    uint32_t index_a = _g_persistent_hash_table_index(hash_a, shift);
+    uint32_t index_b = _g_persistent_hash_table_index(hash_b, shift);
+    struct GPersistentHashTableBranch *branch;
+
+    if (index_a == index_b) {
+        branch = _g_persistent_hash_table_branch_new((uint32_t) 1 << index_a);
+        branch->children[0] = _g_persistent_hash_table_merge(a, hash_a, b, hash_b, shift + GPERSISTENTHASHTABLE_BITS);
+    } else {
+        branch = _g_persistent_hash_table_branch_new(((uint32_t) 1 << index_a) | ((uint32_t) 1 << index_b));
+        branch->children[index_a > index_b] = a;
+        branch->children[index_a < index_b] = b;
+    }
+
+    return &branch->node;
+}
+
+// The new leaf of a replaced key takes over the stored key and shares it
+// with the old leaf.
+void _g_persistent_hash_table_replace_key(GPersistentHashTable *hash_table, struct GPersistentHashTableLeaf *leaf, struct GPersistentHashTableLeaf *old)
+{
+    if (leaf->key != old->key && hash_table->key_destroy_func) {
+        hash_table->key_destroy_func(leaf->key);
+    }
+
+    atomic_fetch_add_explicit(&old->key_owner->key_ref_count, 1, memory_order_relaxed);
+    leaf->key = old->key;
+    leaf->key_owner = old->key_owner;
+}
+
+struct GPersistentHashTableNode *_g_persistent_hash_table_insert_node(GPersistentHashTable *hash_table, struct GPersistentHashTableNode *node, uint32_t shift, struct GPersistentHashTableLeaf *leaf, bool *ret_added)
+{
+    if (node == NULL) {
+        *ret_added = true;
+        return &leaf->node;
+    }
+
+    switch (node->kind) {
+        case G_PERSISTENT_HASH_TABLE_LEAF: {
+            struct GPersistentHashTableLeaf *old = (struct GPersistentHashTableLeaf*) node;
+
+            if (old->hash == leaf->hash && hash_table->key_equal_func(leaf->key, old->key)) {
+                *ret_added = false;
+                _g_persistent_hash_table_replace_key(hash_table, leaf, old);
+                return &leaf->node;
+            }
+
+            *ret_added = true;
+            _g_persistent_hash_table_node_ref(node);
+
+            if (old->hash == leaf->hash) {
+                struct GPersistentHashTableCollision *collision = _g_persistent_hash_table_collision_new(leaf->hash, 2);
+                collision->leaves[0] = old;
+                collision->leaves[1] = leaf;
+                return &collision->node;
+            }
+
+            return _g_persistent_hash_table_merge(node, old->hash, &leaf->node, leaf->hash, shift);
+        }
+        case G_PERSISTENT_HASH_TABLE_BRANCH: {
+            struct GPersistentHashTableBranch *branch = (struct GPersistentHashTableBranch*) node;
+            uint32_t bit = (uint32_t) 1 << _g_persistent_hash_table_index(leaf->hash, shift);
+            uint32_t pos = _g_hash_table_popcount(branch->bitmap & (bit - 1));
+            uint32_t count = _g_hash_table_popcount(branch->bitmap);
+            struct GPersistentHashTableBranch *copy;
+
+            if (branch->bitmap & bit) {
+                copy = _g_persistent_hash_table_branch_new(branch->bitmap);
+
+                for (uint32_t i = 0; i < count; i++) {
+                    if (i != pos) {
+                        _g_persistent_hash_table_node_ref(branch->children[i]);
+                        copy->children[i] = branch->children[i];
+                    }
+                }
+
+                copy->children[pos] = _g_persistent_hash_table_insert_node(hash_table, branch->children[pos], shift + GPERSISTENTHASHTABLE_BITS, leaf, ret_added);
+            } else {
+                *ret_added = true;
+                copy = _g_persistent_hash_table_branch_new(branch->bitmap | bit);
+
+                for (uint32_t i = 0; i < count; i++) {
+                    _g_persistent_hash_table_node_ref(branch->children[i]);
+                    copy->children[i + (i >= pos)] = branch->children[i];
+                }
+
+                copy->children[pos] = &leaf->node;
+            }
+
+            return &copy->node;
+        }
+        case G_PERSISTENT_HASH_TABLE_COLLISION: {
+            struct GPersistentHashTableCollision *collision = (struct GPersistentHashTableCollision*) node;
+
+            if (collision->hash != leaf->hash) {
+                *ret_added = true;
+                _g_persistent_hash_table_node_ref(node);
+                return _g_persistent_hash_table_merge(node, collision->hash, &leaf->node, leaf->hash, shift);
+            }
+
+            uint32_t pos = collision->num_leaves;
+
+            for (uint32_t i = 0; i < collision->num_leaves; i++) {
+                if (hash_table->key_equal_func(leaf->key, collision->leaves[i]->key)) {
+                    pos = i;
+                    break;
+                }
+            }
+
+            *ret_added = pos == collision->num_leaves;
+
+            struct GPersistentHashTableCollision *copy = _g_persistent_hash_table_collision_new(collision->hash, collision->num_leaves + *ret_added);
+
+            for (uint32_t i = 0; i < collision->num_leaves; i++) {
+                if (i != pos) {
+                    _g_persistent_hash_table_node_ref(&collision->leaves[i]->node);
+                    copy->leaves[i] = collision->leaves[i];
+                }
+            }
+
+            if (!*ret_added) {
+                _g_persistent_hash_table_replace_key(hash_table, leaf, collision->leaves[pos]);
+            }
+            copy->leaves[pos] = leaf;
+
+            return &copy->node;
+        }
+    }
+
+    return NULL;
+}
+
+// The key must be present. Returns NULL if nothing is left of the node; a
+// branch left with a single leaf or collision node is replaced by it.
+struct GPersistentHashTableNode *_g_persistent_hash_table_remove_node(GPersistentHashTable *hash_table, struct GPersistentHashTableNode *node, uint32_t shift, uint32_t hash, void *key)
+{
+    switch (node->kind) {
+        case G_PERSISTENT_HASH_TABLE_LEAF:
+            return NULL;
+        case G_PERSISTENT_HASH_TABLE_BRANCH: {
+            struct GPersistentHashTableBranch *branch = (struct GPersistentHashTableBranch*) node;
+            uint32_t bit = (uint32_t) 1 << _g_persistent_hash_table_index(hash, shift);
+            uint32_t pos = _g_hash_table_popcount(branch->bitmap & (bit - 1));
+            uint32_t count = _g_hash_table_popcount(branch->bitmap);
+            struct GPersistentHashTableNode *child = _g_persistent_hash_table_remove_node(hash_table, branch->children[pos], shift + GPERSISTENTHASHTABLE_BITS, hash, key);
+            struct GPersistentHashTableBranch *copy;
+
+            if (child == NULL) {
+                if (count == 1) {
+                    return NULL;
+                }
+
+                if (count == 2 && branch->children[pos ^ 1]->kind != G_PERSISTENT_HASH_TABLE_BRANCH) {
+                    _g_persistent_hash_table_node_ref(branch->children[pos ^ 1]);
+                    return branch->children[pos ^ 1];
+                }
+
+                copy = _g_persistent_hash_table_branch_new(branch->bitmap & ~bit);
+
+                for (uint32_t i = 0; i < count; i++) {
+                    if (i != pos) {
+                        _g_persistent_hash_table_node_ref(branch->children[i]);
+                        copy->children[i - (i > pos)] = branch->children[i];
+                    }
+                }
+            } else {
+                if (count == 1 && child->kind != G_PERSISTENT_HASH_TABLE_BRANCH) {
+                    return child;
+                }
+
+                copy = _g_persistent_hash_table_branch_new(branch->bitmap);
+
+                for (uint32_t i = 0; i < count; i++) {
+                    if (i != pos) {
+                        _g_persistent_hash_table_node_ref(branch->children[i]);
+                        copy->children[i] = branch->children[i];
+                    }
+                }
+
+                copy->children[pos] = child;
+            }
+
+            return &copy->node;
+        }
+        case G_PERSISTENT_HASH_TABLE_COLLISION: {
+            struct GPersistentHashTableCollision *collision = (struct GPersistentHashTableCollision*) node;
+            uint32_t pos = 0;
+
+            while (!hash_table->key_equal_func(key, collision->leaves[pos]->key)) {
+                pos++;
+            }
+
+            if (collision->num_leaves == 2) {
+                _g_persistent_hash_table_node_ref(&collision->leaves[pos ^ 1]->node);
+                return &collision->leaves[pos ^ 1]->node;
+            }
+
+            struct GPersistentHashTableCollision *copy = _g_persistent_hash_table_collision_new(collision->hash, collision->num_leaves - 1);
+
+            for (uint32_t i = 0; i < collision->num_leaves; i++) {
+                if (i != pos) {
+                    _g_persistent_hash_table_node_ref(&collision->leaves[i]->node);
+                    copy->leaves[i - (i > pos)] = collision->leaves[i];
+                }
+            }
+
+            return &copy->node;
+        }
+    }
+
+    return NULL;
+}
+
+struct GPersistentHashTableLeaf *_g_persistent_hash_table_find(GPersistentHashTable *hash_table, void *key)
+{
+    uint32_t hash = _g_hash_fmix32(hash_table->hash_func(key) ^ hash_table->seed);
+    struct GPersistentHashTableNode *node = hash_table->root;
+
+    for (uint32_t shift = 0; node; shift += GPERSISTENTHASHTABLE_BITS) {
+        switch (node->kind) {
+            case G_PERSISTENT_HASH_TABLE_LEAF: {
+                struct GPersistentHashTableLeaf *leaf = (struct GPersistentHashTableLeaf*) node;
+
+                if (leaf->hash == hash && hash_table->key_equal_func(key, leaf->key)) {
+                    return leaf;
+                }
+                return NULL;
+            }
+            case G_PERSISTENT_HASH_TABLE_BRANCH: {
+                struct GPersistentHashTableBranch *branch = (struct GPersistentHashTableBranch*) node;
+                uint32_t bit = (uint32_t) 1 << _g_persistent_hash_table_index(hash, shift);
+
+                if (!(branch->bitmap & bit)) {
+                    return NULL;
+                }
+
+                node = branch->children[_g_hash_table_popcount(branch->bitmap & (bit - 1))];
+                break;
+            }
+            case G_PERSISTENT_HASH_TABLE_COLLISION: {
+                struct GPersistentHashTableCollision *collision = (struct GPersistentHashTableCollision*) node;
+
+                if (collision->hash != hash) {
+                    return NULL;
+                }
+
+                for (uint32_t i = 0; i < collision->num_leaves; i++) {
+                    if (hash_table->key_equal_func(key, collision->leaves[i]->key)) {
+                        return collision->leaves[i];
+                    }
+                }
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+GPersistentHashTable *_g_persistent_hash_table_new_version(GPersistentHashTable *hash_table, struct GPersistentHashTableNode *root, uint32_t size)
+{
+    GPersistentHashTable *version = malloc(sizeof(GPersistentHashTable));
+    if (version == NULL) {
+        fprintf(stderr, "FATAL ERROR: _g_persistent_hash_table_new_version: Out of memory");
+        exit(1);
+    }
+
+    atomic_init(&version->ref_count, 1);
+    version->size = size;
+    version->seed = hash_table->seed;
+    version->hash_func = hash_table->hash_func;
+    version->key_equal_func = hash_table->key_equal_func;
+    version->key_destroy_func = hash_table->key_destroy_func;
+    version->value_destroy_func = hash_table->value_destroy_func;
+    version->root = root;
+
+    return version;
+}
+
+GPersistentHashTable *g_persistent_hash_table_new(GHashFunc hash_func, GEqualFunc key_equal_func)
+{
+    return g_persistent_hash_table_new_full(hash_func, key_equal_func, NULL, NULL);
+}
+
+GPersistentHashTable *g_persistent_hash_table_new_full(GHashFunc hash_func, GEqualFunc key_equal_func, GDestroyNotify key_destroy_func, GDestroyNotify value_destroy_func)
+{
+    if (hash_func == NULL) {
+        return NULL;
+    }
+
+    if (key_equal_func == NULL) {
+        return NULL;
+    }
+
+    GPersistentHashTable *hash_table = malloc(sizeof(GPersistentHashTable));
+    if (hash_table == NULL) {
+        fprintf(stderr, "FATAL ERROR: g_persistent_hash_table_new_full: Out of memory");
+        exit(1);
+    }
+
+    atomic_init(&hash_table->ref_count, 1);
+    hash_table->size = 0;
+    hash_table->seed = (uint32_t) _g_hash_mix(_g_hash_seed(), (uint64_t) (uintptr_t) hash_table);
+    hash_table->hash_func = hash_func;
+    hash_table->key_equal_func = key_equal_func;
+    hash_table->key_destroy_func = key_destroy_func;
+    hash_table->value_destroy_func = value_destroy_func;
+    hash_table->root = NULL;
+
+    return hash_table;
+}
+
+GPersistentHashTable *g_persistent_hash_table_ref(GPersistentHashTable *hash_table)
+{
+    atomic_fetch_add_explicit(&hash_table->ref_count, 1, memory_order_relaxed);
+
+    return hash_table;
+}
+
+void g_persistent_hash_table_unref(GPersistentHashTable *hash_table)
+{
+    if (atomic_fetch_sub_explicit(&hash_table->ref_count, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    if (hash_table->root) {
+        _g_persistent_hash_table_node_unref(hash_table, hash_table->root);
+    }
+
+    free(hash_table);
+}
+
+// An existing key gets the new value in the new version; the old value is
+// destroyed with the last version holding it.
+GPersistentHashTable *g_persistent_hash_table_insert(GPersistentHashTable *hash_table, void *key, void *value)
+{
+    // a value can't be owned by two leaves, and the version wouldn't change
+    if (hash_table->value_destroy_func) {
+        struct GPersistentHashTableLeaf *existing = _g_persistent_hash_table_find(hash_table, key);
+
+        if (existing && existing->value == value) {
+            if (existing->key != key && hash_table->key_destroy_func) {
+                hash_table->key_destroy_func(key);
+            }
+            return g_persistent_hash_table_ref(hash_table);
+        }
+    }
+
+    uint32_t hash = _g_hash_fmix32(hash_table->hash_func(key) ^ hash_table->seed);
+    struct GPersistentHashTableLeaf *leaf = _g_persistent_hash_table_leaf_new(hash, key, value);
+    bool added;
+
+    struct GPersistentHashTableNode *root = _g_persistent_hash_table_insert_node(hash_table, hash_table->root, 0, leaf, &added);
+
+    return _g_persistent_hash_table_new_version(hash_table, root, hash_table->size + added);
+}
+
+// Returns another reference to the same version if the key is missing.
+GPersistentHashTable *g_persistent_hash_table_remove(GPersistentHashTable *hash_table, void *key)
+{
+    if (_g_persistent_hash_table_find(hash_table, key) == NULL) {
+        return g_persistent_hash_table_ref(hash_table);
+    }
+
+    uint32_t hash = _g_hash_fmix32(hash_table->hash_func(key) ^ hash_table->seed);
+    struct GPersistentHashTableNode *root = _g_persistent_hash_table_remove_node(hash_table, hash_table->root, 0, hash, key);
+
+    return _g_persistent_hash_table_new_version(hash_table, root, hash_table->size - 1);
+}
+
+uint32_t g_persistent_hash_table_size(GPersistentHashTable *hash_table)
+{
+    return hash_table->size;
+}
+
+void* g_persistent_hash_table_lookup(GPersistentHashTable *hash_table, void *key)
+{
+    struct GPersistentHashTableLeaf *leaf = _g_persistent_hash_table_find(hash_table, key);
+
+    return leaf ? leaf->value : NULL;
+}
+
+bool g_persistent_hash_table_lookup_extended(GPersistentHashTable *hash_table, void *lookup_key, void **orig_key, void **value)
+{
+    struct GPersistentHashTableLeaf *leaf = _g_persistent_hash_table_find(hash_table, lookup_key);
+
+    if (leaf == NULL) {
+        return false;
+    }
+
+    if (orig_key) {
+        *orig_key = leaf->key;
+    }
+
+    if (value) {
+        *value = leaf->value;
+    }
+
+    return true;
+}
+
+bool g_persistent_hash_table_contains(GPersistentHashTable *hash_table, void *key)
+{
+    return _g_persistent_hash_table_find(hash_table, key) != NULL;
+}
+
+void _g_persistent_hash_table_foreach_node(struct GPersistentHashTableNode *node, GHFunc func, void *user_data)
+{
+    switch (node->kind) {
+        case G_PERSISTENT_HASH_TABLE_LEAF: {
+            struct GPersistentHashTableLeaf *leaf = (struct GPersistentHashTableLeaf*) node;
+
+            func(leaf->key, leaf->value, user_data);
+            break;
+        }
+        case G_PERSISTENT_HASH_TABLE_BRANCH: {
+            struct GPersistentHashTableBranch *branch = (struct GPersistentHashTableBranch*) node;
+            uint32_t count = _g_hash_table_popcount(branch->bitmap);
+
+            for (uint32_t i = 0; i < count; i++) {
+                _g_persistent_hash_table_foreach_node(branch->children[i], func, user_data);
+            }
+            break;
+        }
+        case G_PERSISTENT_HASH_TABLE_COLLISION: {
+            struct GPersistentHashTableCollision *collision = (struct GPersistentHashTableCollision*) node;
+
+            for (uint32_t i = 0; i < collision->num_leaves; i++) {
+                func(collision->leaves[i]->key, collision->leaves[i]->value, user_data);
+            }
+            break;
+        }
+    }
+}
+
+void g_persistent_hash_table_foreach(GPersistentHashTable *hash_table, GHFunc func, void *user_data)
+{
+    if (hash_table->root) {
+        _g_persistent_hash_table_foreach_node(hash_table->root, func, user_data);
+    }
+}
+
+// Takes over the caller's reference to hash_table and drops the one current
+// held on the previous version once no pinned reader can still be using it.
+// Must not be called while pinned.
+void g_persistent_hash_table_publish(_Atomic(GPersistentHashTable*) *current, GPersistentHashTable *hash_table)
+{
+    GPersistentHashTable *old = atomic_exchange(current, hash_table);
+
+    if (old) {
+        _g_epoch_synchronize();
+        g_persistent_hash_table_unref(old);
+    }
+}
+
+// Returns a reference to the current version, or NULL if none was published.
+GPersistentHashTable *g_persistent_hash_table_acquire(_Atomic(GPersistentHashTable*) *current)
+{
+    g_concurrent_hash_table_pin();
+
+    GPersistentHashTable *hash_table = atomic_load(current);
+    if (hash_table) {
+        g_persistent_hash_table_ref(hash_table);
+    }
+
+    g_concurrent_hash_table_unpin();
+
+    return hash_table;
+}
@@ -1,7 +1,586 @@
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <miniglib.h>
 
+#define NUM_VALUES 100000
+#define NUM_PATTERNS 6
+
+struct record {
+    uint64_t key;
+    uint64_t seq;
+};
+
+struct record12 {
+    uint32_t seq;
+    int32_t key;
+    uint32_t pad;
+};
+
+#define u64_less(a, b) (*(a) < *(b))
+#define record_less(a, b) ((a)->key < (b)->key)
+
+G_ARRAY_SORT_DEFINE(u64, uint64_t, u64_less)
+G_ARRAY_SORT_DEFINE(record, struct record, record_less)
+
+static int *int_at(GArray *array, size_t i) {
+    return &g_array_index(array, int, i);
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return (*(const int*) a > *(const int*) b) - (*(const int*) a < *(const int*) b);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    return (*(const uint64_t*) a > *(const uint64_t*) b) - (*(const uint64_t*) a < *(const uint64_t*) b);
+}
+
+static int compare_records(const void *a, const void *b) {
+    return compare_u64(&((const struct record*) a)->key, &((const struct record*) b)->key);
+}
+
+// a total order, so every correct sort gives the same bytes
+static int compare_records_total(const void *a, const void *b, void *user_data) {
+    int cmp = compare_records(a, b);
+    return cmp ? cmp : compare_u64(&((const struct record*) a)->seq, &((const struct record*) b)->seq);
+}
+
+static int compare_record12s_total(const void *a, const void *b) {
+    int cmp = compare_ints(&((const struct record12*) a)->key, &((const struct record12*) b)->key);
+    return cmp ? cmp : compare_ints(&((const struct record12*) a)->seq, &((const struct record12*) b)->seq);
+}
+
+static int compare_records_with_data(const void *a, const void *b, void *user_data) {
+    (*(size_t*) user_data)++;
+    return compare_records(a, b);
+}
+
+static int compare_record12s(const void *a, const void *b) {
+    return compare_ints(&((const struct record12*) a)->key, &((const struct record12*) b)->key);
+}
+
+static int compare_floats(const void *a, const void *b) {
+    return (*(const float*) a > *(const float*) b) - (*(const float*) a < *(const float*) b);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    return (*(const double*) a > *(const double*) b) - (*(const double*) a < *(const double*) b);
+}
+
+// random, sorted, reversed, all equal, few distinct and sawtooth keys, which
+// cover the sort's pattern shortcuts and its duplicate handling
+static uint64_t pattern_key(int pattern, size_t i, size_t n, uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    switch (pattern) {
+        case 0: return *state;
+        case 1: return i;
+        case 2: return n - i;
+        case 3: return 42;
+        case 4: return *state % 4;
+        default: return i % 1000;
+    }
+}
+
+static void check_sorts(size_t n, int pattern) {
+    uint64_t state = 0x9E3779B97F4A7C15ull + n;
+    GArray *u64s = g_array_new(false, false, sizeof(uint64_t));
+    GArray *ints = g_array_new(false, false, sizeof(int));
+    GArray *records = g_array_new(false, false, sizeof(struct record));
+    GArray *record12s = g_array_new(false, false, sizeof(struct record12));
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = pattern_key(pattern, i, n, &state);
+        int value = (int) (key % 100000) - 50000;
+        struct record record = {key % 1000, i};
+        struct record12 record12 = {(uint32_t) i, value, 0};
+
+        g_array_append_val(u64s, key);
+        g_array_append_val(ints, value);
+        g_array_append_val(records, record);
+        g_array_append_val(record12s, record12);
+    }
+
+    // the generic sorts agree with qsort
+    uint64_t *expected = malloc(n * sizeof(uint64_t) + 1);
+    if (n) {
+        memcpy(expected, u64s->data, n * sizeof(uint64_t));
+        qsort(expected, n, sizeof(uint64_t), compare_u64);
+    }
+
+    GArray *copy = g_array_copy(u64s);
+    g_array_sort(copy, compare_u64);
+    assert(n == 0 || memcmp(copy->data, expected, n * sizeof(uint64_t)) == 0);
+    g_array_free(copy, true);
+
+    copy = g_array_copy(u64s);
+    g_array_sort_u64(copy);
+    assert(n == 0 || memcmp(copy->data, expected, n * sizeof(uint64_t)) == 0);
+    _g_array_sort_u64_heap((uint64_t*) (void*) u64s->data, n, NULL);
+    assert(n == 0 || memcmp(u64s->data, expected, n * sizeof(uint64_t)) == 0);
+    g_array_free(copy, true);
+
+    copy = g_array_copy(ints);
+    g_array_sort(copy, compare_ints);
+    for (size_t i = 1; i < n; i++) {
+        assert(g_array_index(copy, int, i - 1) <= g_array_index(copy, int, i));
+    }
+    g_array_free(copy, true);
+
+    copy = g_array_copy(record12s);
+    g_array_sort(copy, compare_record12s);
+    for (size_t i = 1; i < n; i++) {
+        assert(g_array_index(copy, struct record12, i - 1).key <= g_array_index(copy, struct record12, i).key);
+    }
+    g_array_free(copy, true);
+
+    copy = g_array_copy(records);
+    size_t comparisons = 0;
+    g_array_sort_with_data(copy, compare_records_with_data, &comparisons);
+    assert(n < 2 || comparisons > 0);
+    for (size_t i = 1; i < n; i++) {
+        assert(g_array_index(copy, struct record, i - 1).key <= g_array_index(copy, struct record, i).key);
+    }
+    g_array_sort_record(records);
+    for (size_t i = 0; i < n; i++) {
+        assert(g_array_index(copy, struct record, i).key == g_array_index(records, struct record, i).key);
+    }
+    g_array_free(copy, true);
+
+    // the stable sorts keep records with equal keys in their original order
+    for (size_t i = 0; i < n; i++) {
+        g_array_index(records, struct record, i).seq = i;
+    }
+    copy = g_array_copy(records);
+    g_array_sort_stable(records, compare_records);
+    g_array_sort_by_key(copy, G_ARRAY_KEY_UINT64, offsetof(struct record, key));
+    assert(n == 0 || memcmp(copy->data, records->data, n * sizeof(struct record)) == 0);
+    for (size_t i = 1; i < n; i++) {
+        struct record *a = &g_array_index(records, struct record, i - 1);
+        struct record *b = &g_array_index(records, struct record, i);
+        assert(a->key < b->key || (a->key == b->key && a->seq < b->seq));
+    }
+    g_array_free(copy, true);
+
+    copy = g_array_copy(record12s);
+    g_array_sort_stable(record12s, compare_record12s);
+    g_array_sort_by_key(copy, G_ARRAY_KEY_INT32, offsetof(struct record12, key));
+    assert(n == 0 || memcmp(copy->data, record12s->data, n * sizeof(struct record12)) == 0);
+    g_array_free(copy, true);
+
+    // radix sorts of bare keys
+    copy = g_array_copy(ints);
+    g_array_sort(ints, compare_ints);
+    g_array_sort_by_key(copy, G_ARRAY_KEY_INT32, 0);
+    assert(n == 0 || memcmp(copy->data, ints->data, n * sizeof(int)) == 0);
+    g_array_free(copy, true);
+
+    g_array_sort_by_key(u64s, G_ARRAY_KEY_UINT64, 0);
+    assert(n == 0 || memcmp(u64s->data, expected, n * sizeof(uint64_t)) == 0);
+
+    free(expected);
+    g_array_free(u64s, true);
+    g_array_free(ints, true);
+    g_array_free(records, true);
+    g_array_free(record12s, true);
+}
+
+static void check_parallel_sorts(size_t n) {
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    GArray *u64s = g_array_new(false, false, sizeof(uint64_t));
+    GArray *records = g_array_new(false, false, sizeof(struct record));
+    GArray *record12s = g_array_new(false, false, sizeof(struct record12));
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = pattern_key(0, i, n, &state);
+        struct record record = {key % 1000, key >> 32};
+        struct record12 record12 = {(uint32_t) (key >> 40), (int32_t) (key % 2000) - 1000, 0};
+
+        g_array_append_val(u64s, key);
+        g_array_append_val(records, record);
+        g_array_append_val(record12s, record12);
+    }
+
+    GArray *expected_u64s = g_array_copy(u64s);
+    GArray *expected_records = g_array_copy(records);
+    GArray *expected_record12s = g_array_copy(record12s);
+    g_array_sort(expected_u64s, compare_u64);
+    g_array_sort_with_data(expected_records, compare_records_total, NULL);
+    g_array_sort(expected_record12s, compare_record12s_total);
+
+    void *scratch = malloc(n * sizeof(struct record));
+
+    for (uint32_t num_threads = 1; num_threads <= 7; num_threads++) {
+        GArray *copy = g_array_copy(u64s);
+        g_array_sort_parallel(copy, compare_u64, num_threads);
+        assert(memcmp(copy->data, expected_u64s->data, n * sizeof(uint64_t)) == 0);
+        g_array_free(copy, true);
+
+        copy = g_array_copy(records);
+        g_array_sort_parallel_with_data(copy, compare_records_total, NULL, num_threads, num_threads % 2 ? scratch : NULL);
+        assert(memcmp(copy->data, expected_records->data, n * sizeof(struct record)) == 0);
+        g_array_free(copy, true);
+
+        copy = g_array_copy(record12s);
+        g_array_sort_parallel(copy, compare_record12s_total, num_threads);
+        assert(memcmp(copy->data, expected_record12s->data, n * sizeof(struct record12)) == 0);
+        g_array_free(copy, true);
+    }
+
+    free(scratch);
+    g_array_free(expected_u64s, true);
+    g_array_free(expected_records, true);
+    g_array_free(expected_record12s, true);
+    g_array_free(u64s, true);
+    g_array_free(records, true);
+    g_array_free(record12s, true);
+}
+
+// every search agrees with a linear scan, on arrays with long runs of
+// duplicates
+static void check_searches(size_t n, int run) {
+    GArray *array = g_array_new(false, false, sizeof(int));
+    for (size_t i = 0; i < n; i++) {
+        int value = (int) (i / run) * 2;
+        g_array_append_val(array, value);
+    }
+
+    GArrayEytzinger *index = g_array_eytzinger_new(array);
+    int max = n ? g_array_index(array, int, n - 1) + 2 : 2;
+    int *targets = malloc((max + 2) * sizeof(int));
+    size_t *indices = malloc((max + 2) * sizeof(size_t));
+
+    for (int target = -1; target <= max; target++) {
+        size_t lower = 0;
+        while (lower < n && g_array_index(array, int, lower) < target) {
+            lower++;
+        }
+        size_t upper = lower;
+        while (upper < n && g_array_index(array, int, upper) == target) {
+            upper++;
+        }
+
+        assert(g_array_lower_bound(array, &target, compare_ints) == lower);
+        assert(g_array_upper_bound(array, &target, compare_ints) == upper);
+        size_t start, end;
+        g_array_equal_range(array, &target, compare_ints, &start, &end);
+        assert(start == lower && end == upper);
+        assert(g_array_eytzinger_lower_bound(index, &target, compare_ints) == lower);
+
+        size_t match = 0;
+        assert(g_array_binary_search_index(array, &target, compare_ints, &match) == (upper > lower));
+        assert(upper == lower || match == lower);
+
+        targets[target + 1] = target;
+    }
+
+    g_array_search_many(array, targets, max + 2, compare_ints, indices);
+    for (int target = -1; target <= max; target++) {
+        assert(indices[target + 1] == g_array_lower_bound(array, &target, compare_ints));
+    }
+
+    free(indices);
+    free(targets);
+    g_array_eytzinger_free(index);
+    g_array_free(array, true);
+}
+
+#if !(defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+#define MAPPED_PATH "garray_test.mapped"
+
+static long file_size(const char *path) {
+    FILE *file = fopen(path, "rb");
+    assert(file);
+    assert(fseek(file, 0, SEEK_END) == 0);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// a file of n uint64 values i * 3, written and read back through mappings
+static void check_mapped(size_t n) {
+    FILE *file = fopen(MAPPED_PATH, "wb");
+    assert(file);
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t value = i * 3;
+        assert(fwrite(&value, sizeof(value), 1, file) == 1);
+    }
+    fclose(file);
+
+    GArray *array = g_array_new_mapped(MAPPED_PATH, sizeof(uint64_t), G_ARRAY_MAP_READ_ONLY);
+    assert(array && array->len == n);
+    for (size_t i = 0; i < n; i++) {
+        assert(g_array_index(array, uint64_t, i) == i * 3);
+    }
+    size_t index = SIZE_MAX;
+    uint64_t target = 3 * (n / 2);
+    assert(n == 0 || (g_array_binary_search_index(array, &target, compare_u64, &index) && index == n / 2));
+
+    // freeing without the segment hands out a heap copy
+    uint64_t *values = (uint64_t*) (void*) g_array_free(array, false);
+    for (size_t i = 0; i < n; i++) {
+        assert(values[i] == i * 3);
+    }
+    free(values);
+
+    // private changes, then growth to the heap, never reach the file
+    array = g_array_new_mapped(MAPPED_PATH, sizeof(uint64_t), G_ARRAY_MAP_COPY_ON_WRITE);
+    assert(array && array->len == n);
+    if (n) {
+        g_array_index(array, uint64_t, 0) = 7;
+    }
+    uint64_t value = 1;
+    g_array_append_val(array, value);
+    assert(array->len == n + 1 && g_array_index(array, uint64_t, n) == 1);
+    assert(n == 0 || g_array_index(array, uint64_t, 0) == 7);
+    g_array_free(array, true);
+    assert(file_size(MAPPED_PATH) == (long) (n * sizeof(uint64_t)));
+
+    // appends grow the file, sync and free trim it to len
+    array = g_array_map_writable(MAPPED_PATH, sizeof(uint64_t));
+    assert(array && array->len == n);
+    for (uint64_t i = n; i < 2 * n + 5; i++) {
+        value = i * 3;
+        g_array_append_val(array, value);
+    }
+    g_array_remove_index(array, 0);
+    assert(g_array_sync(array));
+    assert(file_size(MAPPED_PATH) == (long) ((2 * n + 4) * sizeof(uint64_t)));
+
+    value = 0;
+    g_array_prepend_val(array, value);
+    g_array_sort_by_key(array, G_ARRAY_KEY_UINT64, 0);
+    g_array_free(array, true);
+    assert(file_size(MAPPED_PATH) == (long) ((2 * n + 5) * sizeof(uint64_t)));
+
+    array = g_array_new_mapped(MAPPED_PATH, sizeof(uint64_t), G_ARRAY_MAP_READ_ONLY);
+    assert(array && array->len == 2 * n + 5);
+    for (size_t i = 0; i < array->len; i++) {
+        assert(g_array_index(array, uint64_t, i) == i * 3);
+    }
+    GArray *copy = g_array_copy(array);
+
+    // shrinking a read-only mapping keeps it
+    g_array_set_size(array, n);
+    g_array_shrink_to_fit(array);
+    assert(array->len == n && (n == 0 || g_array_index(array, uint64_t, n - 1) == (n - 1) * 3));
+    g_array_free(array, true);
+    assert(copy->len == 2 * n + 5 && g_array_index(copy, uint64_t, copy->len - 1) == (2 * n + 4) * 3);
+    g_array_free(copy, true);
+
+    // a writable array that ends up empty leaves an empty file
+    array = g_array_map_writable(MAPPED_PATH, sizeof(uint64_t));
+    size_t len;
+    free(g_array_steal(array, &len));
+    assert(len == 2 * n + 5 && array->len == 0);
+    g_array_free(array, true);
+
+    array = g_array_map_writable(MAPPED_PATH, sizeof(uint64_t));
+    g_array_set_size(array, 0);
+    g_array_shrink_to_fit(array);
+    assert(array->data == NULL && g_array_sync(array));
+    g_array_free(array, true);
+    assert(file_size(MAPPED_PATH) == 0);
+
+    // records sorted by key stay in the file
+    GArray *records = g_array_map_writable(MAPPED_PATH, sizeof(struct record));
+    for (uint64_t i = 0; i < n + 2; i++) {
+        struct record record = {(n + 2 - i) / 2, i};
+        g_array_append_val(records, record);
+    }
+    g_array_sort_by_key(records, G_ARRAY_KEY_UINT64, offsetof(struct record, key));
+    g_array_free(records, true);
+
+    records = g_array_new_mapped(MAPPED_PATH, sizeof(struct record), G_ARRAY_MAP_READ_ONLY);
+    assert(records && records->len == n + 2);
+    for (size_t i = 1; i < records->len; i++) {
+        struct record *a = &g_array_index(records, struct record, i - 1);
+        struct record *b = &g_array_index(records, struct record, i);
+        assert(a->key < b->key || (a->key == b->key && a->seq < b->seq));
+    }
+    g_array_free(records, true);
+
+    // sizes that aren't a multiple of the element size don't map
+    file = fopen(MAPPED_PATH, "wb");
+    assert(fwrite("abc", 1, 3, file) == 3);
+    fclose(file);
+    assert(g_array_new_mapped(MAPPED_PATH, sizeof(uint64_t), G_ARRAY_MAP_READ_ONLY) == NULL);
+    assert(g_array_map_writable(MAPPED_PATH, 0) == NULL);
+
+    assert(remove(MAPPED_PATH) == 0);
+    assert(g_array_new_mapped(MAPPED_PATH, sizeof(uint64_t), G_ARRAY_MAP_READ_ONLY) == NULL);
+}
+#endif
+
+static int cleared = 0;
+
+static void clear_int(void *data) {
+    cleared += *(int*) data;
+}
+
 int garray_test(int argc, char** argv) {
+    // appending one at a time reallocates O(log n) times
+    GArray *array = g_array_new(true, false, sizeof(int));
+    unsigned int reallocations = 0;
+
+    for (int i = 0; i < NUM_VALUES; i++) {
+        size_t allocated = array->_allocated_elements;
+        g_array_append_val(array, i);
+        reallocations += array->_allocated_elements != allocated;
+    }
+    assert(array->len == NUM_VALUES);
+    assert(reallocations < 40);
+    for (int i = 0; i < NUM_VALUES; i++) {
+        assert(*int_at(array, i) == i);
+    }
+    assert(*int_at(array, NUM_VALUES) == 0);
+
+    GArray *copy = g_array_copy(array);
+    assert(copy->len == NUM_VALUES);
+    assert(copy->_allocated_elements == NUM_VALUES + 1);
+    assert(*int_at(copy, NUM_VALUES - 1) == NUM_VALUES - 1);
+    assert(*int_at(copy, NUM_VALUES) == 0);
+    g_array_free(copy, true);
+
+    g_array_set_size(array, 10);
+    g_array_shrink_to_fit(array);
+    assert(array->_allocated_elements == 11);
+    assert(*int_at(array, 9) == 9);
+    assert(*int_at(array, 10) == 0);
+    g_array_free(array, true);
+
+    // growing up to the reserved length doesn't move the data
+    array = g_array_new(false, false, sizeof(int));
+    g_array_reserve(array, 1000);
+    assert(array->_allocated_elements >= 1000);
+    char *data = array->data;
+    for (int i = 0; i < 1000; i++) {
+        g_array_append_val(array, i);
+    }
+    assert(array->data == data);
+    g_array_reserve(array, 10);
+    assert(array->_allocated_elements >= 1000);
+
+    g_array_set_size(array, 0);
+    g_array_shrink_to_fit(array);
+    assert(array->_allocated_elements == 0 && array->data == NULL);
+    int one = 1;
+    g_array_append_val(array, one);
+    assert(*int_at(array, 0) == 1);
+    g_array_free(array, true);
+
+    // elements exposed by set_size or an insert past the end are zeroed, even
+    // if the memory held values before
+    array = g_array_sized_new(false, true, sizeof(int), 16);
+    g_array_set_size(array, 16);
+    for (unsigned int i = 0; i < 16; i++) {
+        assert(*int_at(array, i) == 0);
+        *int_at(array, i) = -1;
+    }
+    g_array_set_size(array, 4);
+    g_array_set_size(array, 16);
+    for (unsigned int i = 4; i < 16; i++) {
+        assert(*int_at(array, i) == 0);
+    }
+    g_array_set_size(array, 0);
+    int seven = 7;
+    g_array_insert_val(array, 5, seven);
+    assert(array->len == 6);
+    for (unsigned int i = 0; i < 5; i++) {
+        assert(*int_at(array, i) == 0);
+    }
+    assert(*int_at(array, 5) == 7);
+    g_array_free(array, true);
+
+    // both binary searches find the left-most match
+    array = g_array_new(false, false, sizeof(int));
+    for (int i = 0; i < 1000; i++) {
+        int value = i / 3 * 2;
+        g_array_append_val(array, value);
+    }
+    for (int i = 0; i < 1000; i++) {
+        int target = i / 3 * 2;
+        size_t index = 0;
+        unsigned int compat_index = 0;
+        assert(g_array_binary_search_index(array, &target, compare_ints, &index));
+        assert(g_array_binary_search(array, &target, compare_ints, &compat_index));
+        assert(index == (size_t) (i / 3 * 3) && compat_index == index);
+
+        target++;
+        assert(!g_array_binary_search_index(array, &target, compare_ints, &index));
+        assert(!g_array_binary_search(array, &target, compare_ints, &compat_index));
+    }
+
+    // the clear func sees exactly the elements that are removed
+    for (size_t i = 0; i < array->len; i++) {
+        g_array_index(array, int, i) = 1 << (i % 8);
+    }
+    g_array_set_clear_func(array, clear_int);
+    g_array_remove_range(array, 8, 8);
+    assert(cleared == 255);
+    g_array_remove_index(array, 3);
+    assert(cleared == 255 + 8);
+    g_array_set_size(array, 10);
+    assert(array->len == 10);
+    cleared = 0;
+    g_array_free(array, true);
+    assert(cleared == 1 + 2 + 4 + 16 + 32 + 64 + 128 + 1 + 2 + 4);
+
+    size_t sizes[] = {0, 1, 2, 5, 23, 24, 100, 129, 1000, 50000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+            check_sorts(sizes[i], pattern);
+        }
+    }
+
+    for (size_t n = 0; n < 70; n++) {
+        check_searches(n, 1);
+        check_searches(n, 3);
+    }
+    check_searches(5000, 1);
+    check_searches(5000, 1000);
+    check_searches(4095, 7);
+
+    check_parallel_sorts(GARRAY_SORT_PARALLEL_MIN_ELEMENTS * 6 + 12345);
+    check_parallel_sorts(1000);
+
+    // floats and doubles sort by value, -0.0 before 0.0
+    double doubles[] = {3.5, -1.0, 0.0, -INFINITY, 1e300, -0.0, 2.0, INFINITY, -1e-300, -7.25};
+    float floats[] = {3.5f, -1.0f, 0.0f, -INFINITY, 1e30f, -0.0f, 2.0f, INFINITY, -1e-30f, -7.25f};
+    size_t num_doubles = sizeof(doubles) / sizeof(doubles[0]);
+    array = g_array_new(false, false, sizeof(double));
+    g_array_append_vals(array, doubles, num_doubles);
+    g_array_sort_by_key(array, G_ARRAY_KEY_DOUBLE, 0);
+    qsort(doubles, num_doubles, sizeof(double), compare_doubles);
+    for (size_t i = 0; i < num_doubles; i++) {
+        assert(g_array_index(array, double, i) == doubles[i]);
+    }
+    assert(signbit(g_array_index(array, double, 4)) && !signbit(g_array_index(array, double, 5)));
+    g_array_free(array, true);
+
+    array = g_array_new(true, false, sizeof(float));
+    g_array_append_vals(array, floats, num_doubles);
+    g_array_sort_by_key(array, G_ARRAY_KEY_FLOAT, 0);
+    qsort(floats, num_doubles, sizeof(float), compare_floats);
+    for (size_t i = 0; i < num_doubles; i++) {
+        assert(g_array_index(array, float, i) == floats[i]);
+    }
+    assert(signbit(g_array_index(array, float, 4)) && !signbit(g_array_index(array, float, 5)));
+    assert(g_array_index(array, float, num_doubles) == 0.0f);
+    g_array_free(array, true);
+
+#if !(defined _WIN32 || defined _WIN64 || defined __WINDOWS__)
+    check_mapped(0);
+    check_mapped(1);
+    check_mapped(100000);
+#endif
+
     return 0;
-}
\ No newline at end of file
+}
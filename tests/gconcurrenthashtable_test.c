@@ -0,0 +1,136 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <miniglib.h>
+
+#define KEY(i) ((void*) (uintptr_t) (i))
+#define NUM_WRITERS 4
+#define NUM_READERS 4
+#define KEYS_PER_WRITER 2000
+
+static atomic_int values_destroyed = 0;
+static atomic_bool writers_done = false;
+
+static void destroy_value(void *value) {
+    atomic_fetch_add(&values_destroyed, 1);
+    free(value);
+}
+
+static uintptr_t *new_value(uintptr_t key) {
+    uintptr_t *value = malloc(sizeof(uintptr_t));
+    *value = key * 2;
+    return value;
+}
+
+static int writer(void *data) {
+    GConcurrentHashTable *table = data;
+    static atomic_int next_writer = 0;
+    uintptr_t base = (uintptr_t) atomic_fetch_add(&next_writer, 1) * KEYS_PER_WRITER + 1;
+
+    for (int round = 0; round < 3; round++) {
+        for (uintptr_t i = base; i < base + KEYS_PER_WRITER; i++) {
+            g_concurrent_hash_table_insert(table, KEY(i), new_value(i));
+        }
+
+        // replacing a value retires the old one
+        for (uintptr_t i = base; i < base + KEYS_PER_WRITER; i += 7) {
+            g_concurrent_hash_table_insert(table, KEY(i), new_value(i));
+        }
+
+        for (uintptr_t i = base; i < base + KEYS_PER_WRITER; i++) {
+            uintptr_t *value = g_concurrent_hash_table_lookup(table, KEY(i));
+            assert(value != NULL && *value == i * 2);
+        }
+
+        if (round < 2) {
+            for (uintptr_t i = base; i < base + KEYS_PER_WRITER; i++) {
+                assert(g_concurrent_hash_table_remove(table, KEY(i)));
+            }
+            assert(!g_concurrent_hash_table_remove(table, KEY(base)));
+        }
+    }
+
+    return 0;
+}
+
+static int reader(void *data) {
+    GConcurrentHashTable *table = data;
+    uintptr_t i = 1;
+
+    while (!atomic_load(&writers_done)) {
+        g_concurrent_hash_table_pin();
+        uintptr_t *value = g_concurrent_hash_table_lookup(table, KEY(i));
+        assert(value == NULL || *value == i * 2);
+        g_concurrent_hash_table_unpin();
+
+        i = i % (NUM_WRITERS * KEYS_PER_WRITER) + 1;
+    }
+
+    return 0;
+}
+
+static void count_entry(void *key, void *value, void *user_data) {
+    assert(*(uintptr_t*) value == (uintptr_t) key * 2);
+    (*(int*) user_data)++;
+}
+
+int gconcurrenthashtable_test(int argc, char** argv) {
+    GConcurrentHashTable *table = g_concurrent_hash_table_new(g_int_hash, g_int_equal);
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        g_concurrent_hash_table_insert(table, KEY(i), KEY(i * 2));
+    }
+    assert(g_concurrent_hash_table_size(table) == 10000);
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        assert(g_concurrent_hash_table_lookup(table, KEY(i)) == KEY(i * 2));
+    }
+    assert(g_concurrent_hash_table_lookup(table, KEY(10001)) == NULL);
+
+    for (uintptr_t i = 1; i <= 10000; i += 2) {
+        assert(g_concurrent_hash_table_remove(table, KEY(i)));
+    }
+    assert(g_concurrent_hash_table_size(table) == 5000);
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        assert(g_concurrent_hash_table_lookup(table, KEY(i)) == (i % 2 ? NULL : KEY(i * 2)));
+    }
+
+    g_concurrent_hash_table_destroy(table);
+
+    // writers churn their own key ranges while readers look up all of them
+    table = g_concurrent_hash_table_new_full(g_int_hash, g_int_equal, NULL, destroy_value);
+    thrd_t writers[NUM_WRITERS];
+    thrd_t readers[NUM_READERS];
+
+    for (int i = 0; i < NUM_READERS; i++) {
+        assert(thrd_create(&readers[i], reader, table) == thrd_success);
+    }
+    for (int i = 0; i < NUM_WRITERS; i++) {
+        assert(thrd_create(&writers[i], writer, table) == thrd_success);
+    }
+
+    for (int i = 0; i < NUM_WRITERS; i++) {
+        thrd_join(writers[i], NULL);
+    }
+    atomic_store(&writers_done, true);
+    for (int i = 0; i < NUM_READERS; i++) {
+        thrd_join(readers[i], NULL);
+    }
+
+    int count = 0;
+    g_concurrent_hash_table_foreach(table, count_entry, &count);
+    assert(count == NUM_WRITERS * KEYS_PER_WRITER);
+    assert(g_concurrent_hash_table_size(table) == NUM_WRITERS * KEYS_PER_WRITER);
+
+    g_concurrent_hash_table_destroy(table);
+
+    // every value ever inserted was destroyed exactly once
+    int replaced_per_round = (KEYS_PER_WRITER + 6) / 7;
+    assert(atomic_load(&values_destroyed) == NUM_WRITERS * 3 * (KEYS_PER_WRITER + replaced_per_round));
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <miniglib.h>
+
+G_DEFINE_HASH_MAP(GU64Map, g_u64_map, uint64_t, void*)
+
+// a map with a custom hash and a sentinel other than 0
+static uint32_t point_hash(int32_t v) {
+    return (uint32_t) v * 2654435761u;
+}
+
+G_DEFINE_HASH_MAP_FULL(GPointMap, g_point_map, int32_t, double, point_hash, G_HASH_MAP_INT_EQUAL, -1)
+
+static void sum_values(uint64_t key, void *value, void *user_data) {
+    assert((uintptr_t) value == key * 2);
+    *(uint64_t*) user_data += key;
+}
+
+int ghashmap_test(int argc, char** argv) {
+    // maps seed themselves from the public per-process seed
+    assert(g_hash_seed() != 0 && g_hash_seed() == g_hash_seed());
+
+    GU64Map *map = g_u64_map_new();
+
+    for (uint64_t i = 0; i < 10000; i++) {
+        g_u64_map_insert(map, i << 32, (void*) (uintptr_t) (i * 2 << 32));
+    }
+    assert(g_u64_map_size(map) == 10000);
+
+    // 0 is the empty key, but it can be stored like any other key
+    assert(g_u64_map_lookup(map, 0) == NULL);
+    void *value = (void*) 1;
+    assert(g_u64_map_lookup_extended(map, 0, &value) && value == NULL);
+
+    for (uint64_t i = 1; i < 10000; i++) {
+        assert(g_u64_map_lookup(map, i << 32) == (void*) (uintptr_t) (i * 2 << 32));
+    }
+    assert(!g_u64_map_lookup_extended(map, 10000ull << 32, NULL));
+
+    for (uint64_t i = 0; i < 10000; i += 2) {
+        assert(g_u64_map_remove(map, i << 32));
+    }
+    assert(!g_u64_map_remove(map, 0));
+    assert(g_u64_map_size(map) == 5000);
+
+    // backward shifting keeps every remaining key reachable
+    for (uint64_t i = 0; i < 10000; i++) {
+        assert(g_u64_map_lookup_extended(map, i << 32, NULL) == (i % 2 == 1));
+    }
+
+    for (uint64_t i = 0; i < 9990; i++) {
+        g_u64_map_remove(map, i << 32);
+    }
+    assert(g_u64_map_size(map) == 5);
+    assert(map->num_slots <= GHASHMAP_MIN_SLOTS * 2);
+    g_u64_map_destroy(map);
+
+    map = g_u64_map_new_sized(1000);
+    uint32_t reserved_slots = map->num_slots;
+    for (uint64_t i = 0; i < 1000; i++) {
+        g_u64_map_insert(map, i, (void*) (uintptr_t) (i * 2));
+    }
+    g_u64_map_insert(map, 7, (void*) 14);
+    assert(map->num_slots == reserved_slots);
+    assert(g_u64_map_size(map) == 1000);
+    uint64_t sum = 0;
+    g_u64_map_foreach(map, sum_values, &sum);
+    assert(sum == 999 * 1000 / 2);
+    g_u64_map_destroy(map);
+
+    GPointMap *points = g_point_map_new();
+    g_point_map_insert(points, -1, 0.5);
+    g_point_map_insert(points, 0, 1.5);
+    g_point_map_insert(points, 1, 2.5);
+    assert(g_point_map_size(points) == 3);
+    assert(g_point_map_lookup(points, -1) == 0.5);
+    assert(g_point_map_lookup(points, 0) == 1.5);
+    assert(g_point_map_lookup(points, 2) == 0.0);
+    assert(g_point_map_remove(points, -1));
+    assert(!g_point_map_lookup_extended(points, -1, NULL));
+    g_point_map_destroy(points);
+
+    return 0;
+}
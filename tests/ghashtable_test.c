@@ -1,3 +1,412 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <miniglib.h>
+
+#define KEY(i) ((void*) (uintptr_t) (i))
+
+static unsigned int hash_calls = 0;
+
+static uint32_t counting_hash(void *key) {
+    hash_calls++;
+    return g_int_hash(key);
+}
+
+// 64 keys share every hash, so probe sequences get long enough to cross
+// from one thread's region of a bulk build into the next
+static uint32_t clustered_hash(void *key) {
+    return (uint32_t) ((uintptr_t) key / 64);
+}
+
+// atomic because bulk builds destroy duplicates on their own threads
+static atomic_uint values_destroyed = 0;
+
+static void count_destroy(void *value) {
+    values_destroyed++;
+}
+
+static bool is_multiple_of(void *key, void *value, void *user_data) {
+    return (uintptr_t) key % (uintptr_t) user_data == 0;
+}
+
+struct sum {
+    uint64_t keys;
+    uint64_t count;
+};
+
+static void sum_entry(void *key, void *value, void *accumulator, void *user_data) {
+    struct sum *sum = accumulator;
+    sum->keys += (uintptr_t) key;
+    sum->count++;
+}
+
+static void combine_sums(void *accumulator, void *other, void *user_data) {
+    struct sum *sum = accumulator;
+    struct sum *add = other;
+    sum->keys += add->keys;
+    sum->count += add->count;
+}
+
+static void count_entry(void *key, void *value, void *user_data) {
+    atomic_fetch_add((atomic_uint*) user_data, 1);
+}
+
 int ghashtable_test(int argc, char** argv) {
+    GHashTable *table = g_hash_table_new(g_int_hash, g_int_equal);
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        g_hash_table_insert(table, KEY(i), KEY(i * 2));
+    }
+    assert(g_hash_table_size(table) == 10000);
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        assert(g_hash_table_lookup(table, KEY(i)) == KEY(i * 2));
+    }
+    assert(g_hash_table_lookup(table, KEY(10001)) == NULL);
+
+    for (uintptr_t i = 1; i <= 10000; i += 2) {
+        assert(g_hash_table_remove(table, KEY(i)));
+    }
+    assert(!g_hash_table_remove(table, KEY(1)));
+    assert(g_hash_table_size(table) == 5000);
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        assert(g_hash_table_lookup(table, KEY(i)) == (i % 2 ? NULL : KEY(i * 2)));
+    }
+
+    g_hash_table_destroy(table);
+
+    // churn through many distinct keys with few live at a time
+    GHashTable *churn = g_hash_table_new(g_int_hash, g_int_equal);
+    for (uintptr_t i = 1; i <= 100000; i++) {
+        g_hash_table_insert(churn, KEY(i), KEY(i));
+        if (i > 20) {
+            assert(g_hash_table_remove(churn, KEY(i - 20)));
+        }
+    }
+    assert(g_hash_table_size(churn) == 20);
+    assert(churn->num_slots == GHASHTABLE_MIN_SLOTS);
+    g_hash_table_destroy(churn);
+
+    // growing reuses the cached hashes instead of calling hash_func again
+    GHashTable *counted = g_hash_table_new(counting_hash, g_int_equal);
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        g_hash_table_insert(counted, KEY(i), KEY(i));
+    }
+    assert(hash_calls == 10000);
+    g_hash_table_destroy(counted);
+
+    assert(g_str_hash("Alan Turing") == g_str_hash_len("Alan Turing", 11));
+    assert(g_str_hash_len("Alan Turing", 4) == g_str_hash("Alan"));
+    assert(g_str_hash("Alan Turing") != g_str_hash("Ada Lovelace"));
+
+    // lookups and removals have to see both slot arrays mid-resize
+    GHashTable *incremental = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, G_HASH_TABLE_INCREMENTAL_RESIZE);
+    bool saw_resize = false;
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        g_hash_table_insert(incremental, KEY(i), KEY(i));
+        saw_resize |= incremental->old_ctrl != NULL;
+        assert(g_hash_table_lookup(incremental, KEY(1)) == KEY(1));
+        assert(g_hash_table_lookup(incremental, KEY(i)) == KEY(i));
+        if (i % 3 == 0) {
+            assert(g_hash_table_remove(incremental, KEY(i)));
+        }
+    }
+    assert(saw_resize);
+    assert(g_hash_table_size(incremental) == 10000 - 10000 / 3);
+    g_hash_table_destroy(incremental);
+
+    // a sized table never resizes during the bulk load, and shrinks back
+    // once most entries are gone
+    GHashTable *sized = g_hash_table_new_sized(g_int_hash, g_int_equal, 100000);
+    uint32_t reserved_slots = sized->num_slots;
+    for (uintptr_t i = 1; i <= 100000; i++) {
+        g_hash_table_insert(sized, KEY(i), KEY(i));
+    }
+    assert(sized->num_slots == reserved_slots);
+    for (uintptr_t i = 1; i <= 99000; i++) {
+        assert(g_hash_table_remove(sized, KEY(i)));
+    }
+    assert(sized->num_slots < reserved_slots / 8);
+    for (uintptr_t i = 99001; i <= 100000; i++) {
+        assert(g_hash_table_lookup(sized, KEY(i)) == KEY(i));
+    }
+    g_hash_table_reserve(sized, 200000);
+    assert(sized->num_slots >= 200000 / GHASHTABLE_MAX_LOAD);
+    g_hash_table_compact(sized);
+    assert(sized->num_slots < reserved_slots / 8);
+    assert(sized->num_deleted == 0);
+    assert(g_hash_table_size(sized) == 1000);
+    for (uintptr_t i = 99001; i <= 100000; i++) {
+        assert(g_hash_table_lookup(sized, KEY(i)) == KEY(i));
+    }
+    g_hash_table_destroy(sized);
+
+    // entries can be removed, replaced and stolen while iterating, and the
+    // bulk removals only visit each slot once
+    GHashTable *iterated = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, count_destroy);
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        g_hash_table_insert(iterated, KEY(i), KEY(i));
+    }
+    GHashTableIter iter;
+    void *key, *value;
+    unsigned int visited = 0;
+    g_hash_table_iter_init(&iter, iterated);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        assert(key == value);
+        visited++;
+        if ((uintptr_t) key % 2 == 0) {
+            g_hash_table_iter_remove(&iter);
+        } else if ((uintptr_t) key % 3 == 0) {
+            g_hash_table_iter_replace(&iter, KEY((uintptr_t) key * 2));
+        } else if ((uintptr_t) key % 5 == 0) {
+            g_hash_table_iter_steal(&iter);
+        }
+    }
+    assert(visited == 10000);
+    assert(values_destroyed == 5000 + 1667);
+    assert(g_hash_table_size(iterated) == 4333);
+    assert(g_hash_table_lookup(iterated, KEY(3)) == KEY(6));
+    assert(g_hash_table_lookup(iterated, KEY(5)) == NULL);
+    assert(g_hash_table_lookup(iterated, KEY(7)) == KEY(7));
+
+    values_destroyed = 0;
+    assert(g_hash_table_foreach_steal(iterated, is_multiple_of, KEY(7)) == 619);
+    assert(values_destroyed == 0);
+    assert(g_hash_table_foreach_remove(iterated, is_multiple_of, KEY(1)) == 4333 - 619);
+    assert(values_destroyed == 4333 - 619);
+    assert(g_hash_table_size(iterated) == 0);
+    assert(iterated->num_slots == GHASHTABLE_MIN_SLOTS);
+    g_hash_table_destroy(iterated);
+
+    // ordered tables iterate in insertion order across every index width, and
+    // removed entries leave no gap in the order
+    GHashTable *ordered = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, G_HASH_TABLE_ORDERED);
+    for (uintptr_t i = 100000; i >= 1; i--) {
+        g_hash_table_insert(ordered, KEY(i), KEY(i * 2));
+    }
+    assert(ordered->num_slots > UINT16_MAX + 1);
+    for (uintptr_t i = 1; i <= 100000; i++) {
+        assert(g_hash_table_lookup(ordered, KEY(i)) == KEY(i * 2));
+        if (i % 4 == 0) {
+            assert(g_hash_table_remove(ordered, KEY(i)));
+        }
+    }
+    g_hash_table_insert(ordered, KEY(8), KEY(8));
+    g_hash_table_insert(ordered, KEY(99999), KEY(1));
+    uintptr_t previous = 100001;
+    g_hash_table_iter_init(&iter, ordered);
+    for (uintptr_t i = 0; i < 75000; i++) {
+        assert(g_hash_table_iter_next(&iter, &key, &value));
+        assert((uintptr_t) key < previous && (uintptr_t) key % 4 != 0);
+        assert(value == ((uintptr_t) key == 99999 ? KEY(1) : KEY((uintptr_t) key * 2)));
+        previous = (uintptr_t) key;
+    }
+    assert(g_hash_table_iter_next(&iter, &key, &value) && key == KEY(8));
+    assert(!g_hash_table_iter_next(&iter, &key, &value));
+    assert(g_hash_table_foreach_remove(ordered, is_multiple_of, KEY(2)) == 25001);
+    g_hash_table_compact(ordered);
+    assert(ordered->num_slots == GHASHTABLE_MIN_SLOTS * 1024);
+    assert(ordered->entries_capacity == 50000);
+    for (uintptr_t i = 1; i <= 100000; i++) {
+        assert(g_hash_table_lookup(ordered, KEY(i)) == (i % 2 ? KEY(i == 99999 ? 1 : i * 2) : NULL));
+    }
+    g_hash_table_destroy(ordered);
+
+    // batched lookups agree with single lookups in every layout, including
+    // mid-resize and for a batch that doesn't fill the last round
+    GHashTableFlags batch_flags[] = {G_HASH_TABLE_FLAGS_NONE, G_HASH_TABLE_INCREMENTAL_RESIZE, G_HASH_TABLE_ORDERED};
+    for (size_t f = 0; f < sizeof(batch_flags) / sizeof(batch_flags[0]); f++) {
+        GHashTable *batched = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, batch_flags[f]);
+        void *batch_keys[1003];
+        void *batch_values[1003];
+        for (uintptr_t i = 1; i <= 1000; i++) {
+            g_hash_table_insert(batched, KEY(i * 3), KEY(i));
+        }
+        for (uintptr_t i = 0; i < 1003; i++) {
+            batch_keys[i] = KEY(i * 2);
+        }
+        g_hash_table_lookup_batch(batched, batch_keys, 1003, batch_values);
+        for (uintptr_t i = 0; i < 1003; i++) {
+            assert(batch_values[i] == g_hash_table_lookup(batched, batch_keys[i]));
+            assert(batch_values[i] == (i > 0 && i % 3 == 0 && i <= 1500 ? KEY(i * 2 / 3) : NULL));
+        }
+        g_hash_table_destroy(batched);
+    }
+
+    // counting with one probe per key, and telling NULL values from
+    // missing keys
+    for (size_t f = 0; f < sizeof(batch_flags) / sizeof(batch_flags[0]); f++) {
+        GHashTable *counts = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, batch_flags[f]);
+        for (uintptr_t i = 0; i < 30000; i++) {
+            bool found = true;
+            void **count = g_hash_table_lookup_or_insert(counts, KEY(i % 10000 + 1), &found);
+            assert(found == (i >= 10000));
+            assert(*count == (found ? KEY(i / 10000) : NULL));
+            *count = KEY((uintptr_t) *count + 1);
+        }
+        assert(g_hash_table_size(counts) == 10000);
+        for (uintptr_t i = 1; i <= 10000; i++) {
+            assert(g_hash_table_lookup(counts, KEY(i)) == KEY(3));
+        }
+
+        g_hash_table_insert(counts, KEY(20000), NULL);
+        assert(g_hash_table_contains(counts, KEY(20000)));
+        assert(!g_hash_table_contains(counts, KEY(20001)));
+        key = NULL;
+        value = KEY(1);
+        assert(g_hash_table_lookup_extended(counts, KEY(20000), &key, &value));
+        assert(key == KEY(20000) && value == NULL);
+        assert(!g_hash_table_lookup_extended(counts, KEY(20001), &key, &value));
+        g_hash_table_destroy(counts);
+    }
+
+    // sets store no values until a value differs from its key
+    for (size_t f = 0; f < sizeof(batch_flags) / sizeof(batch_flags[0]); f++) {
+        GHashTable *set = g_hash_table_new_with_flags(g_str_hash, g_str_equal, NULL, count_destroy, batch_flags[f]);
+        char set_keys[2][3000][8];
+        for (uintptr_t i = 0; i < 3000; i++) {
+            snprintf(set_keys[0][i], sizeof(set_keys[0][i]), "%u", (unsigned int) i);
+            snprintf(set_keys[1][i], sizeof(set_keys[1][i]), "%u", (unsigned int) i);
+            assert(g_hash_table_add(set, set_keys[0][i]));
+        }
+        assert(set->values == set->keys);
+        assert(g_hash_table_size(set) == 3000);
+
+        // an equal key replaces the stored one
+        values_destroyed = 0;
+        assert(!g_hash_table_add(set, set_keys[1][7]));
+        assert(values_destroyed == 1);
+        assert(g_hash_table_lookup_extended(set, "7", &key, &value));
+        assert(key == set_keys[1][7] && value == set_keys[1][7]);
+        assert(set->values == set->keys);
+
+        g_hash_table_insert(set, set_keys[0][8], KEY(8));
+        assert(set->values != set->keys);
+        assert(g_hash_table_lookup(set, "8") == KEY(8));
+        for (uintptr_t i = 0; i < 3000; i++) {
+            if (i != 7 && i != 8) {
+                assert(g_hash_table_lookup(set, set_keys[1][i]) == set_keys[0][i]);
+            }
+        }
+        g_hash_table_destroy(set);
+    }
+
+    // bulk builds resolve duplicates like inserting one key after another
+    void **build_keys = malloc(300000 * sizeof(void*));
+    void **build_values = malloc(300000 * sizeof(void*));
+    assert(build_keys && build_values);
+    for (uintptr_t i = 0; i < 300000; i++) {
+        build_keys[i] = KEY(i % 200000 + 1);
+        build_values[i] = KEY(i + 1);
+    }
+    values_destroyed = 0;
+    GHashTable *built = g_hash_table_new_from_arrays(clustered_hash, g_int_equal, NULL, count_destroy, build_keys, build_values, 300000, 4);
+    assert(values_destroyed == 100000);
+    assert(g_hash_table_size(built) == 200000);
+    for (uintptr_t i = 1; i <= 200000; i++) {
+        assert(g_hash_table_lookup(built, KEY(i)) == KEY(i <= 100000 ? i + 200000 : i));
+    }
+    assert(g_hash_table_lookup(built, KEY(200001)) == NULL);
+    g_hash_table_insert(built, KEY(200001), KEY(1));
+    assert(g_hash_table_size(built) == 200001);
+    g_hash_table_destroy(built);
+
+    built = g_hash_table_new_from_arrays(g_int_hash, g_int_equal, NULL, NULL, build_keys, NULL, 300000, 4);
+    assert(built->values == built->keys);
+    assert(g_hash_table_size(built) == 200000);
+    for (uintptr_t i = 1; i <= 200000; i++) {
+        assert(g_hash_table_contains(built, KEY(i)));
+    }
+    g_hash_table_destroy(built);
+
+    built = g_hash_table_new_from_arrays(g_int_hash, g_int_equal, NULL, NULL, build_keys, build_values, 10, 4);
+    assert(g_hash_table_size(built) == 10);
+    assert(g_hash_table_lookup(built, KEY(10)) == KEY(10));
+    g_hash_table_destroy(built);
+    free(build_values);
+    free(build_keys);
+
+    // stats see every entry and every home group, and notice a hash
+    // function that puts all keys into one group
+    GHashTableStats stats;
+    GHashTableFlags stats_flags[] = {G_HASH_TABLE_FLAGS_NONE, G_HASH_TABLE_ORDERED};
+    for (size_t f = 0; f < sizeof(stats_flags) / sizeof(stats_flags[0]); f++) {
+        GHashTable *measured = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, stats_flags[f]);
+        for (uintptr_t i = 1; i <= 5000; i++) {
+            g_hash_table_insert(measured, KEY(i), KEY(i));
+        }
+        g_hash_table_get_stats(measured, &stats);
+        assert(stats.size == 5000);
+        assert(stats.num_slots == measured->num_slots);
+        assert(stats.load_factor > GHASHTABLE_MAX_LOAD / 2 && stats.load_factor <= GHASHTABLE_MAX_LOAD);
+        assert(stats.num_resizes > 0);
+        assert(stats.bytes_allocated > measured->num_slots);
+        assert(stats.mean_probe_length_found >= 1 && stats.mean_probe_length_found < 2);
+        assert(stats.mean_probe_length_missing >= 1);
+        assert(stats.max_probe_length_found >= 1 && stats.max_probe_length_missing >= 1);
+        uint32_t found_total = 0;
+        uint32_t missing_total = 0;
+        for (size_t i = 0; i < GHASHTABLE_STATS_HISTOGRAM_SIZE; i++) {
+            found_total += stats.probe_length_found[i];
+            missing_total += stats.probe_length_missing[i];
+        }
+        assert(found_total == 5000);
+        assert(missing_total == measured->num_slots / GHASHTABLE_GROUP_WIDTH);
+        if (stats.counters_enabled) {
+            assert(stats.counters.probes >= 5000);
+            assert(stats.counters.free_slot_searches >= 5000);
+        }
+        g_hash_table_destroy(measured);
+    }
+
+    GHashTable *skewed = g_hash_table_new(clustered_hash, g_int_equal);
+    for (uintptr_t i = 0; i < 64 * 8; i++) {
+        g_hash_table_insert(skewed, KEY(i % 8 * 64 + i / 8), KEY(1));
+    }
+    for (uintptr_t i = 0; i < 64 * 8; i += 2) {
+        g_hash_table_remove(skewed, KEY(i % 8 * 64 + i / 8));
+    }
+    g_hash_table_get_stats(skewed, &stats);
+    assert(stats.max_probe_length_found > 1);
+    assert(stats.num_tombstones > 0 && stats.num_tombstones == skewed->num_deleted);
+    assert(stats.tombstone_ratio == (double) stats.num_tombstones / stats.num_slots);
+    g_hash_table_destroy(skewed);
+
+    // parallel scans see every entry once in every layout, including a
+    // table that is mid-resize
+    for (size_t f = 0; f < sizeof(batch_flags) / sizeof(batch_flags[0]); f++) {
+        GHashTable *scanned = g_hash_table_new_with_flags(g_int_hash, g_int_equal, NULL, NULL, batch_flags[f]);
+        for (uintptr_t i = 1; i <= 100000; i++) {
+            g_hash_table_insert(scanned, KEY(i), KEY(i));
+        }
+        for (uintptr_t i = 1; i <= 100000; i += 10) {
+            g_hash_table_remove(scanned, KEY(i));
+        }
+        for (uint32_t threads = 1; threads <= 4; threads++) {
+            struct sum sum = {.keys = 5, .count = 0};
+            g_hash_table_reduce_parallel(scanned, sum_entry, combine_sums, &sum, sizeof(sum), NULL, threads);
+            assert(sum.count == 90000);
+            assert(sum.keys == 5 + 5000050000ull - 499960000ull);
+
+            atomic_uint count = 0;
+            g_hash_table_foreach_parallel(scanned, count_entry, &count, threads);
+            assert(count == 90000);
+        }
+        g_hash_table_destroy(scanned);
+    }
+
+    GHashTable *strings = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(strings, "Alan Turing", "1912");
+    g_hash_table_insert(strings, "Ada Lovelace", "1815");
+    g_hash_table_insert(strings, "Alan Turing", "1954");
+    assert(g_hash_table_size(strings) == 2);
+    assert(strcmp(g_hash_table_lookup(strings, "Alan Turing"), "1954") == 0);
+    assert(strcmp(g_hash_table_lookup(strings, "Ada Lovelace"), "1815") == 0);
+    g_hash_table_destroy(strings);
+
     return 0;
-}
\ No newline at end of file
+}
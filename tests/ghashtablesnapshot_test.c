@@ -0,0 +1,84 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <miniglib.h>
+
+#define SNAPSHOT_PATH "ghashtablesnapshot_test.bin"
+#define NUM_KEYS 20000
+
+static char keys[NUM_KEYS][16];
+static uint64_t offsets[NUM_KEYS];
+
+static void corrupt_byte(uint64_t offset) {
+    FILE *file = fopen(SNAPSHOT_PATH, "r+b");
+    assert(file);
+    assert(fseek(file, (long) offset, SEEK_SET) == 0);
+    int c = fgetc(file);
+    assert(fseek(file, (long) offset, SEEK_SET) == 0);
+    fputc(c ^ 0x20, file);
+    fclose(file);
+}
+
+int ghashtablesnapshot_test(int argc, char** argv) {
+    GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+    for (uint64_t i = 0; i < NUM_KEYS; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "key-%llu", (unsigned long long) i);
+        offsets[i] = i * 4096;
+        g_hash_table_insert(table, keys[i], &offsets[i]);
+    }
+    // a NULL value is written as zeros
+    g_hash_table_insert(table, "", NULL);
+
+    assert(g_hash_table_snapshot_write(table, SNAPSHOT_PATH, sizeof(uint64_t)));
+    g_hash_table_destroy(table);
+
+    GHashTableSnapshot *snapshot = g_hash_table_snapshot_open(SNAPSHOT_PATH);
+    assert(snapshot);
+    assert(g_hash_table_snapshot_verify(snapshot));
+    assert(g_hash_table_snapshot_size(snapshot) == NUM_KEYS + 1);
+    assert(g_hash_table_snapshot_value_size(snapshot) == sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < NUM_KEYS; i++) {
+        const uint64_t *value = g_hash_table_snapshot_lookup(snapshot, keys[i]);
+        assert(value && *value == i * 4096);
+        assert((uintptr_t) value % sizeof(uint64_t) == 0);
+    }
+    assert(*(const uint64_t*) g_hash_table_snapshot_lookup(snapshot, "") == 0);
+    assert(g_hash_table_snapshot_lookup(snapshot, "key-") == NULL);
+    assert(g_hash_table_snapshot_lookup(snapshot, "missing") == NULL);
+    assert(g_hash_table_snapshot_lookup_len(snapshot, "key-12345678", 9) == g_hash_table_snapshot_lookup(snapshot, "key-12345"));
+
+    uint64_t file_size = snapshot->size;
+    uint64_t entries_offset = snapshot->header->entries_offset;
+    g_hash_table_snapshot_close(snapshot);
+
+    // a damaged entry is caught by the data checksum, a damaged header by
+    // open itself
+    corrupt_byte(entries_offset + 8 + 4);
+    snapshot = g_hash_table_snapshot_open(SNAPSHOT_PATH);
+    assert(snapshot);
+    assert(!g_hash_table_snapshot_verify(snapshot));
+    g_hash_table_snapshot_close(snapshot);
+
+    corrupt_byte(offsetof(struct GHashTableSnapshotHeader, num_entries));
+    assert(g_hash_table_snapshot_open(SNAPSHOT_PATH) == NULL);
+
+    // snapshots of empty tables work too
+    GHashTable *empty = g_hash_table_new(g_str_hash, g_str_equal);
+    assert(g_hash_table_snapshot_write(empty, SNAPSHOT_PATH, 0));
+    g_hash_table_destroy(empty);
+    snapshot = g_hash_table_snapshot_open(SNAPSHOT_PATH);
+    assert(snapshot);
+    assert(g_hash_table_snapshot_verify(snapshot));
+    assert(g_hash_table_snapshot_size(snapshot) == 0);
+    assert(g_hash_table_snapshot_lookup(snapshot, "key-1") == NULL);
+    assert(snapshot->size < file_size);
+    g_hash_table_snapshot_close(snapshot);
+
+    remove(SNAPSHOT_PATH);
+    assert(g_hash_table_snapshot_open(SNAPSHOT_PATH) == NULL);
+
+    return 0;
+}
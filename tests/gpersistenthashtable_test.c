@@ -0,0 +1,292 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <miniglib.h>
+
+#define KEY(i) ((void*) (uintptr_t) (i))
+#define NUM_KEYS 2000
+#define NUM_OPS 40000
+#define NUM_VERSIONS 8
+#define NUM_READERS 4
+#define NUM_ROUNDS 200
+#define KEYS_PER_ROUND 64
+
+static atomic_uint values_created = 0;
+static atomic_uint values_destroyed = 0;
+static atomic_bool publisher_done = false;
+
+static void destroy_value(void *value) {
+    atomic_fetch_add(&values_destroyed, 1);
+    free(value);
+}
+
+static uintptr_t *new_value(uintptr_t v) {
+    uintptr_t *value = malloc(sizeof(uintptr_t));
+    *value = v;
+    atomic_fetch_add(&values_created, 1);
+    return value;
+}
+
+// four keys share each full hash value, so leaves end up in collision nodes
+static uint32_t colliding_hash(void *key) {
+    return (uint32_t) (uintptr_t) key >> 2;
+}
+
+static void count_entry(void *key, void *value, void *user_data) {
+    (void) key;
+    (void) value;
+    (*(uint32_t*) user_data)++;
+}
+
+static atomic_uint keys_destroyed = 0;
+
+static void destroy_key(void *key) {
+    atomic_fetch_add(&keys_destroyed, 1);
+    free(key);
+}
+
+static char *new_key(const char *name) {
+    size_t len = strlen(name) + 1;
+    return memcpy(malloc(len), name, len);
+}
+
+// replacing a key keeps the stored key, which every version holding it
+// shares, whichever version goes first
+static void check_replaced_keys(bool oldest_first) {
+    uint32_t destroyed = atomic_load(&keys_destroyed);
+    char *key = new_key("key");
+
+    GPersistentHashTable *v0 = g_persistent_hash_table_new_full(g_str_hash, g_str_equal, destroy_key, destroy_value);
+    GPersistentHashTable *v1 = g_persistent_hash_table_insert(v0, key, new_value(1));
+    // the same key pointer again
+    GPersistentHashTable *v2 = g_persistent_hash_table_insert(v1, key, new_value(2));
+    // an equal key, destroyed right away
+    GPersistentHashTable *v3 = g_persistent_hash_table_insert(v2, new_key("key"), new_value(3));
+    assert(atomic_load(&keys_destroyed) == destroyed + 1);
+
+    // the value the key already maps to leaves the version as it is
+    uintptr_t *value = g_persistent_hash_table_lookup(v3, "key");
+    GPersistentHashTable *same = g_persistent_hash_table_insert(v3, new_key("key"), value);
+    assert(same == v3 && atomic_load(&keys_destroyed) == destroyed + 2);
+    g_persistent_hash_table_unref(same);
+
+    void *orig_key = NULL;
+    assert(g_persistent_hash_table_lookup_extended(v3, "key", &orig_key, NULL) && orig_key == key);
+
+    GPersistentHashTable *versions[] = {v0, v1, v2, v3};
+    for (int i = 0; i < 4; i++) {
+        GPersistentHashTable *version = versions[oldest_first ? i : 3 - i];
+        g_persistent_hash_table_unref(version);
+
+        for (int j = oldest_first ? i + 1 : 1; j < (oldest_first ? 4 : 3 - i); j++) {
+            assert(*(uintptr_t*) g_persistent_hash_table_lookup(versions[j], "key") == (uintptr_t) j);
+        }
+    }
+
+    assert(atomic_load(&keys_destroyed) == destroyed + 3);
+    assert(atomic_load(&values_destroyed) == atomic_load(&values_created));
+}
+
+// expected[i] is the value of KEY(i), 0 if it is missing
+static void check_version(GPersistentHashTable *version, const uintptr_t *expected) {
+    uint32_t size = 0;
+
+    for (uintptr_t i = 0; i < NUM_KEYS; i++) {
+        uintptr_t *value = g_persistent_hash_table_lookup(version, KEY(i));
+
+        if (expected[i]) {
+            assert(value && *value == expected[i]);
+            size++;
+        } else {
+            assert(value == NULL);
+            assert(!g_persistent_hash_table_contains(version, KEY(i)));
+        }
+    }
+
+    assert(g_persistent_hash_table_size(version) == size);
+
+    uint32_t visited = 0;
+    g_persistent_hash_table_foreach(version, count_entry, &visited);
+    assert(visited == size);
+}
+
+// random inserts and removes checked against GHashTable, with a few versions
+// kept along the way that must not change afterwards
+static void check_random_ops(GHashFunc hash_func) {
+    static uintptr_t saved[NUM_VERSIONS][NUM_KEYS];
+    GPersistentHashTable *versions[NUM_VERSIONS];
+    uint32_t num_versions = 0;
+
+    GPersistentHashTable *version = g_persistent_hash_table_new_full(hash_func, g_int_equal, NULL, destroy_value);
+    GHashTable *reference = g_hash_table_new(g_int_hash, g_int_equal);
+    uint64_t state = 88172645463325252ull;
+
+    for (uint32_t op = 0; op < NUM_OPS; op++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        uintptr_t key = state % NUM_KEYS;
+        GPersistentHashTable *next;
+
+        if (state >> 62) {
+            next = g_persistent_hash_table_insert(version, KEY(key), new_value(op + 1));
+            g_hash_table_insert(reference, KEY(key), KEY(op + 1));
+        } else {
+            next = g_persistent_hash_table_remove(version, KEY(key));
+            g_hash_table_remove(reference, KEY(key));
+        }
+
+        g_persistent_hash_table_unref(version);
+        version = next;
+        assert(g_persistent_hash_table_size(version) == g_hash_table_size(reference));
+
+        if ((op + 1) % (NUM_OPS / NUM_VERSIONS) == 0) {
+            for (uintptr_t i = 0; i < NUM_KEYS; i++) {
+                saved[num_versions][i] = (uintptr_t) g_hash_table_lookup(reference, KEY(i));
+            }
+            versions[num_versions++] = g_persistent_hash_table_ref(version);
+        }
+    }
+
+    for (uint32_t i = 0; i < num_versions; i++) {
+        check_version(versions[i], saved[i]);
+    }
+
+    // removing everything leaves an empty version
+    for (uintptr_t i = 0; i < NUM_KEYS; i++) {
+        GPersistentHashTable *next = g_persistent_hash_table_remove(version, KEY(i));
+        g_persistent_hash_table_unref(version);
+        version = next;
+    }
+    assert(g_persistent_hash_table_size(version) == 0);
+    assert(version->root == NULL);
+
+    for (uint32_t i = 0; i < num_versions; i++) {
+        check_version(versions[i], saved[i]);
+        g_persistent_hash_table_unref(versions[i]);
+    }
+
+    g_persistent_hash_table_unref(version);
+    g_hash_table_destroy(reference);
+}
+
+// every published version maps all keys to the same round, so a reader that
+// sees two different rounds saw a torn or freed version
+static int publisher(void *data) {
+    _Atomic(GPersistentHashTable*) *current = data;
+
+    for (uintptr_t round = 2; round <= NUM_ROUNDS; round++) {
+        GPersistentHashTable *version = g_persistent_hash_table_acquire(current);
+
+        for (uintptr_t i = 0; i < KEYS_PER_ROUND; i++) {
+            GPersistentHashTable *next = g_persistent_hash_table_insert(version, KEY(i), new_value(round));
+            g_persistent_hash_table_unref(version);
+            version = next;
+        }
+
+        g_persistent_hash_table_publish(current, version);
+    }
+
+    atomic_store(&publisher_done, true);
+
+    return 0;
+}
+
+static int reader(void *data) {
+    _Atomic(GPersistentHashTable*) *current = data;
+    uintptr_t last_round = 1;
+
+    while (!atomic_load(&publisher_done)) {
+        GPersistentHashTable *version = g_persistent_hash_table_acquire(current);
+        uintptr_t round = *(uintptr_t*) g_persistent_hash_table_lookup(version, KEY(0));
+
+        assert(round >= last_round);
+        assert(g_persistent_hash_table_size(version) == KEYS_PER_ROUND);
+        for (uintptr_t i = 1; i < KEYS_PER_ROUND; i++) {
+            assert(*(uintptr_t*) g_persistent_hash_table_lookup(version, KEY(i)) == round);
+        }
+
+        g_persistent_hash_table_unref(version);
+        last_round = round;
+
+        // or read it in place without taking a reference
+        g_concurrent_hash_table_pin();
+        version = atomic_load(current);
+        assert(*(uintptr_t*) g_persistent_hash_table_lookup(version, KEY(KEYS_PER_ROUND - 1)) >= last_round);
+        g_concurrent_hash_table_unpin();
+    }
+
+    return 0;
+}
+
+int gpersistenthashtable_test(int argc, char** argv) {
+    GPersistentHashTable *empty = g_persistent_hash_table_new(g_int_hash, g_int_equal);
+    assert(g_persistent_hash_table_size(empty) == 0);
+    assert(g_persistent_hash_table_lookup(empty, KEY(1)) == NULL);
+
+    GPersistentHashTable *one = g_persistent_hash_table_insert(empty, KEY(1), KEY(2));
+    GPersistentHashTable *two = g_persistent_hash_table_insert(one, KEY(1), KEY(3));
+    assert(g_persistent_hash_table_lookup(empty, KEY(1)) == NULL);
+    assert(g_persistent_hash_table_lookup(one, KEY(1)) == KEY(2));
+    assert(g_persistent_hash_table_lookup(two, KEY(1)) == KEY(3));
+    assert(g_persistent_hash_table_size(two) == 1);
+
+    // removing a missing key returns the same version
+    GPersistentHashTable *same = g_persistent_hash_table_remove(two, KEY(5));
+    assert(same == two);
+    g_persistent_hash_table_unref(same);
+
+    void *orig_key = NULL, *value = NULL;
+    assert(g_persistent_hash_table_lookup_extended(two, KEY(1), &orig_key, &value));
+    assert(orig_key == KEY(1) && value == KEY(3));
+    assert(!g_persistent_hash_table_lookup_extended(two, KEY(4), &orig_key, &value));
+
+    g_persistent_hash_table_unref(two);
+    g_persistent_hash_table_unref(one);
+    g_persistent_hash_table_unref(empty);
+
+    check_replaced_keys(true);
+    check_replaced_keys(false);
+
+    check_random_ops(g_int_hash);
+    check_random_ops(colliding_hash);
+
+    // values are destroyed exactly once, after the last version holding them
+    assert(atomic_load(&values_destroyed) == atomic_load(&values_created));
+
+    _Atomic(GPersistentHashTable*) current = NULL;
+    assert(g_persistent_hash_table_acquire(&current) == NULL);
+
+    GPersistentHashTable *first = g_persistent_hash_table_new_full(g_int_hash, g_int_equal, NULL, destroy_value);
+    for (uintptr_t i = 0; i < KEYS_PER_ROUND; i++) {
+        GPersistentHashTable *next = g_persistent_hash_table_insert(first, KEY(i), new_value(1));
+        g_persistent_hash_table_unref(first);
+        first = next;
+    }
+    g_persistent_hash_table_publish(&current, first);
+
+    thrd_t readers[NUM_READERS];
+    thrd_t writer;
+
+    for (int i = 0; i < NUM_READERS; i++) {
+        assert(thrd_create(&readers[i], reader, &current) == thrd_success);
+    }
+    assert(thrd_create(&writer, publisher, &current) == thrd_success);
+
+    assert(thrd_join(writer, NULL) == thrd_success);
+    for (int i = 0; i < NUM_READERS; i++) {
+        assert(thrd_join(readers[i], NULL) == thrd_success);
+    }
+
+    GPersistentHashTable *last = atomic_load(&current);
+    assert(*(uintptr_t*) g_persistent_hash_table_lookup(last, KEY(0)) == NUM_ROUNDS);
+    g_persistent_hash_table_unref(last);
+    assert(atomic_load(&values_destroyed) == atomic_load(&values_created));
+
+    return 0;
+}